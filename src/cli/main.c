@@ -0,0 +1,732 @@
+#include "diff.h"
+#include "hdr.h"
+#include "jobs.h"
+#include "metrics.h"
+
+#include "dyn.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+// --------------------------------------------------------------------------------------
+// Pairs
+
+typedef enum PairStatus
+{
+    PAIRSTATUS_PENDING = 0,
+    PAIRSTATUS_OK,
+    PAIRSTATUS_MISSING1, // only in the second directory
+    PAIRSTATUS_MISSING2, // only in the first directory
+    PAIRSTATUS_LOADFAILED,
+    PAIRSTATUS_MISMATCH // dimensions differ
+} PairStatus;
+
+static const char * pairStatusNames[] = { "pending", "ok", "missing1", "missing2", "loadFailed", "mismatch" };
+
+// Longest side of the diff previews written by --preview
+static const int PREVIEW_SIZE = 1024;
+
+typedef struct DiffPair
+{
+    char * name;
+    PairStatus status;
+    char * error; // colorist's diagnostic, if a load failed
+
+    int width;
+    int height;
+    int depth;
+    int pixelCount;
+    int matchCount;
+    int underThresholdCount;
+    int overThresholdCount;
+    int largestChannelDiff;
+    int identical; // byte for byte, found by the diff's tile pass
+
+    int metricsValid;
+    double psnr;
+    double psnrPQ;
+    double ssim;
+    double deltaEITPMean;
+    double deltaEITPMax;
+    double deltaE2000Mean;
+    double deltaE2000Max;
+
+    int lightValid;
+    HDRLightLevels light[2];      // of image1 and image2
+    HDRContentLightLevel clli[2]; // declared by their files
+
+    double loadSeconds;
+    double diffSeconds;
+} DiffPair;
+
+typedef struct DiffBatch
+{
+    const char * dir1;
+    const char * dir2;
+    DiffPair * pairs;
+    int workerCount;
+    int workerJobs; // jobs each worker's context splits a single diff into
+    int defaultLuminance;
+    int threshold;
+    int metrics;
+    int light;               // also measure both images' light levels, checked against their CLLI
+    const char * previewDir; // where to write each pair's diff preview, NULL for none
+} DiffBatch;
+
+static int compareNames(const void * a, const void * b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static int compareWorst(const void * a, const void * b)
+{
+    const DiffPair * pair1 = *(const DiffPair **)a;
+    const DiffPair * pair2 = *(const DiffPair **)b;
+    if (pair1->overThresholdCount != pair2->overThresholdCount) {
+        return (pair1->overThresholdCount < pair2->overThresholdCount) ? 1 : -1;
+    }
+    if (pair1->largestChannelDiff != pair2->largestChannelDiff) {
+        return (pair1->largestChannelDiff < pair2->largestChannelDiff) ? 1 : -1;
+    }
+    return strcmp(pair1->name, pair2->name);
+}
+
+// Fills names with the (sorted) regular, non hidden files in dir. Returns 0 if dir can't be read.
+static int listDirectory(const char * dir, char *** names)
+{
+#ifdef _WIN32
+    char * wildcard = NULL;
+    dsPrintf(&wildcard, "%s\\*", dir);
+    WIN32_FIND_DATAA wfd;
+    HANDLE hFind = FindFirstFileA(wildcard, &wfd);
+    dsDestroy(&wildcard);
+    if (hFind == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    do {
+        if ((wfd.dwFileAttributes & (FILE_ATTRIBUTE_DIRECTORY | FILE_ATTRIBUTE_DEVICE)) || (wfd.cFileName[0] == '.')) {
+            continue;
+        }
+        char * name = NULL;
+        dsCopy(&name, wfd.cFileName);
+        daPush(names, name);
+    } while (FindNextFileA(hFind, &wfd));
+    FindClose(hFind);
+#else
+    DIR * d = opendir(dir);
+    if (!d) {
+        return 0;
+    }
+    char * path = NULL;
+    struct dirent * entry;
+    while ((entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        struct stat st;
+        dsPrintf(&path, "%s/%s", dir, entry->d_name);
+        if (stat(path, &st) || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        char * name = NULL;
+        dsCopy(&name, entry->d_name);
+        daPush(names, name);
+    }
+    dsDestroy(&path);
+    closedir(d);
+#endif
+
+    if (daSize(names) > 1) {
+        qsort(*names, daSize(names), sizeof(char *), compareNames);
+    }
+    return 1;
+}
+
+// Merges the two sorted listings into one pair per name, flagging names missing on either side
+static void pairNames(DiffPair ** pairs, char ** names1, char ** names2)
+{
+    int index1 = 0;
+    int index2 = 0;
+    const int count1 = daSize(&names1);
+    const int count2 = daSize(&names2);
+    while ((index1 < count1) || (index2 < count2)) {
+        DiffPair pair;
+        memset(&pair, 0, sizeof(pair));
+
+        int order;
+        if (index1 >= count1) {
+            order = 1;
+        } else if (index2 >= count2) {
+            order = -1;
+        } else {
+            order = strcmp(names1[index1], names2[index2]);
+        }
+
+        if (order < 0) {
+            dsCopy(&pair.name, names1[index1++]);
+            pair.status = PAIRSTATUS_MISSING2;
+        } else if (order > 0) {
+            dsCopy(&pair.name, names2[index2++]);
+            pair.status = PAIRSTATUS_MISSING1;
+        } else {
+            dsCopy(&pair.name, names1[index1++]);
+            ++index2;
+        }
+        daPush(pairs, pair);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Workers
+
+static void writePreview(clContext * C, DiffBatch * batch, DiffPair * pair, clImage * preview)
+{
+    char * path = NULL;
+    dsPrintf(&path, "%s/%s.diff.png", batch->previewDir, pair->name);
+    clWriteParams writeParams;
+    clWriteParamsSetDefaults(C, &writeParams);
+    if (!preview || !clContextWrite(C, preview, path, "png", &writeParams)) {
+        fprintf(stderr, "WARNING: can't write %s\n", path);
+    }
+    dsDestroy(&path);
+}
+
+static int diffPairWhole(clContext * C, DiffBatch * batch, DiffPair * pair, clImage * image1, clImage * image2)
+{
+    ImageDiff * diff = diffCreate(C, image1, image2, 0.0f, batch->threshold);
+    if (!diff) {
+        return 0;
+    }
+    pair->pixelCount = diff->pixelCount;
+    pair->matchCount = diff->matchCount;
+    pair->underThresholdCount = diff->underThresholdCount;
+    pair->overThresholdCount = diff->overThresholdCount;
+    pair->largestChannelDiff = diff->largestChannelDiff;
+    pair->identical = diff->identical;
+    if (batch->previewDir) {
+        const int longest = (image1->width > image1->height) ? image1->width : image1->height;
+        const int level = diffLevelForScale(diff, (float)longest / (float)PREVIEW_SIZE);
+        writePreview(C, batch, pair, diffVisualize(C, diff, level));
+    }
+    diffDestroy(C, diff);
+    return 1;
+}
+
+static void diffPairRun(clContext * C, DiffBatch * batch, DiffPair * pair)
+{
+    Timer t;
+    char * path = NULL;
+
+    timerStart(&t);
+    dsPrintf(&path, "%s/%s", batch->dir1, pair->name);
+    clImage * image1 = clContextRead(C, path, NULL, NULL);
+    if (batch->light) {
+        hdrReadContentLightLevel(path, &pair->clli[0]);
+    }
+    dsPrintf(&path, "%s/%s", batch->dir2, pair->name);
+    clImage * image2 = clContextRead(C, path, NULL, NULL);
+    if (batch->light) {
+        hdrReadContentLightLevel(path, &pair->clli[1]);
+    }
+    dsDestroy(&path);
+    pair->loadSeconds = timerElapsedSeconds(&t);
+
+    if (!image1 || !image2) {
+        pair->status = PAIRSTATUS_LOADFAILED;
+        if (*C->readExtraInfo.diagnosticError) {
+            dsCopy(&pair->error, C->readExtraInfo.diagnosticError);
+            C->readExtraInfo.diagnosticError[0] = 0;
+        }
+    } else if ((image1->width != image2->width) || (image1->height != image2->height)) {
+        pair->status = PAIRSTATUS_MISMATCH;
+    } else {
+        timerStart(&t);
+
+        // Same as the viewer: compared in the first image's color volume
+        if (!diffPairWhole(C, batch, pair, image1, image2)) {
+            pair->status = PAIRSTATUS_LOADFAILED;
+            clImageDestroy(C, image1);
+            clImageDestroy(C, image2);
+            return;
+        }
+        pair->status = PAIRSTATUS_OK;
+        pair->width = image1->width;
+        pair->height = image1->height;
+        pair->depth = image1->depth;
+
+        DiffMetrics * metrics = NULL;
+        if (batch->metrics && pair->identical) {
+            // Nothing to measure
+            pair->metricsValid = 1;
+            pair->psnr = INFINITY;
+            pair->psnrPQ = INFINITY;
+            pair->ssim = 1.0;
+        } else if (batch->metrics) {
+            metrics = metricsCreate(C, image1, image2, 0);
+        }
+        if (metrics) {
+            pair->metricsValid = 1;
+            pair->psnr = metrics->psnr;
+            pair->psnrPQ = metrics->psnrPQ;
+            pair->ssim = metrics->ssim;
+            pair->deltaEITPMean = metrics->deltaEITPMean;
+            pair->deltaEITPMax = metrics->deltaEITPMax;
+            pair->deltaE2000Mean = metrics->deltaE2000Mean;
+            pair->deltaE2000Max = metrics->deltaE2000Max;
+            metricsDestroy(C, metrics);
+        }
+        if (batch->light) {
+            pair->lightValid = hdrMeasureLightLevels(C, image1, NULL, &pair->light[0]) && hdrMeasureLightLevels(C, image2, NULL, &pair->light[1]);
+        }
+        pair->diffSeconds = timerElapsedSeconds(&t);
+    }
+
+    if (image1) {
+        clImageDestroy(C, image1);
+    }
+    if (image2) {
+        clImageDestroy(C, image2);
+    }
+}
+
+// Each worker owns a context and walks every workerCount-th pair, so at most workerCount pairs
+// are resident at once and slow pairs don't pile up on a single worker.
+static void diffBatchWorkers(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    DiffBatch * batch = (DiffBatch *)userData;
+    const int pairCount = daSize(&batch->pairs);
+    for (int workerIndex = first; workerIndex < (first + count); ++workerIndex) {
+        clContext * C = clContextCreate(NULL);
+        C->params.jobs = batch->workerJobs;
+        if (batch->defaultLuminance > 0) {
+            C->defaultLuminance = batch->defaultLuminance;
+        }
+        for (int pairIndex = workerIndex; pairIndex < pairCount; pairIndex += batch->workerCount) {
+            DiffPair * pair = &batch->pairs[pairIndex];
+            if (pair->status == PAIRSTATUS_PENDING) {
+                diffPairRun(C, batch, pair);
+            }
+        }
+        clContextDestroy(C);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Reports
+
+static void writeJSONString(FILE * f, const char * s)
+{
+    fputc('"', f);
+    for (; *s; ++s) {
+        const unsigned char c = (unsigned char)*s;
+        if ((c == '"') || (c == '\\')) {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// JSON has no infinity, identical pairs report a null PSNR
+static void writeJSONNumber(FILE * f, double v)
+{
+    if (isfinite(v)) {
+        fprintf(f, "%.6g", v);
+    } else {
+        fprintf(f, "null");
+    }
+}
+
+static void writeJSONLight(FILE * f, int index, const HDRLightLevels * levels, const HDRContentLightLevel * clli)
+{
+    fprintf(f,
+            ", \"light%d\": { \"maxCLL\": %.6g, \"maxFALL\": %.6g, \"p50\": %.6g, \"p90\": %.6g, \"p99\": %.6g, \"p999\": %.6g, \"clli\": ",
+            index,
+            levels->maxCLL,
+            levels->maxFALL,
+            levels->p50,
+            levels->p90,
+            levels->p99,
+            levels->p999);
+    if (clli->present) {
+        fprintf(f,
+                "{ \"maxCLL\": %.6g, \"maxFALL\": %.6g, \"valid\": %s } }",
+                clli->maxCLL,
+                clli->maxFALL,
+                hdrContentLightLevelValid(clli, levels) ? "true" : "false");
+    } else {
+        fprintf(f, "null }");
+    }
+}
+
+static void writeJSON(FILE * f, DiffBatch * batch, DiffPair ** worst, int worstCount, double seconds)
+{
+    const int pairCount = daSize(&batch->pairs);
+
+    fprintf(f, "{\n  \"dir1\": ");
+    writeJSONString(f, batch->dir1);
+    fprintf(f, ",\n  \"dir2\": ");
+    writeJSONString(f, batch->dir2);
+    fprintf(f, ",\n  \"threshold\": %d,\n  \"workers\": %d,\n  \"seconds\": %.3f,\n", batch->threshold, batch->workerCount, seconds);
+
+    fprintf(f, "  \"pairs\": [");
+    for (int i = 0; i < pairCount; ++i) {
+        DiffPair * pair = &batch->pairs[i];
+        fprintf(f, "%s\n    { \"name\": ", i ? "," : "");
+        writeJSONString(f, pair->name);
+        fprintf(f, ", \"status\": \"%s\"", pairStatusNames[pair->status]);
+        if (pair->error) {
+            fprintf(f, ", \"error\": ");
+            writeJSONString(f, pair->error);
+        }
+        if (pair->status == PAIRSTATUS_OK) {
+            fprintf(f,
+                    ", \"identical\": %s, \"width\": %d, \"height\": %d, \"depth\": %d, \"pixelCount\": %d, \"matchCount\": %d"
+                    ", \"underThresholdCount\": %d, \"overThresholdCount\": %d, \"largestChannelDiff\": %d",
+                    pair->identical ? "true" : "false",
+                    pair->width,
+                    pair->height,
+                    pair->depth,
+                    pair->pixelCount,
+                    pair->matchCount,
+                    pair->underThresholdCount,
+                    pair->overThresholdCount,
+                    pair->largestChannelDiff);
+            if (pair->metricsValid) {
+                fprintf(f, ", \"psnr\": ");
+                writeJSONNumber(f, pair->psnr);
+                fprintf(f, ", \"psnrPQ\": ");
+                writeJSONNumber(f, pair->psnrPQ);
+                fprintf(f, ", \"ssim\": ");
+                writeJSONNumber(f, pair->ssim);
+                fprintf(f, ", \"deltaEITPMean\": ");
+                writeJSONNumber(f, pair->deltaEITPMean);
+                fprintf(f, ", \"deltaEITPMax\": ");
+                writeJSONNumber(f, pair->deltaEITPMax);
+                fprintf(f, ", \"deltaE2000Mean\": ");
+                writeJSONNumber(f, pair->deltaE2000Mean);
+                fprintf(f, ", \"deltaE2000Max\": ");
+                writeJSONNumber(f, pair->deltaE2000Max);
+            }
+            if (pair->lightValid) {
+                writeJSONLight(f, 1, &pair->light[0], &pair->clli[0]);
+                writeJSONLight(f, 2, &pair->light[1], &pair->clli[1]);
+            }
+        }
+        fprintf(f, ", \"loadSeconds\": %.4f, \"diffSeconds\": %.4f }", pair->loadSeconds, pair->diffSeconds);
+    }
+    fprintf(f, "\n  ],\n");
+
+    fprintf(f, "  \"worst\": [");
+    for (int i = 0; i < worstCount; ++i) {
+        fprintf(f, "%s\n    { \"name\": ", i ? "," : "");
+        writeJSONString(f, worst[i]->name);
+        fprintf(f,
+                ", \"overThresholdCount\": %d, \"largestChannelDiff\": %d }",
+                worst[i]->overThresholdCount,
+                worst[i]->largestChannelDiff);
+    }
+    fprintf(f, "%s]\n}\n", worstCount ? "\n  " : "");
+}
+
+static void writeCSVString(FILE * f, const char * s)
+{
+    fputc('"', f);
+    for (; *s; ++s) {
+        if (*s == '"') {
+            fputc('"', f);
+        }
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void writeCSV(FILE * f, DiffBatch * batch)
+{
+    const int pairCount = daSize(&batch->pairs);
+    fprintf(f,
+            "name,status,identical,width,height,depth,pixelCount,matchCount,underThresholdCount,overThresholdCount,largestChannelDiff,"
+            "psnr,psnrPQ,ssim,deltaEITPMean,deltaEITPMax,deltaE2000Mean,deltaE2000Max,loadSeconds,diffSeconds,"
+            "maxCLL1,maxFALL1,p50_1,p90_1,p99_1,p999_1,clliMaxCLL1,clliMaxFALL1,clliValid1,"
+            "maxCLL2,maxFALL2,p50_2,p90_2,p99_2,p999_2,clliMaxCLL2,clliMaxFALL2,clliValid2\n");
+    for (int i = 0; i < pairCount; ++i) {
+        DiffPair * pair = &batch->pairs[i];
+        writeCSVString(f, pair->name);
+        fprintf(f, ",%s", pairStatusNames[pair->status]);
+        if (pair->status == PAIRSTATUS_OK) {
+            fprintf(f,
+                    ",%d,%d,%d,%d,%d,%d,%d,%d,%d",
+                    pair->identical,
+                    pair->width,
+                    pair->height,
+                    pair->depth,
+                    pair->pixelCount,
+                    pair->matchCount,
+                    pair->underThresholdCount,
+                    pair->overThresholdCount,
+                    pair->largestChannelDiff);
+        } else {
+            fprintf(f, ",,,,,,,,,");
+        }
+        if (pair->metricsValid) {
+            fprintf(f,
+                    ",%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g",
+                    pair->psnr,
+                    pair->psnrPQ,
+                    pair->ssim,
+                    pair->deltaEITPMean,
+                    pair->deltaEITPMax,
+                    pair->deltaE2000Mean,
+                    pair->deltaE2000Max);
+        } else {
+            fprintf(f, ",,,,,,,");
+        }
+        fprintf(f, ",%.4f,%.4f", pair->loadSeconds, pair->diffSeconds);
+        for (int j = 0; j < 2; ++j) {
+            const HDRLightLevels * levels = &pair->light[j];
+            const HDRContentLightLevel * clli = &pair->clli[j];
+            if (pair->lightValid) {
+                fprintf(f, ",%.6g,%.6g,%.6g,%.6g,%.6g,%.6g", levels->maxCLL, levels->maxFALL, levels->p50, levels->p90, levels->p99, levels->p999);
+            } else {
+                fprintf(f, ",,,,,,");
+            }
+            if (pair->lightValid && clli->present) {
+                fprintf(f, ",%.6g,%.6g,%d", clli->maxCLL, clli->maxFALL, hdrContentLightLevelValid(clli, levels));
+            } else {
+                fprintf(f, ",,,");
+            }
+        }
+        fputc('\n', f);
+    }
+}
+
+// "-" writes to stdout
+static int writeReport(const char * filename, DiffBatch * batch, DiffPair ** worst, int worstCount, double seconds, int json)
+{
+    FILE * f = stdout;
+    if (strcmp(filename, "-")) {
+        f = fopen(filename, "w");
+        if (!f) {
+            fprintf(stderr, "ERROR: can't write %s\n", filename);
+            return 0;
+        }
+    }
+    if (json) {
+        writeJSON(f, batch, worst, worstCount, seconds);
+    } else {
+        writeCSV(f, batch);
+    }
+    if (f != stdout) {
+        fclose(f);
+    }
+    return 1;
+}
+
+// --------------------------------------------------------------------------------------
+// Main
+
+static void printUsage(void)
+{
+    fprintf(stderr,
+            "Syntax: vantage-diff [options] dir1 dir2\n"
+            "Diffs every file in dir1 against the file of the same name in dir2.\n"
+            "Options:\n"
+            "    -j JOBS         : concurrent pairs (default: one per core)\n"
+            "    -t THRESHOLD    : largest channel diff still counted as under threshold (default: 0)\n"
+            "    -l LUMINANCE    : luminance assumed for images without one, in nits\n"
+            "    -m, --metrics   : also measure PSNR, SSIM and delta E (slower)\n"
+            "    --light         : also measure MaxCLL, MaxFALL and luminance percentiles of both images, failing any\n"
+            "                      that exceed the CLLI their file declares\n"
+            "    -w COUNT        : number of worst pairs to summarize (default: 10)\n"
+            "    --preview DIR   : write each pair's downsampled diff preview to DIR/NAME.diff.png\n"
+            "    --json FILE     : write a JSON report (- for stdout)\n"
+            "    --csv FILE      : write a CSV report (- for stdout)\n");
+}
+
+int main(int argc, char * argv[])
+{
+    DiffBatch batch;
+    memset(&batch, 0, sizeof(batch));
+    int jobs = 0;
+    int worstMax = 10;
+    const char * jsonFilename = NULL;
+    const char * csvFilename = NULL;
+
+    for (int argIndex = 1; argIndex < argc; ++argIndex) {
+        const char * arg = argv[argIndex];
+        const int hasValue = (argIndex + 1) < argc;
+        if (!strcmp(arg, "-j") && hasValue) {
+            jobs = atoi(argv[++argIndex]);
+        } else if (!strcmp(arg, "-t") && hasValue) {
+            batch.threshold = atoi(argv[++argIndex]);
+        } else if (!strcmp(arg, "-l") && hasValue) {
+            batch.defaultLuminance = atoi(argv[++argIndex]);
+        } else if (!strcmp(arg, "-m") || !strcmp(arg, "--metrics")) {
+            batch.metrics = 1;
+        } else if (!strcmp(arg, "-w") && hasValue) {
+            worstMax = atoi(argv[++argIndex]);
+        } else if (!strcmp(arg, "--light")) {
+            batch.light = 1;
+        } else if (!strcmp(arg, "--preview") && hasValue) {
+            batch.previewDir = argv[++argIndex];
+        } else if (!strcmp(arg, "--json") && hasValue) {
+            jsonFilename = argv[++argIndex];
+        } else if (!strcmp(arg, "--csv") && hasValue) {
+            csvFilename = argv[++argIndex];
+        } else if ((arg[0] == '-') && arg[1]) {
+            printUsage();
+            return 2;
+        } else if (!batch.dir1) {
+            batch.dir1 = arg;
+        } else if (!batch.dir2) {
+            batch.dir2 = arg;
+        } else {
+            printUsage();
+            return 2;
+        }
+    }
+    if (!batch.dir1 || !batch.dir2) {
+        printUsage();
+        return 2;
+    }
+
+    char ** names1 = NULL;
+    char ** names2 = NULL;
+    daCreate(&names1, 0);
+    daCreate(&names2, 0);
+    if (!listDirectory(batch.dir1, &names1) || !listDirectory(batch.dir2, &names2)) {
+        fprintf(stderr, "ERROR: can't read %s\n", daSize(&names1) ? batch.dir2 : batch.dir1);
+        daDestroy(&names1, dsDestroyIndirect);
+        daDestroy(&names2, dsDestroyIndirect);
+        return 2;
+    }
+    daCreate(&batch.pairs, sizeof(DiffPair));
+    pairNames(&batch.pairs, names1, names2);
+    daDestroy(&names1, dsDestroyIndirect);
+    daDestroy(&names2, dsDestroyIndirect);
+    const int pairCount = daSize(&batch.pairs);
+
+    // Split the cores between concurrent pairs, leftovers go to each pair's own diff
+    clContext * C = clContextCreate(NULL);
+    C->params.jobs = 0;
+    const int coreCount = jobsCount(C);
+    batch.workerCount = (jobs > 0) ? jobs : coreCount;
+    if (batch.workerCount > pairCount) {
+        batch.workerCount = (pairCount > 0) ? pairCount : 1;
+    }
+    batch.workerJobs = coreCount / batch.workerCount;
+    if (batch.workerJobs < 1) {
+        batch.workerJobs = 1;
+    }
+
+    Timer t;
+    timerStart(&t);
+    C->params.jobs = batch.workerCount;
+    jobsParallelFor(C, batch.workerCount, diffBatchWorkers, &batch);
+    const double seconds = timerElapsedSeconds(&t);
+
+    int identicalCount = 0;
+    int underCount = 0;
+    int failedCount = 0;
+    int clliFailedCount = 0;
+    DiffPair ** worst = (DiffPair **)calloc(pairCount + 1, sizeof(DiffPair *));
+    int worstCount = 0;
+    for (int i = 0; i < pairCount; ++i) {
+        DiffPair * pair = &batch.pairs[i];
+        if (pair->lightValid) {
+            clliFailedCount += !hdrContentLightLevelValid(&pair->clli[0], &pair->light[0]);
+            clliFailedCount += !hdrContentLightLevelValid(&pair->clli[1], &pair->light[1]);
+        }
+        if (pair->status != PAIRSTATUS_OK) {
+            ++failedCount;
+        } else if (pair->matchCount == pair->pixelCount) {
+            ++identicalCount;
+        } else if (pair->overThresholdCount == 0) {
+            ++underCount;
+        } else {
+            worst[worstCount++] = pair;
+        }
+    }
+    const int overCount = worstCount;
+    if (worstCount > 1) {
+        qsort(worst, worstCount, sizeof(DiffPair *), compareWorst);
+    }
+    if (worstCount > worstMax) {
+        worstCount = (worstMax > 0) ? worstMax : 0;
+    }
+
+    int result = ((failedCount > 0) || (overCount > 0) || (clliFailedCount > 0)) ? 1 : 0;
+    if (jsonFilename && !writeReport(jsonFilename, &batch, worst, worstCount, seconds, 1)) {
+        result = 2;
+    }
+    if (csvFilename && !writeReport(csvFilename, &batch, worst, worstCount, seconds, 0)) {
+        result = 2;
+    }
+
+    // Keep stdout clean for a report written there
+    FILE * summary = stdout;
+    if ((jsonFilename && !strcmp(jsonFilename, "-")) || (csvFilename && !strcmp(csvFilename, "-"))) {
+        summary = stderr;
+    }
+    fprintf(summary,
+            "%d pairs in %.2fs (%d workers): %d identical, %d under threshold, %d over threshold, %d failed\n",
+            pairCount,
+            seconds,
+            batch.workerCount,
+            identicalCount,
+            underCount,
+            overCount,
+            failedCount);
+    for (int i = 0; i < worstCount; ++i) {
+        fprintf(summary,
+                "  %2d. %s: %d pixels over threshold, largest channel diff %d\n",
+                i + 1,
+                worst[i]->name,
+                worst[i]->overThresholdCount,
+                worst[i]->largestChannelDiff);
+    }
+    for (int i = 0; i < pairCount; ++i) {
+        DiffPair * pair = &batch.pairs[i];
+        if (pair->status != PAIRSTATUS_OK) {
+            fprintf(summary, "  %s: %s%s%s\n", pair->name, pairStatusNames[pair->status], pair->error ? ", " : "", pair->error ? pair->error : "");
+        }
+    }
+    for (int i = 0; (i < pairCount) && (clliFailedCount > 0); ++i) {
+        DiffPair * pair = &batch.pairs[i];
+        for (int j = 0; (j < 2) && pair->lightValid; ++j) {
+            if (!hdrContentLightLevelValid(&pair->clli[j], &pair->light[j])) {
+                fprintf(summary,
+                        "  %s (%s): MaxCLL %.1f, MaxFALL %.1f over its CLLI of %.0f, %.0f nits\n",
+                        pair->name,
+                        j ? batch.dir2 : batch.dir1,
+                        pair->light[j].maxCLL,
+                        pair->light[j].maxFALL,
+                        pair->clli[j].maxCLL,
+                        pair->clli[j].maxFALL);
+            }
+        }
+    }
+
+    free(worst);
+    for (int i = 0; i < pairCount; ++i) {
+        dsDestroy(&batch.pairs[i].name);
+        dsDestroy(&batch.pairs[i].error);
+    }
+    daDestroy(&batch.pairs, NULL);
+    clContextDestroy(C);
+    return result;
+}
@@ -0,0 +1,404 @@
+#include "align.h"
+
+#include "jobs.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Longest side of the downsampled luminance the translation is first found on
+static const int ALIGN_COARSE_SIZE = 512;
+
+// Side of the full resolution window the coarse translation is refined on
+static const int ALIGN_FINE_SIZE = 256;
+
+// Smallest refinement window worth correlating
+static const int ALIGN_FINE_MIN_SIZE = 32;
+
+// Peak heights under this are indistinguishable from unrelated images
+static const float ALIGN_MIN_CONFIDENCE = 0.05f;
+
+// --------------------------------------------------------------------------------------
+// FFT
+
+// Square complex plane, size is a power of two
+typedef struct AlignPlane
+{
+    float * re;
+    float * im;
+    int size;
+} AlignPlane;
+
+static void alignPlaneInit(AlignPlane * plane, int size)
+{
+    plane->size = size;
+    plane->re = (float *)calloc((size_t)size * size, sizeof(float));
+    plane->im = (float *)calloc((size_t)size * size, sizeof(float));
+}
+
+static void alignPlaneDestroy(AlignPlane * plane)
+{
+    free(plane->re);
+    free(plane->im);
+}
+
+typedef struct AlignFFT
+{
+    AlignPlane * plane;
+    int inverse;
+    float * cosTable; // size / 2 twiddles
+    float * sinTable;
+    float * scratch;  // a column's re and im per job
+} AlignFFT;
+
+// In place iterative radix-2 transform of n (a power of two) contiguous values
+static void alignFFT1D(const AlignFFT * fft, float * re, float * im, int n)
+{
+    for (int i = 1, j = 0; i < n; ++i) {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (int length = 2; length <= n; length <<= 1) {
+        const int half = length >> 1;
+        const int step = n / length;
+        for (int i = 0; i < n; i += length) {
+            for (int k = 0; k < half; ++k) {
+                const float wr = fft->cosTable[k * step];
+                const float wi = fft->inverse ? fft->sinTable[k * step] : -fft->sinTable[k * step];
+                const int a = i + k;
+                const int b = a + half;
+                const float tr = (re[b] * wr) - (im[b] * wi);
+                const float ti = (re[b] * wi) + (im[b] * wr);
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+static void alignFFTRows(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    AlignFFT * fft = (AlignFFT *)userData;
+    const int size = fft->plane->size;
+    for (int y = first; y < (first + count); ++y) {
+        alignFFT1D(fft, &fft->plane->re[(size_t)y * size], &fft->plane->im[(size_t)y * size], size);
+    }
+}
+
+static void alignFFTColumns(void * userData, int jobIndex, int first, int count)
+{
+    AlignFFT * fft = (AlignFFT *)userData;
+    const int size = fft->plane->size;
+    float * re = &fft->scratch[(size_t)jobIndex * size * 2];
+    float * im = re + size;
+    for (int x = first; x < (first + count); ++x) {
+        for (int y = 0; y < size; ++y) {
+            re[y] = fft->plane->re[((size_t)y * size) + x];
+            im[y] = fft->plane->im[((size_t)y * size) + x];
+        }
+        alignFFT1D(fft, re, im, size);
+        for (int y = 0; y < size; ++y) {
+            fft->plane->re[((size_t)y * size) + x] = re[y];
+            fft->plane->im[((size_t)y * size) + x] = im[y];
+        }
+    }
+}
+
+// Unscaled, so an inverse transform comes back size * size times larger
+static void alignFFT2D(clContext * C, AlignPlane * plane, int inverse)
+{
+    const int size = plane->size;
+    AlignFFT fft;
+    fft.plane = plane;
+    fft.inverse = inverse;
+    fft.cosTable = (float *)malloc(sizeof(float) * (size / 2));
+    fft.sinTable = (float *)malloc(sizeof(float) * (size / 2));
+    for (int k = 0; k < (size / 2); ++k) {
+        const double angle = 2.0 * 3.14159265358979323846 * k / size;
+        fft.cosTable[k] = (float)cos(angle);
+        fft.sinTable[k] = (float)sin(angle);
+    }
+    fft.scratch = (float *)malloc(sizeof(float) * jobsCount(C) * size * 2);
+
+    jobsParallelFor(C, size, alignFFTRows, &fft);
+    jobsParallelFor(C, size, alignFFTColumns, &fft);
+
+    free(fft.cosTable);
+    free(fft.sinTable);
+    free(fft.scratch);
+}
+
+// --------------------------------------------------------------------------------------
+// Luminance
+
+typedef struct AlignLuma
+{
+    clImage * image;
+    AlignPlane * plane;
+    int x; // source region
+    int y;
+    int factor; // box filtered factor x factor blocks per plane pixel
+    int w;      // plane pixels written
+    int h;
+} AlignLuma;
+
+static void alignLumaRows(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    AlignLuma * al = (AlignLuma *)userData;
+    clImage * image = al->image;
+    const int depth16 = image->depth > 8;
+    const float scale = 1.0f / ((depth16 ? 65535.0f : 255.0f) * (float)(al->factor * al->factor));
+    for (int py = first; py < (first + count); ++py) {
+        float * dst = &al->plane->re[(size_t)py * al->plane->size];
+        for (int px = 0; px < al->w; ++px) {
+            float sum = 0.0f;
+            for (int by = 0; by < al->factor; ++by) {
+                const size_t row = (size_t)(al->y + (py * al->factor) + by) * image->width;
+                for (int bx = 0; bx < al->factor; ++bx) {
+                    const size_t index = (row + al->x + (px * al->factor) + bx) * 4;
+                    if (depth16) {
+                        const uint16_t * p = &image->pixelsU16[index];
+                        sum += (0.2126f * p[0]) + (0.7152f * p[1]) + (0.0722f * p[2]);
+                    } else {
+                        const uint8_t * p = &image->pixelsU8[index];
+                        sum += (0.2126f * p[0]) + (0.7152f * p[1]) + (0.0722f * p[2]);
+                    }
+                }
+            }
+            dst[px] = sum * scale;
+        }
+    }
+}
+
+// Fills plane (which must be zeroed) with the luminance of a w x h region of image, box filtered
+// down by factor, then mean subtracted and Hann windowed so the region's edges don't correlate
+static void alignLumaPlane(clContext * C, clImage * image, int x, int y, int w, int h, int factor, AlignPlane * plane)
+{
+    clImagePrepareReadPixels(C, image, (image->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+
+    AlignLuma al;
+    al.image = image;
+    al.plane = plane;
+    al.x = x;
+    al.y = y;
+    al.factor = factor;
+    al.w = w / factor;
+    al.h = h / factor;
+    jobsParallelFor(C, al.h, alignLumaRows, &al);
+
+    double sum = 0.0;
+    for (int py = 0; py < al.h; ++py) {
+        for (int px = 0; px < al.w; ++px) {
+            sum += plane->re[((size_t)py * plane->size) + px];
+        }
+    }
+    const float mean = (float)(sum / ((double)al.w * al.h));
+    for (int py = 0; py < al.h; ++py) {
+        const float windowY = 0.5f - (0.5f * cosf(2.0f * 3.14159265f * (py + 0.5f) / al.h));
+        for (int px = 0; px < al.w; ++px) {
+            const float windowX = 0.5f - (0.5f * cosf(2.0f * 3.14159265f * (px + 0.5f) / al.w));
+            float * v = &plane->re[((size_t)py * plane->size) + px];
+            *v = (*v - mean) * windowX * windowY;
+        }
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Phase correlation
+
+// Offset of the parabola through three samples around a peak, in [-0.5, 0.5]
+static float alignSubPixel(float before, float peak, float after)
+{
+    const float denominator = before - (2.0f * peak) + after;
+    if (denominator >= 0.0f) {
+        return 0.0f;
+    }
+    return CL_CLAMP(0.5f * (before - after) / denominator, -0.5f, 0.5f);
+}
+
+// Where plane2's content sits relative to plane1's (wrapping to +/- size / 2), to sub-pixel.
+// Returns the peak height, 1 for identical content. Destroys both planes' contents.
+static float alignCorrelate(clContext * C, AlignPlane * plane1, AlignPlane * plane2, float * dx, float * dy)
+{
+    const int size = plane1->size;
+    const size_t count = (size_t)size * size;
+    alignFFT2D(C, plane1, 0);
+    alignFFT2D(C, plane2, 0);
+
+    // Normalized cross power spectrum, F2 * conj(F1) / |F2 * conj(F1)|
+    for (size_t i = 0; i < count; ++i) {
+        const float re = (plane2->re[i] * plane1->re[i]) + (plane2->im[i] * plane1->im[i]);
+        const float im = (plane2->im[i] * plane1->re[i]) - (plane2->re[i] * plane1->im[i]);
+        const float magnitude = sqrtf((re * re) + (im * im));
+        if (magnitude > 1e-12f) {
+            plane1->re[i] = re / magnitude;
+            plane1->im[i] = im / magnitude;
+        } else {
+            plane1->re[i] = 0.0f;
+            plane1->im[i] = 0.0f;
+        }
+    }
+    alignFFT2D(C, plane1, 1);
+
+    size_t peakIndex = 0;
+    for (size_t i = 1; i < count; ++i) {
+        if (plane1->re[i] > plane1->re[peakIndex]) {
+            peakIndex = i;
+        }
+    }
+    const int peakX = (int)(peakIndex % size);
+    const int peakY = (int)(peakIndex / size);
+    const float * c = plane1->re;
+    const float peak = c[peakIndex];
+    const float left = c[((size_t)peakY * size) + ((peakX + size - 1) % size)];
+    const float right = c[((size_t)peakY * size) + ((peakX + 1) % size)];
+    const float up = c[((size_t)((peakY + size - 1) % size) * size) + peakX];
+    const float down = c[((size_t)((peakY + 1) % size) * size) + peakX];
+    *dx = (float)((peakX > (size / 2)) ? (peakX - size) : peakX) + alignSubPixel(left, peak, right);
+    *dy = (float)((peakY > (size / 2)) ? (peakY - size) : peakY) + alignSubPixel(up, peak, down);
+    return peak / (float)count;
+}
+
+// --------------------------------------------------------------------------------------
+// Alignment
+
+static int alignPowerOfTwo(int minimum)
+{
+    int size = 1;
+    while (size < minimum) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static void alignOverlap(DiffAlignment * alignment, clImage * image1, clImage * image2, int offsetX, int offsetY)
+{
+    alignment->offsetX = offsetX;
+    alignment->offsetY = offsetY;
+    alignment->x1 = (offsetX < 0) ? -offsetX : 0;
+    alignment->y1 = (offsetY < 0) ? -offsetY : 0;
+    const int x1End = ((image2->width - offsetX) < image1->width) ? (image2->width - offsetX) : image1->width;
+    const int y1End = ((image2->height - offsetY) < image1->height) ? (image2->height - offsetY) : image1->height;
+    alignment->w = x1End - alignment->x1;
+    alignment->h = y1End - alignment->y1;
+    alignment->x2 = alignment->x1 + offsetX;
+    alignment->y2 = alignment->y1 + offsetY;
+}
+
+int alignFind(clContext * C, clImage * image1, clImage * image2, DiffAlignment * alignment)
+{
+    memset(alignment, 0, sizeof(DiffAlignment));
+
+    int longest = (image1->width > image1->height) ? image1->width : image1->height;
+    longest = (image2->width > longest) ? image2->width : longest;
+    longest = (image2->height > longest) ? image2->height : longest;
+    const int factor = (longest + ALIGN_COARSE_SIZE - 1) / ALIGN_COARSE_SIZE;
+    if ((longest / factor) < ALIGN_FINE_MIN_SIZE) {
+        return 0;
+    }
+
+    AlignPlane coarse1, coarse2;
+    const int coarseSize = alignPowerOfTwo(longest / factor);
+    alignPlaneInit(&coarse1, coarseSize);
+    alignPlaneInit(&coarse2, coarseSize);
+    alignLumaPlane(C, image1, 0, 0, image1->width, image1->height, factor, &coarse1);
+    alignLumaPlane(C, image2, 0, 0, image2->width, image2->height, factor, &coarse2);
+    float dx, dy;
+    const float confidence = alignCorrelate(C, &coarse1, &coarse2, &dx, &dy);
+    alignPlaneDestroy(&coarse1);
+    alignPlaneDestroy(&coarse2);
+    if (confidence < ALIGN_MIN_CONFIDENCE) {
+        return 0;
+    }
+    dx *= (float)factor;
+    dy *= (float)factor;
+    alignOverlap(alignment, image1, image2, (int)lroundf(dx), (int)lroundf(dy));
+
+    // The coarse peak is only good to about a block, so refine around it at full resolution
+    int fineSize = (alignment->w < alignment->h) ? alignment->w : alignment->h;
+    fineSize = (fineSize < ALIGN_FINE_SIZE) ? fineSize : ALIGN_FINE_SIZE;
+    fineSize = alignPowerOfTwo(fineSize + 1) >> 1;
+    if (fineSize >= ALIGN_FINE_MIN_SIZE) {
+        const int x = alignment->x1 + ((alignment->w - fineSize) / 2);
+        const int y = alignment->y1 + ((alignment->h - fineSize) / 2);
+        AlignPlane fine1, fine2;
+        alignPlaneInit(&fine1, fineSize);
+        alignPlaneInit(&fine2, fineSize);
+        alignLumaPlane(C, image1, x, y, fineSize, fineSize, 1, &fine1);
+        alignLumaPlane(C, image2, x + alignment->offsetX, y + alignment->offsetY, fineSize, fineSize, 1, &fine2);
+        float residualX, residualY;
+        if (alignCorrelate(C, &fine1, &fine2, &residualX, &residualY) >= ALIGN_MIN_CONFIDENCE) {
+            dx = (float)alignment->offsetX + residualX;
+            dy = (float)alignment->offsetY + residualY;
+        }
+        alignPlaneDestroy(&fine1);
+        alignPlaneDestroy(&fine2);
+    }
+
+    alignOverlap(alignment, image1, image2, (int)lroundf(dx), (int)lroundf(dy));
+    if ((alignment->w <= 0) || (alignment->h <= 0)) {
+        memset(alignment, 0, sizeof(DiffAlignment));
+        return 0;
+    }
+    alignment->dx = dx;
+    alignment->dy = dy;
+    alignment->confidence = confidence;
+    return 1;
+}
+
+clImage * alignCrop(clContext * C, clImage * image, const DiffAlignment * alignment, int second)
+{
+    const int x = second ? alignment->x2 : alignment->x1;
+    const int y = second ? alignment->y2 : alignment->y1;
+    if ((x == 0) && (y == 0) && (alignment->w == image->width) && (alignment->h == image->height)) {
+        return image;
+    }
+    clImage * cropped = clImageCrop(C, image, x, y, alignment->w, alignment->h, clTrue);
+    clImageDestroy(C, image);
+    return cropped;
+}
+
+clImage * alignReadTransform(clContext * C, clImage * image, const clReadExtraInfo * info)
+{
+    if (image == NULL) {
+        return image;
+    }
+
+    if ((info->crop[2] > 0) && (info->crop[3] > 0)) {
+        clImage * cropped = clImageCrop(C, image, info->crop[0], info->crop[1], info->crop[2], info->crop[3], clTrue);
+        if (cropped) {
+            clImageDestroy(C, image);
+            image = cropped;
+        }
+    }
+    if (info->cwRotationsNeeded) {
+        clImage * rotated = clImageRotate(C, image, info->cwRotationsNeeded);
+        clImageDestroy(C, image);
+        image = rotated;
+    }
+    if (info->mirrorNeeded) {
+        const int horizontal = (info->mirrorNeeded == 1);
+        clImage * mirrored = clImageMirror(C, image, horizontal);
+        clImageDestroy(C, image);
+        image = mirrored;
+    }
+    return image;
+}
@@ -0,0 +1,46 @@
+#ifndef ALIGN_H
+#define ALIGN_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+
+// Translation between a diff pair, and the region both images cover once it's applied. Pixel
+// (x, y) of the first image lines up with (x + offsetX, y + offsetY) of the second.
+typedef struct DiffAlignment
+{
+    float dx; // sub-pixel translation, offsetX/Y are these rounded
+    float dy;
+    int offsetX;
+    int offsetY;
+    int x1; // overlap origin in the first image
+    int y1;
+    int x2; // and in the second
+    int y2;
+    int w; // overlap size, shared by both
+    int h;
+    float confidence; // phase correlation peak height (0-1) of the coarse estimate
+} DiffAlignment;
+
+// Phase correlates downsampled luminance (at most 512 on a side) for the translation, then
+// refines it to sub-pixel with a second correlation over a full resolution window at the
+// overlap's center. FFTs are split across jobs by rows, then by columns. Returns 0 (with an
+// all zero alignment) if neither peak stood out or the images wouldn't overlap.
+int alignFind(clContext * C, clImage * image1, clImage * image2, DiffAlignment * alignment);
+
+// Crops image (destroying it) to the overlap, as the pair's first or second image
+clImage * alignCrop(clContext * C, clImage * image, const DiffAlignment * alignment, int second);
+
+// Applies what the reader left in info (an AVIF's clap crop, irot rotation and imir mirror) to
+// image, destroying it. Everything decoded from a file goes through this before it's shown,
+// diffed or aligned, so frames read on other threads line up with the ones on screen. NULL in,
+// NULL out.
+clImage * alignReadTransform(clContext * C, clImage * image, const clReadExtraInfo * info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,805 @@
+#include "diff.h"
+
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Profile of the visualization (sRGB-like, white at the usual SDR reference)
+static const int DIFF_IMAGE_LUMINANCE = 80;
+
+// One allocated diff tile
+static const size_t DIFF_TILE_BYTES = sizeof(uint16_t) * DIFF_TILE_SIZE * DIFF_TILE_SIZE;
+
+// --------------------------------------------------------------------------------------
+// Tiled levels
+
+static void diffLevelInit(DiffLevel * level, int width, int height, int withIntensities)
+{
+    level->width = width;
+    level->height = height;
+    level->tilesX = (width + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE;
+    level->tilesY = (height + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE;
+    level->tiles = (uint16_t **)calloc((size_t)level->tilesX * level->tilesY, sizeof(uint16_t *));
+    level->intensities = withIntensities ? (uint8_t *)malloc((size_t)width * height) : NULL;
+}
+
+static void diffLevelFree(DiffLevel * level)
+{
+    if (level->tiles) {
+        const size_t tileCount = (size_t)level->tilesX * level->tilesY;
+        for (size_t i = 0; i < tileCount; ++i) {
+            free(level->tiles[i]);
+        }
+        free(level->tiles);
+    }
+    free(level->intensities);
+}
+
+static size_t diffLevelBytes(const DiffLevel * level)
+{
+    const size_t tileCount = (size_t)level->tilesX * level->tilesY;
+    size_t bytes = sizeof(uint16_t *) * tileCount;
+    for (size_t i = 0; i < tileCount; ++i) {
+        if (level->tiles[i]) {
+            bytes += DIFF_TILE_BYTES;
+        }
+    }
+    if (level->intensities) {
+        bytes += (size_t)level->width * level->height;
+    }
+    return bytes;
+}
+
+// Allocates (zeroed) on first use. Only the job owning the tile's row may call this.
+static uint16_t * diffLevelTile(DiffLevel * level, int tx, int ty)
+{
+    uint16_t ** tile = &level->tiles[((size_t)ty * level->tilesX) + tx];
+    if (!*tile) {
+        *tile = (uint16_t *)calloc(DIFF_TILE_SIZE * DIFF_TILE_SIZE, sizeof(uint16_t));
+    }
+    return *tile;
+}
+
+int diffLevelAt(const DiffLevel * level, int x, int y)
+{
+    const uint16_t * tile = level->tiles[((size_t)(y / DIFF_TILE_SIZE) * level->tilesX) + (x / DIFF_TILE_SIZE)];
+    return tile ? tile[((y % DIFF_TILE_SIZE) * DIFF_TILE_SIZE) + (x % DIFF_TILE_SIZE)] : 0;
+}
+
+void diffLevelReadRow(const DiffLevel * level, int y, uint16_t * diffs)
+{
+    uint16_t * const * tiles = &level->tiles[(size_t)(y / DIFF_TILE_SIZE) * level->tilesX];
+    const int tileRow = (y % DIFF_TILE_SIZE) * DIFF_TILE_SIZE;
+    for (int tx = 0; tx < level->tilesX; ++tx) {
+        const int x = tx * DIFF_TILE_SIZE;
+        const int count = ((level->width - x) < DIFF_TILE_SIZE) ? (level->width - x) : DIFF_TILE_SIZE;
+        if (tiles[tx]) {
+            memcpy(&diffs[x], &tiles[tx][tileRow], sizeof(uint16_t) * count);
+        } else {
+            memset(&diffs[x], 0, sizeof(uint16_t) * count);
+        }
+    }
+}
+
+// Level 1 intensities (or any level's, from the one before) of a pair of rows: row1 is row0 again
+// for an odd height's last row, and an odd width's last block averages its one column.
+static void diffPoolIntensityRows(const uint8_t * row0, const uint8_t * row1, int width, uint8_t * dst)
+{
+    const int blockCount = width / 2;
+    for (int i = 0; i < blockCount; ++i) {
+        const int x = i * 2;
+        const int intensitySum = row0[x] + row0[x + 1] + row1[x] + row1[x + 1];
+        dst[i] = (uint8_t)((intensitySum + 2) >> 2);
+    }
+    if (width & 1) {
+        const int x = width - 1;
+        dst[blockCount] = (uint8_t)((row0[x] + row1[x] + 1) >> 1);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Channel differences
+
+typedef struct DiffCompare
+{
+    ImageDiff * diff;
+    clContext * C;
+    clImage * image2;
+    int convert; // image2 has to be converted (band by band) to image1's profile and depth
+    clProfile * profile;
+    int depth;
+    const uint8_t * pixels1U8;
+    const uint8_t * pixels2U8;
+    const uint16_t * pixels1U16;
+    const uint16_t * pixels2U16;
+    int width;
+    int height;
+    float luma[3];      // Rec. 709 luma weights over maxChannel, so luma comes out 0-1
+    int maxChannel;     // (1 << depth) - 1
+    float minIntensity; // 0-1
+    const uint8_t * tiles; // per DIFF_TILE_SIZE tile, 0 if byte identical (skipped), NULL compares everything
+    int tilesX;
+    int * jobLargest;    // -1 if the job's conversion failed
+    int * jobHistograms; // histogramSize bins per job, reduced in job order
+    int histogramSize;
+} DiffCompare;
+
+// Gray a matching pixel is drawn in: the first image's luma (of its code values, not light),
+// lifted so 0 lands on minIntensity, and rounded to 8 bits. clImageDiff's mapping.
+static inline uint8_t diffIntensity(const DiffCompare * dc, float r, float g, float b)
+{
+    const float y = (dc->luma[0] * r) + (dc->luma[1] * g) + (dc->luma[2] * b);
+    return (uint8_t)((255.0f * (dc->minIntensity + ((1.0f - dc->minIntensity) * y))) + 0.5f);
+}
+
+static inline uint8_t diffIntensityU8(const DiffCompare * dc, const uint8_t * p)
+{
+    return diffIntensity(dc, (float)p[0], (float)p[1], (float)p[2]);
+}
+
+static inline uint8_t diffIntensityU16(const DiffCompare * dc, const uint16_t * p)
+{
+    return diffIntensity(dc, (float)p[0], (float)p[1], (float)p[2]);
+}
+
+// Branch free so the compiler can vectorize each span: absolute differences, a horizontal max
+// over the four channels and the first image's luma.
+static int diffCompareSpanU8(const DiffCompare * dc, const uint8_t * p1, const uint8_t * p2, int count, int * diffs, uint8_t * intensities)
+{
+    int largest = 0;
+    for (int i = 0; i < count; ++i, p1 += 4, p2 += 4) {
+        int r = abs((int)p1[0] - (int)p2[0]);
+        int g = abs((int)p1[1] - (int)p2[1]);
+        int b = abs((int)p1[2] - (int)p2[2]);
+        int a = abs((int)p1[3] - (int)p2[3]);
+        int rg = (r > g) ? r : g;
+        int ba = (b > a) ? b : a;
+        int d = (rg > ba) ? rg : ba;
+        diffs[i] = d;
+        largest = (d > largest) ? d : largest;
+        intensities[i] = diffIntensityU8(dc, p1);
+    }
+    return largest;
+}
+
+static int diffCompareSpanU16(const DiffCompare * dc, const uint16_t * p1, const uint16_t * p2, int count, int * diffs, uint8_t * intensities)
+{
+    int largest = 0;
+    for (int i = 0; i < count; ++i, p1 += 4, p2 += 4) {
+        int r = abs((int)p1[0] - (int)p2[0]);
+        int g = abs((int)p1[1] - (int)p2[1]);
+        int b = abs((int)p1[2] - (int)p2[2]);
+        int a = abs((int)p1[3] - (int)p2[3]);
+        int rg = (r > g) ? r : g;
+        int ba = (b > a) ? b : a;
+        int d = (rg > ba) ? rg : ba;
+        diffs[i] = d;
+        largest = (d > largest) ? d : largest;
+        intensities[i] = diffIntensityU16(dc, p1);
+    }
+    return largest;
+}
+
+// Just the first image's intensities, for byte identical spans and level 0's visualization
+static void diffIntensitySpan(const DiffCompare * dc, size_t offset, int count, uint8_t * intensities)
+{
+    if (dc->pixels1U8) {
+        const uint8_t * p1 = &dc->pixels1U8[offset * 4];
+        for (int i = 0; i < count; ++i, p1 += 4) {
+            intensities[i] = diffIntensityU8(dc, p1);
+        }
+    } else {
+        const uint16_t * p1 = &dc->pixels1U16[offset * 4];
+        for (int i = 0; i < count; ++i, p1 += 4) {
+            intensities[i] = diffIntensityU16(dc, p1);
+        }
+    }
+}
+
+// A job per row of tiles, which is also the band of image2 converted at a time. Level 0 tiles are
+// only allocated once a span in them differs, and its intensities are never stored: each pair of
+// rows is pooled straight into level 1.
+static void diffCompareRows(void * userData, int jobIndex, int first, int count)
+{
+    DiffCompare * dc = (DiffCompare *)userData;
+    DiffLevel * level0 = &dc->diff->levels[0];
+    DiffLevel * level1 = (dc->diff->levelCount > 1) ? &dc->diff->levels[1] : NULL;
+
+    clContext * C = NULL;
+    clProfile * profile = NULL;
+    if (dc->convert) {
+        C = jobsCreateContext(dc->C);
+        profile = clProfileClone(C, dc->profile);
+    }
+
+    int * histogram = &dc->jobHistograms[(size_t)jobIndex * dc->histogramSize];
+    int * spanDiffs = (int *)malloc(sizeof(int) * DIFF_TILE_SIZE);
+    uint8_t * rowIntensities = (uint8_t *)malloc((size_t)dc->width * 2); // the current pair of rows
+    int largest = 0;
+    for (int ty = first; ty < (first + count); ++ty) {
+        const int y = ty * DIFF_TILE_SIZE;
+        const int rowCount = ((dc->height - y) < DIFF_TILE_SIZE) ? (dc->height - y) : DIFF_TILE_SIZE;
+
+        // Only a band of the converted second image ever exists
+        clImage * band = NULL;
+        const uint8_t * pixels2U8 = dc->pixels2U8 ? &dc->pixels2U8[(size_t)y * dc->width * 4] : NULL;
+        const uint16_t * pixels2U16 = dc->pixels2U16 ? &dc->pixels2U16[(size_t)y * dc->width * 4] : NULL;
+        if (C) {
+            band = diffConvertRows(C, dc->image2, y, rowCount, dc->depth, profile);
+            if (!band) {
+                largest = -1;
+                break;
+            }
+            if (dc->depth > 8) {
+                clImagePrepareReadPixels(C, band, CL_PIXELFORMAT_U16);
+                pixels2U16 = band->pixelsU16;
+            } else {
+                clImagePrepareReadPixels(C, band, CL_PIXELFORMAT_U8);
+                pixels2U8 = band->pixelsU8;
+            }
+        }
+
+        const uint8_t * tileRow = dc->tiles ? &dc->tiles[(size_t)ty * dc->tilesX] : NULL;
+        for (int j = 0; j < rowCount; ++j) {
+            const size_t rowOffset = (size_t)(y + j) * dc->width;
+            const size_t bandOffset = (size_t)j * dc->width * 4;
+            uint8_t * intensities = &rowIntensities[(size_t)(j & 1) * dc->width];
+            for (int tx = 0; tx < level0->tilesX; ++tx) {
+                const int x = tx * DIFF_TILE_SIZE;
+                const int spanCount = ((dc->width - x) < DIFF_TILE_SIZE) ? (dc->width - x) : DIFF_TILE_SIZE;
+                if (tileRow && !tileRow[tx]) {
+                    diffIntensitySpan(dc, rowOffset + x, spanCount, &intensities[x]);
+                    histogram[0] += spanCount;
+                    continue;
+                }
+
+                int spanLargest;
+                if (dc->pixels1U8) {
+                    const uint8_t * p1 = &dc->pixels1U8[(rowOffset + x) * 4];
+                    spanLargest = diffCompareSpanU8(dc, p1, &pixels2U8[bandOffset + (size_t)x * 4], spanCount, spanDiffs, &intensities[x]);
+                } else {
+                    const uint16_t * p1 = &dc->pixels1U16[(rowOffset + x) * 4];
+                    spanLargest = diffCompareSpanU16(dc, p1, &pixels2U16[bandOffset + (size_t)x * 4], spanCount, spanDiffs, &intensities[x]);
+                }
+                largest = (spanLargest > largest) ? spanLargest : largest;
+
+                if (spanLargest > 0) {
+                    uint16_t * diffs = &diffLevelTile(level0, tx, ty)[j * DIFF_TILE_SIZE];
+                    for (int i = 0; i < spanCount; ++i) {
+                        diffs[i] = (uint16_t)spanDiffs[i];
+                        ++histogram[spanDiffs[i]];
+                    }
+                } else {
+                    histogram[0] += spanCount;
+                }
+            }
+
+            // Tiles are an even number of rows, so pairs never straddle two jobs
+            if (level1 && ((j & 1) || ((y + j + 1) == dc->height))) {
+                const uint8_t * row1 = &rowIntensities[(size_t)(j & 1) * dc->width];
+                diffPoolIntensityRows(rowIntensities, row1, dc->width, &level1->intensities[(size_t)((y + j) / 2) * level1->width]);
+            }
+        }
+
+        if (band) {
+            clImageDestroy(C, band);
+        }
+    }
+    dc->jobLargest[jobIndex] = largest;
+    free(spanDiffs);
+    free(rowIntensities);
+
+    if (C) {
+        clProfileDestroy(C, profile);
+        clContextDestroy(C);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Tiles
+
+typedef struct DiffTiles
+{
+    const uint8_t * pixels1;
+    const uint8_t * pixels2;
+    int pixelBytes;
+    int width;
+    int height;
+    int tilesX;
+    uint8_t * tiles;     // 1 where any byte differs
+    int * jobDiffering;  // differing tile count per job
+} DiffTiles;
+
+// Walks whole rows of each tile row so both images are read front to back, and stops comparing a
+// tile at its first differing row. memcmp is about as close to memory bandwidth as a single
+// pass gets, and cheaper than hashing both images when neither hash would ever be reused.
+static void diffCompareTileRows(void * userData, int jobIndex, int first, int count)
+{
+    DiffTiles * dt = (DiffTiles *)userData;
+    const size_t rowBytes = (size_t)dt->width * dt->pixelBytes;
+    const size_t tileBytes = (size_t)DIFF_TILE_SIZE * dt->pixelBytes;
+    int differing = 0;
+    for (int ty = first; ty < (first + count); ++ty) {
+        uint8_t * tiles = &dt->tiles[(size_t)ty * dt->tilesX];
+        const int y0 = ty * DIFF_TILE_SIZE;
+        const int y1 = ((y0 + DIFF_TILE_SIZE) < dt->height) ? (y0 + DIFF_TILE_SIZE) : dt->height;
+        int tileRowDiffering = 0;
+        for (int y = y0; (y < y1) && (tileRowDiffering < dt->tilesX); ++y) {
+            const uint8_t * row1 = &dt->pixels1[(size_t)y * rowBytes];
+            const uint8_t * row2 = &dt->pixels2[(size_t)y * rowBytes];
+            for (int tx = 0; tx < dt->tilesX; ++tx) {
+                if (tiles[tx]) {
+                    continue;
+                }
+                const size_t offset = (size_t)tx * tileBytes;
+                const size_t bytes = ((rowBytes - offset) < tileBytes) ? (rowBytes - offset) : tileBytes;
+                if (memcmp(&row1[offset], &row2[offset], bytes)) {
+                    tiles[tx] = 1;
+                    ++tileRowDiffering;
+                }
+            }
+        }
+        differing += tileRowDiffering;
+    }
+    dt->jobDiffering[jobIndex] = differing;
+}
+
+// Fills in dc->tiles (allocated) and returns how many tiles differ
+static int diffCompareTiles(clContext * C, DiffCompare * dc, int height)
+{
+    DiffTiles dt;
+    dt.pixels1 = dc->pixels1U8 ? dc->pixels1U8 : (const uint8_t *)dc->pixels1U16;
+    dt.pixels2 = dc->pixels2U8 ? dc->pixels2U8 : (const uint8_t *)dc->pixels2U16;
+    dt.pixelBytes = dc->pixels1U8 ? 4 : 8;
+    dt.width = dc->width;
+    dt.height = height;
+    dt.tilesX = (dc->width + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE;
+    const int tilesY = (height + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE;
+    dt.tiles = (uint8_t *)calloc((size_t)dt.tilesX * tilesY, 1);
+
+    const int jobs = jobsCount(C);
+    dt.jobDiffering = (int *)calloc(jobs, sizeof(int));
+    jobsParallelFor(C, tilesY, diffCompareTileRows, &dt);
+    int differing = 0;
+    for (int j = 0; j < jobs; ++j) {
+        differing += dt.jobDiffering[j];
+    }
+    free(dt.jobDiffering);
+
+    dc->tiles = dt.tiles;
+    dc->tilesX = dt.tilesX;
+    return differing;
+}
+
+// --------------------------------------------------------------------------------------
+// Pyramid
+
+typedef struct DiffPool
+{
+    const DiffLevel * src;
+    DiffLevel * dst;
+} DiffPool;
+
+// Largest diff of the 2x2 source block under (x, y), clamped at src's edges
+static int diffPoolBlock(const DiffLevel * src, int x, int y)
+{
+    const int x0 = x * 2;
+    const int y0 = y * 2;
+    const int x1 = ((x0 + 1) < src->width) ? (x0 + 1) : x0;
+    const int y1 = ((y0 + 1) < src->height) ? (y0 + 1) : y0;
+    const int a = diffLevelAt(src, x0, y0);
+    const int b = diffLevelAt(src, x1, y0);
+    const int c = diffLevelAt(src, x0, y1);
+    const int d = diffLevelAt(src, x1, y1);
+    const int top = (a > b) ? a : b;
+    const int bottom = (c > d) ? c : d;
+    return (top > bottom) ? top : bottom;
+}
+
+// A job per row of destination tiles. Each covers (up to) 2x2 source tiles, and is only allocated
+// if one of them is: any nonzero diff survives pooling, so an allocated tile is never all zero.
+static void diffPoolTileRows(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    DiffPool * dp = (DiffPool *)userData;
+    const DiffLevel * src = dp->src;
+    DiffLevel * dst = dp->dst;
+    for (int ty = first; ty < (first + count); ++ty) {
+        for (int tx = 0; tx < dst->tilesX; ++tx) {
+            int used = 0;
+            for (int sy = ty * 2; (sy < (ty * 2 + 2)) && (sy < src->tilesY); ++sy) {
+                for (int sx = tx * 2; (sx < (tx * 2 + 2)) && (sx < src->tilesX); ++sx) {
+                    used |= (src->tiles[((size_t)sy * src->tilesX) + sx] != NULL);
+                }
+            }
+            if (!used) {
+                continue;
+            }
+
+            uint16_t * tile = diffLevelTile(dst, tx, ty);
+            const int x0 = tx * DIFF_TILE_SIZE;
+            const int y0 = ty * DIFF_TILE_SIZE;
+            const int w = ((dst->width - x0) < DIFF_TILE_SIZE) ? (dst->width - x0) : DIFF_TILE_SIZE;
+            const int h = ((dst->height - y0) < DIFF_TILE_SIZE) ? (dst->height - y0) : DIFF_TILE_SIZE;
+            for (int j = 0; j < h; ++j) {
+                for (int i = 0; i < w; ++i) {
+                    tile[(j * DIFF_TILE_SIZE) + i] = (uint16_t)diffPoolBlock(src, x0 + i, y0 + j);
+                }
+            }
+        }
+    }
+}
+
+// Each destination row reads two source rows (the last one twice if the height is odd)
+static void diffPoolIntensities(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    DiffPool * dp = (DiffPool *)userData;
+    const DiffLevel * src = dp->src;
+    for (int j = first; j < first + count; ++j) {
+        const int y0 = j * 2;
+        const int y1 = ((y0 + 1) < src->height) ? (y0 + 1) : y0;
+        diffPoolIntensityRows(&src->intensities[(size_t)y0 * src->width],
+                              &src->intensities[(size_t)y1 * src->width],
+                              src->width,
+                              &dp->dst->intensities[(size_t)j * dp->dst->width]);
+    }
+}
+
+// Every level but the first keeps intensities, which the first gets from image1 when needed
+static void diffAllocLevels(ImageDiff * diff, int width, int height)
+{
+    int levelCount = 1;
+    for (int w = width, h = height; (w > 1) || (h > 1); w = (w + 1) / 2, h = (h + 1) / 2) {
+        ++levelCount;
+    }
+
+    diff->levels = (DiffLevel *)calloc(levelCount, sizeof(DiffLevel));
+    diff->levelCount = levelCount;
+    diffLevelInit(&diff->levels[0], width, height, 0);
+    for (int level = 1; level < levelCount; ++level) {
+        const DiffLevel * src = &diff->levels[level - 1];
+        diffLevelInit(&diff->levels[level], (src->width + 1) / 2, (src->height + 1) / 2, 1);
+    }
+}
+
+// Levels 0 (diffs) and 1 (intensities) come from the comparison, the rest is pooled from them
+static void diffBuildPyramid(clContext * C, ImageDiff * diff)
+{
+    for (int level = 1; level < diff->levelCount; ++level) {
+        DiffPool dp;
+        dp.src = &diff->levels[level - 1];
+        dp.dst = &diff->levels[level];
+        jobsParallelFor(C, dp.dst->tilesY, diffPoolTileRows, &dp);
+        if (level > 1) {
+            jobsParallelFor(C, dp.dst->height, diffPoolIntensities, &dp);
+        }
+    }
+
+    diff->storageBytes = 0;
+    for (int level = 0; level < diff->levelCount; ++level) {
+        diff->storageBytes += diffLevelBytes(&diff->levels[level]);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Threshold (visualization)
+
+enum
+{
+    DIFFCLASS_MATCH = 0,
+    DIFFCLASS_UNDER,
+    DIFFCLASS_OVER
+};
+
+static const uint8_t diffClassColors[3][3] = {
+    { 0, 0, 0 },   // unused, matches show their intensity
+    { 0, 255, 0 }, // under threshold
+    { 255, 0, 0 }, // over threshold
+};
+
+typedef struct DiffColorize
+{
+    const DiffLevel * level;
+    const DiffCompare * kernels; // reads level 0's intensities from the first image
+    const uint8_t * classes;     // DIFFCLASS_* for every diff value, built from the threshold
+    uint8_t * dst;
+} DiffColorize;
+
+// DIFFCLASS_* for every diff value up to histogramSize, a lookup per pixel
+static uint8_t * diffCreateClasses(int histogramSize, int threshold)
+{
+    uint8_t * classes = (uint8_t *)malloc(histogramSize);
+    classes[0] = DIFFCLASS_MATCH;
+    for (int i = 1; i < histogramSize; ++i) {
+        classes[i] = (i > threshold) ? DIFFCLASS_OVER : DIFFCLASS_UNDER;
+    }
+    return classes;
+}
+
+static void diffColorizeRows(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    DiffColorize * dc = (DiffColorize *)userData;
+    const DiffLevel * level = dc->level;
+    uint16_t * diffs = (uint16_t *)malloc(sizeof(uint16_t) * level->width);
+    uint8_t * rowIntensities = level->intensities ? NULL : (uint8_t *)malloc(level->width);
+    for (int y = first; y < (first + count); ++y) {
+        const size_t rowOffset = (size_t)y * level->width;
+        const uint8_t * intensities = rowIntensities;
+        if (level->intensities) {
+            intensities = &level->intensities[rowOffset];
+        } else {
+            diffIntensitySpan(dc->kernels, rowOffset, level->width, rowIntensities);
+        }
+        diffLevelReadRow(level, y, diffs);
+
+        uint8_t * pixel = &dc->dst[rowOffset * 4];
+        for (int x = 0; x < level->width; ++x, pixel += 4) {
+            const uint8_t diffClass = dc->classes[diffs[x]];
+            if (diffClass == DIFFCLASS_MATCH) {
+                pixel[0] = intensities[x];
+                pixel[1] = intensities[x];
+                pixel[2] = intensities[x];
+            } else {
+                pixel[0] = diffClassColors[diffClass][0];
+                pixel[1] = diffClassColors[diffClass][1];
+                pixel[2] = diffClassColors[diffClass][2];
+            }
+            pixel[3] = 255;
+        }
+    }
+    free(diffs);
+    free(rowIntensities);
+}
+
+// --------------------------------------------------------------------------------------
+// Public
+
+clImage * diffCreateVisualization(clContext * C, int width, int height)
+{
+    clProfilePrimaries primaries;
+    clContextGetStockPrimaries(C, "bt709", &primaries);
+    clProfileCurve curve;
+    curve.type = CL_PCT_GAMMA;
+    curve.gamma = 2.2f;
+    curve.implicitScale = 1.0f;
+    clProfile * profile = clProfileCreate(C, &primaries, &curve, DIFF_IMAGE_LUMINANCE, NULL);
+    clImage * image = clImageCreate(C, width, height, 8, profile);
+    clProfileDestroy(C, profile);
+    return image;
+}
+
+clImage * diffConvertRows(clContext * C, clImage * image, int y, int rowCount, int depth, clProfile * profile)
+{
+    clImage * rows = clImageCrop(C, image, 0, y, image->width, rowCount, clTrue);
+    if (!rows) {
+        return NULL;
+    }
+    clImage * converted = clImageConvert(C, rows, depth, profile, CL_TONEMAP_OFF, NULL);
+    clImageDestroy(C, rows);
+    return converted;
+}
+
+// Everything the span kernels need besides the pixels
+static void diffInitKernels(DiffCompare * dc, int width, int depth, float minIntensity)
+{
+    memset(dc, 0, sizeof(DiffCompare));
+    dc->width = width;
+    dc->maxChannel = (1 << depth) - 1;
+    dc->luma[0] = 0.2126f / (float)dc->maxChannel;
+    dc->luma[1] = 0.7152f / (float)dc->maxChannel;
+    dc->luma[2] = 0.0722f / (float)dc->maxChannel;
+    dc->minIntensity = minIntensity;
+    dc->depth = depth;
+}
+
+// Common to diffCreate() and filling in an identical diff: image1's pixels (and image2's, unless
+// converting or every tile matches) must be in dc already.
+static void diffInitCompare(clContext * C, DiffCompare * dc, ImageDiff * diff, clImage * image1)
+{
+    diffInitKernels(dc, image1->width, image1->depth, diff->minIntensity);
+    dc->height = image1->height;
+    dc->diff = diff;
+    dc->C = C;
+    dc->profile = image1->profile;
+    if (image1->depth > 8) {
+        clImagePrepareReadPixels(C, image1, CL_PIXELFORMAT_U16);
+        dc->pixels1U16 = image1->pixelsU16;
+    } else {
+        clImagePrepareReadPixels(C, image1, CL_PIXELFORMAT_U8);
+        dc->pixels1U8 = image1->pixelsU8;
+    }
+}
+
+// Allocates the levels and histogram, runs dc over every row of tiles and builds the pyramid.
+// Returns 0 if a band of image2 failed to convert.
+static int diffCompare(clContext * C, DiffCompare * dc)
+{
+    ImageDiff * diff = dc->diff;
+    diffAllocLevels(diff, dc->width, dc->height);
+
+    const int jobs = jobsCount(C);
+    dc->histogramSize = dc->maxChannel + 1;
+    dc->jobLargest = (int *)calloc(jobs, sizeof(int));
+    dc->jobHistograms = (int *)calloc((size_t)jobs * dc->histogramSize, sizeof(int));
+    jobsParallelFor(C, diff->levels[0].tilesY, diffCompareRows, dc);
+    int failed = 0;
+    diff->largestChannelDiff = 0;
+    for (int j = 0; j < jobs; ++j) {
+        failed |= (dc->jobLargest[j] < 0);
+        if (diff->largestChannelDiff < dc->jobLargest[j]) {
+            diff->largestChannelDiff = dc->jobLargest[j];
+        }
+    }
+    if (failed) {
+        free(dc->jobLargest);
+        free(dc->jobHistograms);
+        return 0;
+    }
+
+    // Nothing past the largest diff is ever counted
+    free(diff->histogram);
+    diff->histogramSize = diff->largestChannelDiff + 1;
+    diff->histogram = (int *)calloc(diff->histogramSize, sizeof(int));
+    for (int j = 0; j < jobs; ++j) {
+        const int * jobHistogram = &dc->jobHistograms[(size_t)j * dc->histogramSize];
+        for (int i = 0; i < diff->histogramSize; ++i) {
+            diff->histogram[i] += jobHistogram[i];
+        }
+    }
+    free(dc->jobLargest);
+    free(dc->jobHistograms);
+
+    diffBuildPyramid(C, diff);
+    return 1;
+}
+
+ImageDiff * diffCreate(clContext * C, clImage * image1, clImage * image2, float minIntensity, int threshold)
+{
+    if ((image1->width != image2->width) || (image1->height != image2->height)) {
+        return NULL;
+    }
+
+    ImageDiff * diff = (ImageDiff *)calloc(1, sizeof(ImageDiff));
+    diff->pixelCount = image1->width * image1->height;
+    diff->imageLevel = -1;
+    diff->image1 = image1;
+    diff->minIntensity = CL_CLAMP(minIntensity, 0.0f, 1.0f);
+
+    DiffCompare dc;
+    diffInitCompare(C, &dc, diff, image1);
+    dc.image2 = image2;
+    dc.convert = !clProfileMatches(C, image1->profile, image2->profile) || (image1->depth != image2->depth);
+    if (dc.convert) {
+        // The kernels crop and convert their own bands of image2
+        clImagePrepareReadPixels(C, image2, (image2->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    } else {
+        if (image1->depth > 8) {
+            clImagePrepareReadPixels(C, image2, CL_PIXELFORMAT_U16);
+            dc.pixels2U16 = image2->pixelsU16;
+        } else {
+            clImagePrepareReadPixels(C, image2, CL_PIXELFORMAT_U8);
+            dc.pixels2U8 = image2->pixelsU8;
+        }
+
+        // Identical tiles skip the per pixel work, and identical images skip everything else
+        // until something needs to look at the diffs (see diffVisualize())
+        diff->tileCount = ((image1->width + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE) *
+                          ((image1->height + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE);
+        diff->differingTileCount = diffCompareTiles(C, &dc, image1->height);
+        if (diff->differingTileCount == 0) {
+            free((void *)dc.tiles);
+            diff->identical = 1;
+            diff->histogramSize = 1;
+            diff->histogram = (int *)calloc(1, sizeof(int));
+            diff->histogram[0] = diff->pixelCount;
+            diffUpdate(C, diff, threshold);
+            return diff;
+        }
+    }
+
+    const int compared = diffCompare(C, &dc);
+    free((void *)dc.tiles);
+    if (!compared) {
+        diffDestroy(C, diff);
+        return NULL;
+    }
+    diffUpdate(C, diff, threshold);
+    return diff;
+}
+
+int diffFillIdentical(clContext * C, ImageDiff * diff)
+{
+    if (diff->levels) {
+        return 1;
+    }
+
+    // Every tile matches, so only image1 is read
+    DiffCompare dc;
+    diffInitCompare(C, &dc, diff, diff->image1);
+    dc.tilesX = (diff->image1->width + DIFF_TILE_SIZE - 1) / DIFF_TILE_SIZE;
+    dc.tiles = (const uint8_t *)calloc(diff->tileCount, 1);
+    const int compared = diffCompare(C, &dc);
+    free((void *)dc.tiles);
+    return compared;
+}
+
+void diffUpdate(clContext * C, ImageDiff * diff, int threshold)
+{
+    (void)C;
+
+    if (diff->threshold != threshold) {
+        diff->imageLevel = -1;
+    }
+    diff->threshold = threshold;
+
+    // Counts come straight from the histogram
+    diff->matchCount = diff->histogram[0];
+    diff->overThresholdCount = 0;
+    for (int i = (threshold > 0) ? (threshold + 1) : 1; i < diff->histogramSize; ++i) {
+        diff->overThresholdCount += diff->histogram[i];
+    }
+    diff->underThresholdCount = diff->pixelCount - diff->matchCount - diff->overThresholdCount;
+}
+
+int diffLevelForScale(const ImageDiff * diff, float imagePixelsPerScreenPixel)
+{
+    int level = 0;
+    while (((level + 1) < diff->levelCount) && ((float)(1 << level) < imagePixelsPerScreenPixel)) {
+        ++level;
+    }
+    return level;
+}
+
+clImage * diffVisualize(clContext * C, ImageDiff * diff, int level)
+{
+    diffFillIdentical(C, diff);
+    level = CL_CLAMP(level, 0, diff->levelCount - 1);
+    if (diff->image && (diff->imageLevel == level)) {
+        return diff->image;
+    }
+
+    const DiffLevel * diffLevel = &diff->levels[level];
+    if (diff->image && ((diff->image->width != diffLevel->width) || (diff->image->height != diffLevel->height))) {
+        clImageDestroy(C, diff->image);
+        diff->image = NULL;
+    }
+    if (!diff->image) {
+        diff->image = diffCreateVisualization(C, diffLevel->width, diffLevel->height);
+    }
+
+    DiffCompare kernels;
+    if (level == 0) {
+        diffInitCompare(C, &kernels, diff, diff->image1);
+    }
+    uint8_t * classes = diffCreateClasses(diff->histogramSize, diff->threshold);
+    DiffColorize dc;
+    clImagePrepareWritePixels(C, diff->image, CL_PIXELFORMAT_U8);
+    dc.level = diffLevel;
+    dc.kernels = (level == 0) ? &kernels : NULL;
+    dc.classes = classes;
+    dc.dst = diff->image->pixelsU8;
+    jobsParallelFor(C, diffLevel->height, diffColorizeRows, &dc);
+    free(classes);
+
+    diff->imageLevel = level;
+    return diff->image;
+}
+
+void diffDestroy(clContext * C, ImageDiff * diff)
+{
+    if (diff->image) {
+        clImageDestroy(C, diff->image);
+    }
+    for (int level = 0; level < diff->levelCount; ++level) {
+        diffLevelFree(&diff->levels[level]);
+    }
+    free(diff->levels);
+    free(diff->histogram);
+    free(diff);
+}
@@ -0,0 +1,87 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+
+// Side of the square tiles compared byte for byte up front, and that diff levels are stored in
+#define DIFF_TILE_SIZE 64
+
+// One level of the diff pyramid. Each level halves the one before it (rounding up), keeping the
+// largest diff of every 2x2 block so isolated differences survive any amount of minification.
+// Diffs are kept in DIFF_TILE_SIZE square tiles of 16 bits (enough for any depth), and a tile
+// whose diffs are all 0 is never allocated, so a mostly matching pair costs little more than its
+// tile pointers. Edge tiles are allocated whole, the part past width/height is never read.
+typedef struct DiffLevel
+{
+    int width;
+    int height;
+    int tilesX;
+    int tilesY;
+    uint16_t ** tiles;     // tilesX * tilesY, row major, NULL where every diff is 0
+    uint8_t * intensities; // mean intensity of each block, NULL on level 0 (read from the first image)
+} DiffLevel;
+
+int diffLevelAt(const DiffLevel * level, int x, int y);
+void diffLevelReadRow(const DiffLevel * level, int y, uint16_t * diffs); // width values of row y
+
+// Per pixel comparison of two same sized, same depth images, in raw (UNorm(depth)) units. The
+// threshold only affects the counts and visualization, so diffUpdate() can change it cheaply:
+// counts come from the histogram and the visualization is recolored through a lookup table, and
+// only for the pyramid level actually shown (see diffVisualize()).
+typedef struct ImageDiff
+{
+    clImage * image;         // 8 bit visualization of imageLevel: matches in gray, under threshold green, over red
+    int imageLevel;          // -1 until diffVisualize() is called, or after diffUpdate()
+    DiffLevel * levels;      // max pooled pyramid, levels[0] is the largest channel difference per pixel
+    int levelCount;          // and the last is 1x1
+    size_t storageBytes;     // tiles and intensities of every level
+    int * histogram;         // pixel count per diff value
+    int histogramSize;       // largestChannelDiff + 1
+    int pixelCount;
+    int threshold;
+    int matchCount;          // diff == 0
+    int underThresholdCount; // 0 < diff <= threshold
+    int overThresholdCount;  // diff > threshold
+    int largestChannelDiff;
+    int tileCount;           // tiles compared byte for byte up front, 0 if image2 had to be converted
+    int differingTileCount;  // the rest went straight to matchCount
+    int identical;           // every tile matched: levels stay NULL until diffFillIdentical()
+    clImage * image1;        // borrowed (the diff can't outlive it), only read again by diffFillIdentical()
+    float minIntensity;      // 0-1
+} ImageDiff;
+
+// minIntensity (0-1) lifts the darkest gray used for matching pixels, 1 draws them all white.
+// image2 is compared in image1's profile and depth, converted a band of rows at a time if it
+// differs. Otherwise both are first compared a tile at a time, and only differing tiles get the
+// per pixel work. Returns NULL if the images don't share dimensions or image2 failed to convert.
+ImageDiff * diffCreate(clContext * C, clImage * image1, clImage * image2, float minIntensity, int threshold);
+
+// Fills in the pyramid of an identical diff (intensities only, every tile stays NULL). Does
+// nothing for any other diff. diffVisualize() calls it, anything else reading levels should too.
+int diffFillIdentical(clContext * C, ImageDiff * diff);
+void diffUpdate(clContext * C, ImageDiff * diff, int threshold);
+void diffDestroy(clContext * C, ImageDiff * diff);
+
+// Pyramid level to show when each screen pixel covers imagePixelsPerScreenPixel full resolution
+// pixels: the first one no larger than the screen, so nothing is lost to the GPU's filtering.
+int diffLevelForScale(const ImageDiff * diff, float imagePixelsPerScreenPixel);
+
+// Returns diff->image, colorized for level at the current threshold (rebuilt only if either changed)
+clImage * diffVisualize(clContext * C, ImageDiff * diff, int level);
+
+// Empty 8 bit image in the profile every diff visualization (diff image, heatmaps) uses
+clImage * diffCreateVisualization(clContext * C, int width, int height);
+
+// Rows [y, y + rowCount) of image converted to depth and profile (no tonemapping), for kernels
+// that convert as they go instead of converting a whole image up front. NULL on failure.
+clImage * diffConvertRows(clContext * C, clImage * image, int y, int rowCount, int depth, clProfile * profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,432 @@
+#include "gainmap.h"
+
+#include "jobs.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --------------------------------------------------------------------------------------
+// Constants
+
+// Resolution of the gain code -> linear gain lookup, codes are bilinearly filtered before lookup
+#define GAINMAP_LUT_SIZE 4096
+
+static const char XMP_HEADER[] = "http://ns.adobe.com/xap/1.0/";
+
+// --------------------------------------------------------------------------------------
+// JPEG container walking
+
+static int isRestartMarker(uint8_t marker)
+{
+    return (marker >= 0xD0) && (marker <= 0xD7);
+}
+
+// Returns the offset just past the EOI of the JPEG whose SOI is at start, or 0 if it is truncated
+static size_t gainMapFindJPEGEnd(const uint8_t * p, size_t size, size_t start)
+{
+    size_t pos = start + 2;
+    while ((pos + 4) <= size) {
+        if (p[pos] != 0xFF) {
+            return 0;
+        }
+        uint8_t marker = p[pos + 1];
+        if (marker == 0xFF) {
+            ++pos; // fill byte
+            continue;
+        }
+        if (marker == 0xD9) {
+            return pos + 2;
+        }
+        if ((marker == 0x01) || isRestartMarker(marker)) {
+            pos += 2;
+            continue;
+        }
+
+        size_t segmentLength = ((size_t)p[pos + 2] << 8) | p[pos + 3];
+        pos += 2 + segmentLength;
+        if (marker == 0xDA) {
+            // Skip entropy coded data up to the next real marker
+            while ((pos + 1) < size) {
+                if ((p[pos] == 0xFF) && (p[pos + 1] != 0x00) && (p[pos + 1] != 0xFF) && !isRestartMarker(p[pos + 1])) {
+                    break;
+                }
+                ++pos;
+            }
+        }
+    }
+    return 0;
+}
+
+// Finds the XMP packet in the APP1 segments of the JPEG at [start, end), NUL terminated copy or NULL
+static char * gainMapCopyXMP(const uint8_t * p, size_t start, size_t end)
+{
+    size_t pos = start + 2;
+    while ((pos + 4) <= end) {
+        if (p[pos] != 0xFF) {
+            break;
+        }
+        uint8_t marker = p[pos + 1];
+        if ((marker == 0xDA) || (marker == 0xD9)) {
+            break;
+        }
+        size_t segmentLength = ((size_t)p[pos + 2] << 8) | p[pos + 3];
+        if ((segmentLength < 2) || ((pos + 2 + segmentLength) > end)) {
+            break;
+        }
+
+        const uint8_t * payload = &p[pos + 4];
+        size_t payloadLength = segmentLength - 2;
+        if ((marker == 0xE1) && (payloadLength > sizeof(XMP_HEADER)) && !memcmp(payload, XMP_HEADER, sizeof(XMP_HEADER))) {
+            size_t xmpLength = payloadLength - sizeof(XMP_HEADER);
+            char * xmp = (char *)malloc(xmpLength + 1);
+            memcpy(xmp, payload + sizeof(XMP_HEADER), xmpLength);
+            xmp[xmpLength] = 0;
+            return xmp;
+        }
+        pos += 2 + segmentLength;
+    }
+    return NULL;
+}
+
+// --------------------------------------------------------------------------------------
+// hdrgm XMP parsing
+
+// Reads up to 3 values of hdrgm:<name>, stored either as an attribute or as an element holding
+// a value or an rdf:Seq. Returns how many were found.
+static int gainMapParseXMPValues(const char * xmp, const char * name, float values[3])
+{
+    char key[64];
+    snprintf(key, sizeof(key), "hdrgm:%s", name);
+    size_t keyLength = strlen(key);
+
+    for (const char * found = strstr(xmp, key); found; found = strstr(found + 1, key)) {
+        const char * p = found + keyLength;
+        if (*p == '=') {
+            // Attribute
+            ++p;
+            if ((*p != '"') && (*p != '\'')) {
+                continue;
+            }
+            ++p;
+            if (!strncmp(p, "True", 4) || !strncmp(p, "true", 4)) {
+                values[0] = 1.0f;
+            } else if (!strncmp(p, "False", 5) || !strncmp(p, "false", 5)) {
+                values[0] = 0.0f;
+            } else {
+                values[0] = strtof(p, NULL);
+            }
+            return 1;
+        }
+
+        if ((*p == '>') && (found > xmp) && (found[-1] == '<')) {
+            // Element, either <rdf:li> entries or a bare value
+            ++p;
+            char closing[72];
+            snprintf(closing, sizeof(closing), "</%s>", key);
+            const char * elementEnd = strstr(p, closing);
+            if (!elementEnd) {
+                return 0;
+            }
+
+            int count = 0;
+            const char * li = strstr(p, "<rdf:li>");
+            while (li && (li < elementEnd) && (count < 3)) {
+                values[count++] = strtof(li + 8, NULL);
+                li = strstr(li + 1, "<rdf:li>");
+            }
+            if (count == 0) {
+                values[0] = strtof(p, NULL);
+                count = 1;
+            }
+            return count;
+        }
+    }
+    return 0;
+}
+
+static void gainMapParseXMPChannels(const char * xmp, const char * name, float values[3], float defaultValue)
+{
+    float parsed[3];
+    int count = gainMapParseXMPValues(xmp, name, parsed);
+    for (int c = 0; c < 3; ++c) {
+        if (count == 0) {
+            values[c] = defaultValue;
+        } else {
+            values[c] = parsed[(count == 3) ? c : 0];
+        }
+    }
+}
+
+// Returns 0 if the XMP doesn't describe a usable gain map
+static int gainMapParseMetadata(const char * xmp, GainMapMetadata * metadata)
+{
+    if (!strstr(xmp, "hdrgm:GainMapMax")) {
+        return 0;
+    }
+
+    float value[3];
+    if (gainMapParseXMPValues(xmp, "BaseRenditionIsHDR", value) && (value[0] != 0.0f)) {
+        // Only SDR bases are supported
+        return 0;
+    }
+
+    gainMapParseXMPChannels(xmp, "GainMapMin", metadata->gainMapMin, 0.0f);
+    gainMapParseXMPChannels(xmp, "GainMapMax", metadata->gainMapMax, 1.0f);
+    gainMapParseXMPChannels(xmp, "Gamma", metadata->gamma, 1.0f);
+    gainMapParseXMPChannels(xmp, "OffsetSDR", metadata->offsetSDR, 1.0f / 64.0f);
+    gainMapParseXMPChannels(xmp, "OffsetHDR", metadata->offsetHDR, 1.0f / 64.0f);
+
+    float maxGainMapMax = fmaxf(metadata->gainMapMax[0], fmaxf(metadata->gainMapMax[1], metadata->gainMapMax[2]));
+    metadata->hdrCapacityMin = 0.0f;
+    metadata->hdrCapacityMax = maxGainMapMax;
+    if (gainMapParseXMPValues(xmp, "HDRCapacityMin", value)) {
+        metadata->hdrCapacityMin = value[0];
+    }
+    if (gainMapParseXMPValues(xmp, "HDRCapacityMax", value)) {
+        metadata->hdrCapacityMax = value[0];
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        if (metadata->gamma[c] <= 0.0f) {
+            metadata->gamma[c] = 1.0f;
+        }
+    }
+    return 1;
+}
+
+// --------------------------------------------------------------------------------------
+// Reading
+
+static uint8_t * gainMapReadFile(const char * filename, size_t * outSize)
+{
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t * data = (uint8_t *)malloc((size_t)size);
+    if (fread(data, 1, (size_t)size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *outSize = (size_t)size;
+    return data;
+}
+
+GainMap * gainMapRead(clContext * C, const char * filename)
+{
+    size_t size = 0;
+    uint8_t * data = gainMapReadFile(filename, &size);
+    if (!data) {
+        return NULL;
+    }
+
+    GainMap * gainMap = NULL;
+    clFormat * jpgFormat = clContextFindFormat(C, "jpg");
+    if ((size > 4) && (data[0] == 0xFF) && (data[1] == 0xD8) && jpgFormat && jpgFormat->readFunc) {
+        // Every JPEG after the primary image is a candidate (MPF can also carry thumbnails and
+        // depth maps), the gain map is the one whose XMP carries hdrgm metadata.
+        size_t pos = gainMapFindJPEGEnd(data, size, 0);
+        while (pos && ((pos + 4) <= size) && !gainMap) {
+            if ((data[pos] != 0xFF) || (data[pos + 1] != 0xD8)) {
+                ++pos;
+                continue;
+            }
+            size_t end = gainMapFindJPEGEnd(data, size, pos);
+            if (!end) {
+                break;
+            }
+
+            GainMapMetadata metadata;
+            char * xmp = gainMapCopyXMP(data, pos, end);
+            if (xmp && gainMapParseMetadata(xmp, &metadata)) {
+                clRaw raw;
+                raw.ptr = &data[pos];
+                raw.size = end - pos;
+                clImage * image = jpgFormat->readFunc(C, "jpg", NULL, &raw);
+                if (image) {
+                    clImagePrepareReadPixels(C, image, CL_PIXELFORMAT_U8);
+                    gainMap = (GainMap *)calloc(1, sizeof(GainMap));
+                    gainMap->image = image;
+                    gainMap->metadata = metadata;
+                }
+            }
+            free(xmp);
+            pos = end;
+        }
+    }
+
+    free(data);
+    return gainMap;
+}
+
+void gainMapDestroy(clContext * C, GainMap * gainMap)
+{
+    if (gainMap->image) {
+        clImageDestroy(C, gainMap->image);
+    }
+    free(gainMap);
+}
+
+// --------------------------------------------------------------------------------------
+// Application
+
+float gainMapWeight(GainMap * gainMap, float headroom)
+{
+    const GainMapMetadata * metadata = &gainMap->metadata;
+    if (headroom <= 1.0f) {
+        return 0.0f;
+    }
+
+    float logHeadroom = log2f(headroom);
+    float range = metadata->hdrCapacityMax - metadata->hdrCapacityMin;
+    if (range <= 0.0f) {
+        return (logHeadroom >= metadata->hdrCapacityMax) ? 1.0f : 0.0f;
+    }
+    float weight = (logHeadroom - metadata->hdrCapacityMin) / range;
+    return CL_CLAMP(weight, 0.0f, 1.0f);
+}
+
+typedef struct GainMapApplyParams
+{
+    const uint16_t * base; // linear RGBA16
+    uint16_t * dst;        // linear RGBA16
+    int width;
+    int height;
+    const uint8_t * gain; // RGBA8 codes
+    int gainW;
+    int gainH;
+    int * gainX0; // per column bilinear taps into the gain map
+    int * gainX1;
+    float * gainFX;
+    float offsetSDR[3];
+    float offsetHDR[3];
+    float scale; // 1 / peak
+    float lut[3][GAINMAP_LUT_SIZE]; // filtered gain code -> linear gain, weight already applied
+} GainMapApplyParams;
+
+static void gainMapApplyRows(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    GainMapApplyParams * params = (GainMapApplyParams *)userData;
+    const float gainScaleY = (float)params->gainH / (float)params->height;
+    const float lutScale = (float)(GAINMAP_LUT_SIZE - 1) / 255.0f;
+
+    for (int j = first; j < (first + count); ++j) {
+        const float gy = CL_CLAMP(((float)j + 0.5f) * gainScaleY - 0.5f, 0.0f, (float)(params->gainH - 1));
+        const int y0 = (int)gy;
+        const int y1 = (y0 + 1 < params->gainH) ? (y0 + 1) : y0;
+        const float fy = gy - (float)y0;
+        const uint8_t * gainRow0 = &params->gain[(size_t)y0 * params->gainW * 4];
+        const uint8_t * gainRow1 = &params->gain[(size_t)y1 * params->gainW * 4];
+        const uint16_t * baseRow = &params->base[(size_t)j * params->width * 4];
+        uint16_t * dstRow = &params->dst[(size_t)j * params->width * 4];
+
+        for (int i = 0; i < params->width; ++i) {
+            const uint8_t * g00 = &gainRow0[params->gainX0[i] * 4];
+            const uint8_t * g01 = &gainRow0[params->gainX1[i] * 4];
+            const uint8_t * g10 = &gainRow1[params->gainX0[i] * 4];
+            const uint8_t * g11 = &gainRow1[params->gainX1[i] * 4];
+            const float fx = params->gainFX[i];
+
+            for (int c = 0; c < 3; ++c) {
+                const float top = (float)g00[c] + ((float)g01[c] - (float)g00[c]) * fx;
+                const float bottom = (float)g10[c] + ((float)g11[c] - (float)g10[c]) * fx;
+                const int index = (int)((top + (bottom - top) * fy) * lutScale + 0.5f);
+                const float base = (float)baseRow[(i * 4) + c] / 65535.0f;
+                float v = ((base + params->offsetSDR[c]) * params->lut[c][index] - params->offsetHDR[c]) * params->scale;
+                v = CL_CLAMP(v, 0.0f, 1.0f);
+                dstRow[(i * 4) + c] = (uint16_t)(v * 65535.0f + 0.5f);
+            }
+            dstRow[(i * 4) + 3] = baseRow[(i * 4) + 3];
+        }
+    }
+}
+
+clImage * gainMapApply(clContext * C, GainMap * gainMap, clImage * baseImage, float headroom)
+{
+    const GainMapMetadata * metadata = &gainMap->metadata;
+    const float weight = gainMapWeight(gainMap, headroom);
+
+    clProfilePrimaries primaries;
+    int luminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, baseImage->profile, &primaries, NULL, &luminance);
+    if (luminance == CL_LUMINANCE_UNSPECIFIED) {
+        luminance = C->defaultLuminance;
+    }
+
+    clProfileCurve curve;
+    curve.type = CL_PCT_GAMMA;
+    curve.gamma = 1.0f;
+    curve.implicitScale = 1.0f;
+
+    // The gain map is defined on linear light in the base's own primaries
+    clProfile * linearProfile = clProfileCreate(C, &primaries, &curve, luminance, NULL);
+    clImage * linearBase = clImageConvert(C, baseImage, 16, linearProfile, CL_TONEMAP_OFF, NULL);
+    clProfileDestroy(C, linearProfile);
+    if (!linearBase) {
+        return NULL;
+    }
+
+    GainMapApplyParams * params = (GainMapApplyParams *)calloc(1, sizeof(GainMapApplyParams));
+    params->width = linearBase->width;
+    params->height = linearBase->height;
+    params->gainW = gainMap->image->width;
+    params->gainH = gainMap->image->height;
+
+    float peak = 1.0f;
+    for (int c = 0; c < 3; ++c) {
+        params->offsetSDR[c] = metadata->offsetSDR[c];
+        params->offsetHDR[c] = metadata->offsetHDR[c];
+        for (int i = 0; i < GAINMAP_LUT_SIZE; ++i) {
+            float recovery = powf((float)i / (float)(GAINMAP_LUT_SIZE - 1), 1.0f / metadata->gamma[c]);
+            float logBoost = metadata->gainMapMin[c] + (metadata->gainMapMax[c] - metadata->gainMapMin[c]) * recovery;
+            params->lut[c][i] = exp2f(logBoost * weight);
+        }
+        float channelPeak = (1.0f + metadata->offsetSDR[c]) * params->lut[c][GAINMAP_LUT_SIZE - 1] - metadata->offsetHDR[c];
+        peak = fmaxf(peak, channelPeak);
+    }
+    params->scale = 1.0f / peak;
+
+    params->gainX0 = (int *)malloc(sizeof(int) * params->width);
+    params->gainX1 = (int *)malloc(sizeof(int) * params->width);
+    params->gainFX = (float *)malloc(sizeof(float) * params->width);
+    const float gainScaleX = (float)params->gainW / (float)params->width;
+    for (int i = 0; i < params->width; ++i) {
+        const float gx = CL_CLAMP(((float)i + 0.5f) * gainScaleX - 0.5f, 0.0f, (float)(params->gainW - 1));
+        params->gainX0[i] = (int)gx;
+        params->gainX1[i] = (params->gainX0[i] + 1 < params->gainW) ? (params->gainX0[i] + 1) : params->gainX0[i];
+        params->gainFX[i] = gx - (float)params->gainX0[i];
+    }
+
+    // Tag the result so diffuse white stays at the base's luminance
+    clProfile * dstProfile = clProfileCreate(C, &primaries, &curve, (int)((float)luminance * peak + 0.5f), NULL);
+    clImage * dstImage = clImageCreate(C, params->width, params->height, 16, dstProfile);
+    clProfileDestroy(C, dstProfile);
+
+    clImagePrepareReadPixels(C, linearBase, CL_PIXELFORMAT_U16);
+    clImagePrepareReadPixels(C, gainMap->image, CL_PIXELFORMAT_U8);
+    clImagePrepareWritePixels(C, dstImage, CL_PIXELFORMAT_U16);
+    params->base = linearBase->pixelsU16;
+    params->gain = gainMap->image->pixelsU8;
+    params->dst = dstImage->pixelsU16;
+    jobsParallelFor(C, params->height, gainMapApplyRows, params);
+
+    free(params->gainX0);
+    free(params->gainX1);
+    free(params->gainFX);
+    free(params);
+    clImageDestroy(C, linearBase);
+    return dstImage;
+}
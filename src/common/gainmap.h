@@ -0,0 +1,45 @@
+#ifndef GAINMAP_H
+#define GAINMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+
+// Gain map metadata, as found in Ultra HDR "hdrgm" XMP. Per channel values are replicated when
+// the file only provides one. Values the spec stores as log2 are kept as log2.
+typedef struct GainMapMetadata
+{
+    float gainMapMin[3]; // log2
+    float gainMapMax[3]; // log2
+    float gamma[3];
+    float offsetSDR[3];
+    float offsetHDR[3];
+    float hdrCapacityMin; // log2
+    float hdrCapacityMax; // log2
+} GainMapMetadata;
+
+// The gain map plane, kept separate from the SDR base so it can be reapplied cheaply
+typedef struct GainMap
+{
+    clImage * image; // raw gain map codes (never color managed), may be smaller than the base
+    GainMapMetadata metadata;
+} GainMap;
+
+// Returns NULL if filename isn't a JPEG with an SDR base and gain map (Ultra HDR)
+GainMap * gainMapRead(clContext * C, const char * filename);
+void gainMapDestroy(clContext * C, GainMap * gainMap);
+
+// How much of the gain map to apply (0-1) on a display with the given headroom (peak / SDR white)
+float gainMapWeight(GainMap * gainMap, float headroom);
+
+// Returns a linear, 16 bit image in the base image's primaries with the gain map applied at
+// gainMapWeight(headroom). Its luminance tag is scaled so the base's diffuse white is unchanged.
+clImage * gainMapApply(clContext * C, GainMap * gainMap, clImage * baseImage, float headroom);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
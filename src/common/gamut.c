@@ -0,0 +1,449 @@
+#include "gamut.h"
+
+#include "jobs.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// --------------------------------------------------------------------------------------
+// Constants
+
+// ACES reference gamut compression thresholds (cyan, magenta, yellow) and curve power
+static const float GAMUT_THRESHOLDS[3] = { 0.815f, 0.803f, 0.880f };
+static const float GAMUT_POWER = 1.2f;
+
+// Entries per channel in the distance compression table
+#define GAMUT_TABLE_SIZE 1024
+
+// The intermediate uses gamma 2.0, so decoding is a square and encoding a square root
+static const float GAMUT_GAMMA = 2.0f;
+
+// Rows each job decodes and compresses at a time
+static const int GAMUT_BAND_ROWS = 64;
+
+// Pixels each pass of the kernel runs over at a time, so a chunk's planes stay in cache
+#define GAMUT_CHUNK_PIXELS 1024
+
+// Achromatic values under this get no distances (rather than dividing by about zero)
+static const float GAMUT_MIN_ACHROMATIC = 1e-10f;
+
+// --------------------------------------------------------------------------------------
+// Matrices
+
+void gamutInvert(const float m[9], float out[9])
+{
+    float c0 = (m[4] * m[8]) - (m[5] * m[7]);
+    float c1 = (m[5] * m[6]) - (m[3] * m[8]);
+    float c2 = (m[3] * m[7]) - (m[4] * m[6]);
+    float invDet = 1.0f / ((m[0] * c0) + (m[1] * c1) + (m[2] * c2));
+    out[0] = c0 * invDet;
+    out[1] = ((m[2] * m[7]) - (m[1] * m[8])) * invDet;
+    out[2] = ((m[1] * m[5]) - (m[2] * m[4])) * invDet;
+    out[3] = c1 * invDet;
+    out[4] = ((m[0] * m[8]) - (m[2] * m[6])) * invDet;
+    out[5] = ((m[2] * m[3]) - (m[0] * m[5])) * invDet;
+    out[6] = c2 * invDet;
+    out[7] = ((m[1] * m[6]) - (m[0] * m[7])) * invDet;
+    out[8] = ((m[0] * m[4]) - (m[1] * m[3])) * invDet;
+}
+
+void gamutMultiply(const float a[9], const float b[9], float out[9])
+{
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            out[(r * 3) + c] = (a[(r * 3) + 0] * b[c]) + (a[(r * 3) + 1] * b[3 + c]) + (a[(r * 3) + 2] * b[6 + c]);
+        }
+    }
+}
+
+// Linear RGB -> XYZ (row major), scaled so white has Y = 1
+void gamutRGBToXYZ(const clProfilePrimaries * primaries, float out[9])
+{
+    const float * xy[3] = { primaries->red, primaries->green, primaries->blue };
+    float m[9];
+    for (int i = 0; i < 3; ++i) {
+        m[i] = xy[i][0] / xy[i][1];
+        m[3 + i] = 1.0f;
+        m[6 + i] = (1.0f - xy[i][0] - xy[i][1]) / xy[i][1];
+    }
+    float white[3] = { primaries->white[0] / primaries->white[1],
+                       1.0f,
+                       (1.0f - primaries->white[0] - primaries->white[1]) / primaries->white[1] };
+    float inv[9];
+    gamutInvert(m, inv);
+    for (int i = 0; i < 3; ++i) {
+        float s = (inv[(i * 3) + 0] * white[0]) + (inv[(i * 3) + 1] * white[1]) + (inv[(i * 3) + 2] * white[2]);
+        m[i] *= s;
+        m[3 + i] *= s;
+        m[6 + i] *= s;
+    }
+    for (int i = 0; i < 9; ++i) {
+        out[i] = m[i];
+    }
+}
+
+void gamutTransform(const float m[9], const float in[3], float out[3])
+{
+    out[0] = (m[0] * in[0]) + (m[1] * in[1]) + (m[2] * in[2]);
+    out[1] = (m[3] * in[0]) + (m[4] * in[1]) + (m[5] * in[2]);
+    out[2] = (m[6] * in[0]) + (m[7] * in[1]) + (m[8] * in[2]);
+}
+
+// --------------------------------------------------------------------------------------
+// Compression
+
+// ACES RGC curve: distances below threshold pass through, limit lands on 1
+static float gamutCompressDistance(float d, float threshold, float limit)
+{
+    if (d < threshold) {
+        return d;
+    }
+    float range = limit - threshold;
+    float scale = range / powf(powf((1.0f - threshold) / range, -GAMUT_POWER) - 1.0f, 1.0f / GAMUT_POWER);
+    float n = (d - threshold) / scale;
+    return threshold + (scale * n / powf(1.0f + powf(n, GAMUT_POWER), 1.0f / GAMUT_POWER));
+}
+
+// Scratch for a chunk of pixels, kept as planes so the arithmetic passes vectorize
+typedef struct GamutChunk
+{
+    float rgb[3][GAMUT_CHUNK_PIXELS];      // linear, source primaries and then BT.709
+    float alpha[GAMUT_CHUNK_PIXELS];       // channel code
+    float achromatic[GAMUT_CHUNK_PIXELS];  // largest BT.709 channel
+    float distance[3][GAMUT_CHUNK_PIXELS]; // table position, and then how far the channel is pulled in
+} GamutChunk;
+
+typedef struct GamutCompress
+{
+    clContext * C;
+    clImage * srcImage;
+    JobsCancel * cancel;
+    clProfile * bandProfile; // source primaries, gamma 2.0: what bands are converted to (NULL if the source is decoded directly)
+    float * decodeTable;     // channel code -> linear, for the source (or for converted bands)
+    int maxCode;
+    float alphaScale;        // alpha channel code -> 16 bit
+    uint16_t * dst;
+    int width;
+    int height;
+    int * jobFailed;
+    float matrix[9];                      // source linear RGB -> BT.709 linear RGB
+    float tableScale[3];                  // distance -> table position, 0 on channels that aren't compressed
+    float table[3][GAMUT_TABLE_SIZE + 1]; // how far a channel is pulled in, over distances [0, limit]
+} GamutCompress;
+
+// Channel codes -> linear planes (a gather, so it's kept apart from the arithmetic)
+static void gamutDecodeChunk(const GamutCompress * gc, GamutChunk * chunk, const clImage * image, size_t first, int count)
+{
+    const float * table = gc->decodeTable;
+    if (image->depth > 8) {
+        const uint16_t * src = &image->pixelsU16[first * 4];
+        const int maxCode = gc->maxCode;
+        for (int i = 0; i < count; ++i) {
+            const uint16_t * s = &src[i * 4];
+            chunk->rgb[0][i] = table[(s[0] < maxCode) ? s[0] : maxCode];
+            chunk->rgb[1][i] = table[(s[1] < maxCode) ? s[1] : maxCode];
+            chunk->rgb[2][i] = table[(s[2] < maxCode) ? s[2] : maxCode];
+            chunk->alpha[i] = (float)s[3];
+        }
+    } else {
+        const uint8_t * src = &image->pixelsU8[first * 4];
+        for (int i = 0; i < count; ++i) {
+            const uint8_t * s = &src[i * 4];
+            chunk->rgb[0][i] = table[s[0]];
+            chunk->rgb[1][i] = table[s[1]];
+            chunk->rgb[2][i] = table[s[2]];
+            chunk->alpha[i] = (float)s[3];
+        }
+    }
+}
+
+// To BT.709, and each channel's distance from the achromatic axis as a table position. Branch
+// free, so it vectorizes.
+static void gamutMeasureChunk(const GamutCompress * gc, GamutChunk * chunk, int count)
+{
+    // Locals, so stores to the planes can't alias them
+    float m[9];
+    for (int i = 0; i < 9; ++i) {
+        m[i] = gc->matrix[i];
+    }
+    const float scaleR = gc->tableScale[0];
+    const float scaleG = gc->tableScale[1];
+    const float scaleB = gc->tableScale[2];
+    const float tableEnd = (float)GAMUT_TABLE_SIZE;
+    for (int i = 0; i < count; ++i) {
+        const float r = chunk->rgb[0][i];
+        const float g = chunk->rgb[1][i];
+        const float b = chunk->rgb[2][i];
+        const float r709 = (m[0] * r) + (m[1] * g) + (m[2] * b);
+        const float g709 = (m[3] * r) + (m[4] * g) + (m[5] * b);
+        const float b709 = (m[6] * r) + (m[7] * g) + (m[8] * b);
+        const float rg = (r709 > g709) ? r709 : g709;
+        const float achromatic = (rg > b709) ? rg : b709;
+        const float invAchromatic = 1.0f / ((achromatic > GAMUT_MIN_ACHROMATIC) ? achromatic : GAMUT_MIN_ACHROMATIC);
+        const float posR = (achromatic - r709) * invAchromatic * scaleR;
+        const float posG = (achromatic - g709) * invAchromatic * scaleG;
+        const float posB = (achromatic - b709) * invAchromatic * scaleB;
+        chunk->rgb[0][i] = r709;
+        chunk->rgb[1][i] = g709;
+        chunk->rgb[2][i] = b709;
+        chunk->achromatic[i] = achromatic;
+        chunk->distance[0][i] = (posR < tableEnd) ? posR : tableEnd;
+        chunk->distance[1][i] = (posG < tableEnd) ? posG : tableEnd;
+        chunk->distance[2][i] = (posB < tableEnd) ? posB : tableEnd;
+    }
+}
+
+// Table positions -> how far each channel is pulled in (the other gather)
+static void gamutLookupChunk(const GamutCompress * gc, GamutChunk * chunk, int count)
+{
+    for (int c = 0; c < 3; ++c) {
+        const float * table = gc->table[c];
+        float * distance = chunk->distance[c];
+        for (int i = 0; i < count; ++i) {
+            const float pos = distance[i];
+            int index = (int)pos;
+            if (index >= GAMUT_TABLE_SIZE) {
+                index = GAMUT_TABLE_SIZE - 1;
+            }
+            distance[i] = table[index] + ((table[index + 1] - table[index]) * (pos - (float)index));
+        }
+    }
+}
+
+// Pulls the channels in and encodes them as 16 bit gamma 2.0. Branch free, so it vectorizes.
+static uint16_t gamutEncode(float v)
+{
+    v = (v > 0.0f) ? v : 0.0f;
+    v = (v < 1.0f) ? v : 1.0f;
+    return (uint16_t)((sqrtf(v) * 65535.0f) + 0.5f);
+}
+
+static void gamutEncodeChunk(const GamutCompress * gc, const GamutChunk * chunk, uint16_t * dst, int count)
+{
+    const float alphaScale = gc->alphaScale;
+    for (int i = 0; i < count; ++i) {
+        // Nothing is pulled in without a positive channel to pull toward
+        const float achromatic = (chunk->achromatic[i] > 0.0f) ? chunk->achromatic[i] : 0.0f;
+        uint16_t * d = &dst[i * 4];
+        d[0] = gamutEncode(chunk->rgb[0][i] + (achromatic * chunk->distance[0][i]));
+        d[1] = gamutEncode(chunk->rgb[1][i] + (achromatic * chunk->distance[1][i]));
+        d[2] = gamutEncode(chunk->rgb[2][i] + (achromatic * chunk->distance[2][i]));
+        d[3] = (uint16_t)((chunk->alpha[i] * alphaScale) + 0.5f);
+    }
+}
+
+// Compresses pixels [first, first + count) of image into dst a chunk at a time, reading image
+// between jobsReadBegin() and jobsReadEnd(). Returns 0 if cancelled.
+static int gamutCompressPixels(const GamutCompress * gc, GamutChunk * chunk, JobsCancel * cancel, const clImage * image, size_t first, size_t count, uint16_t * dst)
+{
+    for (size_t done = 0; done < count; done += GAMUT_CHUNK_PIXELS) {
+        const int chunkCount = ((count - done) < GAMUT_CHUNK_PIXELS) ? (int)(count - done) : GAMUT_CHUNK_PIXELS;
+        if (!jobsReadBegin(cancel)) {
+            return 0;
+        }
+        gamutDecodeChunk(gc, chunk, image, first + done, chunkCount);
+        jobsReadEnd(cancel);
+        gamutMeasureChunk(gc, chunk, chunkCount);
+        gamutLookupChunk(gc, chunk, chunkCount);
+        gamutEncodeChunk(gc, chunk, &dst[done * 4], chunkCount);
+    }
+    return 1;
+}
+
+static void gamutCompressBands(void * userData, int jobIndex, int first, int count)
+{
+    GamutCompress * gc = (GamutCompress *)userData;
+    GamutChunk * chunk = (GamutChunk *)malloc(sizeof(GamutChunk));
+    clContext * C = jobsCreateContext(gc->C);
+    clProfile * profile = gc->bandProfile ? clProfileClone(C, gc->bandProfile) : NULL;
+    for (int band = first; band < (first + count); ++band) {
+        const int y = band * GAMUT_BAND_ROWS;
+        const int rowCount = ((gc->height - y) < GAMUT_BAND_ROWS) ? (gc->height - y) : GAMUT_BAND_ROWS;
+        const size_t pixelCount = (size_t)gc->width * rowCount;
+        uint16_t * dst = &gc->dst[(size_t)y * gc->width * 4];
+        int compressed = 0;
+        if (!profile) {
+            compressed = gamutCompressPixels(gc, chunk, gc->cancel, gc->srcImage, (size_t)y * gc->width, pixelCount, dst);
+        } else {
+            clImage * rows = jobsCropRows(C, gc->cancel, gc->srcImage, y, rowCount);
+            clImage * decoded = rows ? clImageConvert(C, rows, 16, profile, CL_TONEMAP_OFF, NULL) : NULL;
+            if (rows) {
+                clImageDestroy(C, rows);
+            }
+            if (decoded) {
+                clImagePrepareReadPixels(C, decoded, CL_PIXELFORMAT_U16);
+                compressed = gamutCompressPixels(gc, chunk, NULL, decoded, 0, pixelCount, dst);
+                clImageDestroy(C, decoded);
+            }
+        }
+        if (!compressed) {
+            gc->jobFailed[jobIndex] = 1;
+            break;
+        }
+    }
+    if (profile) {
+        clProfileDestroy(C, profile);
+    }
+    clContextDestroy(C);
+    free(chunk);
+}
+
+// Samples srcProfile's curve at every channel code, converting a ramp of greys to decodeProfile
+// just as a band would be. NULL if it failed.
+static float * gamutCreateDecodeTable(clContext * C, clProfile * srcProfile, int depth, clProfile * decodeProfile)
+{
+    const int codeCount = 1 << depth;
+    clImage * ramp = clImageCreate(C, codeCount, 1, depth, srcProfile);
+    clImagePrepareWritePixels(C, ramp, (depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    for (int i = 0; i < codeCount; ++i) {
+        if (depth > 8) {
+            uint16_t * pixel = &ramp->pixelsU16[i * 4];
+            pixel[0] = pixel[1] = pixel[2] = (uint16_t)i;
+            pixel[3] = (uint16_t)(codeCount - 1);
+        } else {
+            uint8_t * pixel = &ramp->pixelsU8[i * 4];
+            pixel[0] = pixel[1] = pixel[2] = (uint8_t)i;
+            pixel[3] = (uint8_t)(codeCount - 1);
+        }
+    }
+    clImage * decoded = clImageConvert(C, ramp, 16, decodeProfile, CL_TONEMAP_OFF, NULL);
+    clImageDestroy(C, ramp);
+    if (!decoded) {
+        return NULL;
+    }
+    clImagePrepareReadPixels(C, decoded, CL_PIXELFORMAT_U16);
+    float * table = (float *)malloc(codeCount * sizeof(float));
+    for (int i = 0; i < codeCount; ++i) {
+        float v = (float)decoded->pixelsU16[i * 4] / 65535.0f;
+        table[i] = v * v;
+    }
+    clImageDestroy(C, decoded);
+    return table;
+}
+
+clImage * gamutCompress(clContext * C, clImage * srcImage, JobsCancel * cancel)
+{
+    if (!jobsReadBegin(cancel)) {
+        return NULL;
+    }
+    clProfilePrimaries srcPrimaries;
+    clProfileCurve srcCurve;
+    int srcLuminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, srcImage->profile, &srcPrimaries, &srcCurve, &srcLuminance);
+    const int width = srcImage->width;
+    const int height = srcImage->height;
+    const int depth = srcImage->depth;
+
+    // Gamma and PQ curves are per channel, so a table of codes decodes the source's own pixels
+    // just as converting it would. Anything else (HLG's OOTF mixes channels) is converted a band
+    // at a time.
+    const int decodeDirect = (srcCurve.type == CL_PCT_GAMMA) || (srcCurve.type == CL_PCT_PQ);
+    clProfile * srcProfile = decodeDirect ? clProfileClone(C, srcImage->profile) : NULL;
+    clImagePrepareReadPixels(C, srcImage, (depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    jobsReadEnd(cancel);
+
+    if (srcLuminance == CL_LUMINANCE_UNSPECIFIED) {
+        srcLuminance = C->defaultLuminance;
+    }
+    clProfilePrimaries bt709Primaries;
+    clContextGetStockPrimaries(C, "bt709", &bt709Primaries);
+
+    GamutCompress * gc = (GamutCompress *)calloc(1, sizeof(GamutCompress));
+    float srcToXYZ[9];
+    float bt709ToXYZ[9];
+    float xyzToBT709[9];
+    gamutRGBToXYZ(&srcPrimaries, srcToXYZ);
+    gamutRGBToXYZ(&bt709Primaries, bt709ToXYZ);
+    gamutInvert(bt709ToXYZ, xyzToBT709);
+    gamutMultiply(xyzToBT709, srcToXYZ, gc->matrix);
+
+    // The furthest the source gamut reaches past each BT.709 channel, taken from the corners
+    // (primaries and secondaries) of the source cube
+    static const float corners[6][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 1, 0, 1 }, { 1, 1, 0 } };
+    float limit[3] = { 0.0f, 0.0f, 0.0f };
+    int anyCompress = 0;
+    for (int i = 0; i < 6; ++i) {
+        float rgb[3];
+        gamutTransform(gc->matrix, corners[i], rgb);
+        float achromatic = fmaxf(rgb[0], fmaxf(rgb[1], rgb[2]));
+        for (int c = 0; c < 3; ++c) {
+            float distance = (achromatic - rgb[c]) / achromatic;
+            limit[c] = fmaxf(limit[c], distance);
+        }
+    }
+    for (int c = 0; c < 3; ++c) {
+        // Nothing reaches past the boundary (distance 1, a zero channel) on this channel, so its
+        // table stays all zero
+        if (limit[c] <= 1.0001f) {
+            continue;
+        }
+        anyCompress = 1;
+        gc->tableScale[c] = (float)GAMUT_TABLE_SIZE / limit[c];
+        for (int i = 0; i <= GAMUT_TABLE_SIZE; ++i) {
+            float distance = limit[c] * (float)i / (float)GAMUT_TABLE_SIZE;
+            gc->table[c][i] = distance - gamutCompressDistance(distance, GAMUT_THRESHOLDS[c], limit[c]);
+        }
+    }
+    if (!anyCompress) {
+        if (srcProfile) {
+            clProfileDestroy(C, srcProfile);
+        }
+        free(gc);
+        return NULL;
+    }
+
+    clProfileCurve curve;
+    curve.type = CL_PCT_GAMMA;
+    curve.gamma = GAMUT_GAMMA;
+    curve.implicitScale = 1.0f;
+    clProfile * decodeProfile = clProfileCreate(C, &srcPrimaries, &curve, srcLuminance, NULL);
+    if (srcProfile) {
+        gc->decodeTable = gamutCreateDecodeTable(C, srcProfile, depth, decodeProfile);
+        clProfileDestroy(C, srcProfile);
+    }
+    if (gc->decodeTable) {
+        gc->maxCode = (1 << depth) - 1;
+        clProfileDestroy(C, decodeProfile);
+    } else {
+        gc->bandProfile = decodeProfile;
+        gc->maxCode = 65535;
+        gc->decodeTable = (float *)malloc((gc->maxCode + 1) * sizeof(float));
+        for (int i = 0; i <= gc->maxCode; ++i) {
+            float v = (float)i / 65535.0f;
+            gc->decodeTable[i] = v * v;
+        }
+    }
+    gc->alphaScale = 65535.0f / (float)gc->maxCode;
+
+    clProfile * dstProfile = clProfileCreate(C, &bt709Primaries, &curve, srcLuminance, NULL);
+    clImage * dstImage = clImageCreate(C, width, height, 16, dstProfile);
+    clProfileDestroy(C, dstProfile);
+    clImagePrepareWritePixels(C, dstImage, CL_PIXELFORMAT_U16);
+
+    const int jobs = jobsCount(C);
+    gc->C = C;
+    gc->srcImage = srcImage;
+    gc->cancel = cancel;
+    gc->dst = dstImage->pixelsU16;
+    gc->width = width;
+    gc->height = height;
+    gc->jobFailed = (int *)calloc(jobs, sizeof(int));
+    const int bandCount = (height + GAMUT_BAND_ROWS - 1) / GAMUT_BAND_ROWS;
+    jobsParallelFor(C, bandCount, gamutCompressBands, gc);
+
+    int failed = 0;
+    for (int j = 0; j < jobs; ++j) {
+        failed |= gc->jobFailed[j];
+    }
+    free(gc->jobFailed);
+    free(gc->decodeTable);
+    if (gc->bandProfile) {
+        clProfileDestroy(C, gc->bandProfile);
+    }
+    free(gc);
+    if (failed) {
+        clImageDestroy(C, dstImage);
+        return NULL;
+    }
+    return dstImage;
+}
@@ -0,0 +1,35 @@
+#ifndef GAMUT_H
+#define GAMUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+#include "jobs.h"
+
+typedef enum GamutMode
+{
+    GAMUTMODE_CLIP = 0, // colorist's conversion, out of gamut colors are clipped per channel
+    GAMUTMODE_COMPRESS  // gamutCompress() first, out of gamut colors roll off toward the boundary
+} GamutMode;
+
+// Reference gamut compression (ACES RGC style) of srcImage into BT.709. Each channel's distance
+// from the achromatic axis is compressed past a threshold so the edge of the source gamut lands
+// on the BT.709 boundary. Jobs decode the source's pixels through a table sampled from its
+// curve (HLG sources are converted a band at a time instead) and compress them in chunks.
+// Returns a 16 bit BT.709 image (gamma 2.0) at the source's luminance, or NULL if the source's
+// primaries already fit in BT.709 (or it failed, or cancel was set; cancel may be NULL).
+clImage * gamutCompress(clContext * C, clImage * srcImage, JobsCancel * cancel);
+
+// Row major 3x3 matrices, shared with the HDR measurements
+void gamutInvert(const float m[9], float out[9]);
+void gamutMultiply(const float a[9], const float b[9], float out[9]);
+void gamutRGBToXYZ(const clProfilePrimaries * primaries, float out[9]); // linear RGB -> XYZ, white has Y = 1
+void gamutTransform(const float m[9], const float in[3], float out[3]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
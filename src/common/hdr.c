@@ -0,0 +1,1076 @@
+#include "hdr.h"
+
+#include "gamut.h"
+#include "jobs.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --------------------------------------------------------------------------------------
+// Constants
+
+// Sources are measured as 16 bit gamma 2.0 in their own primaries (as gamutCompress() reads
+// them), so nothing is clipped before the BT.709 channels are looked at
+static const float HDR_GAMMA = 2.0f;
+
+// Saturation past 1 still counted as in gamut, rounding in the conversion lands just over it
+static const float HDR_GAMUT_TOLERANCE = 0.001f;
+
+// sRGB luminance bands are measured by clImageMeasureHDR() at. Per pixel values scale with it
+// (maxNits is a pixel's peak at this luminance), so the planes work for any threshold.
+static const int HDR_REFERENCE_LUMINANCE = 100;
+
+// Planes keep BT.709 channels in nits up to this (as gamma 2.0), and histograms have a bin per
+// whole nit up to it, plus one for anything brighter
+#define HDR_NITS_MAX 10000
+#define HDR_NITS_BINS (HDR_NITS_MAX + 2)
+
+// The fourth plane value: the peak's bin, and whether the pixel is out of gamut
+#define HDR_CODE_PEAK 0x7fff
+#define HDR_CODE_OUTOFGAMUT_SHIFT 15
+
+// Pixels measured per span. A job converts and measures a band of this many rows at a time.
+#define HDR_TILE_SIZE 64
+
+// Light level histograms bin nits by their float exponent and top mantissa bits (bins under 1%
+// wide), from 2^HDR_LIGHT_MIN_EXPONENT (anything dimmer is bin 0) to 2^HDR_LIGHT_MAX_EXPONENT
+#define HDR_LIGHT_MANTISSA_BITS 7
+#define HDR_LIGHT_MIN_EXPONENT -16
+#define HDR_LIGHT_MAX_EXPONENT 14
+#define HDR_LIGHT_BINS (((HDR_LIGHT_MAX_EXPONENT - HDR_LIGHT_MIN_EXPONENT) << HDR_LIGHT_MANTISSA_BITS) + 1)
+
+// Measured light levels can be this far over the declared ones (relative, then in nits) and match
+static const float HDR_CLLI_TOLERANCE = 0.01f;
+static const float HDR_CLLI_TOLERANCE_NITS = 1.0f;
+
+// An AVIF / HEIF meta box (item info, locations and properties, not pixels) past this isn't read
+// for its light levels
+#define HDR_CLLI_MAX_META_BYTES (16 * 1024 * 1024)
+
+#define HDR_FOURCC(a, b, c, d) (((uint32_t)(a) << 24) | ((uint32_t)(b) << 16) | ((uint32_t)(c) << 8) | (uint32_t)(d))
+
+enum
+{
+    HDRCLASS_FITS = 0,
+    HDRCLASS_OVERBRIGHT = 1,
+    HDRCLASS_OUTOFGAMUT = 2,
+    HDRCLASS_BOTH = 3
+};
+
+// Flagged pixels in the highlight: overbright sets blue, out of gamut red (so both is magenta)
+static const uint8_t HDR_FLAG_ON = 255;
+
+// --------------------------------------------------------------------------------------
+// Pixels
+
+typedef struct HDRMeasure
+{
+    float toBT709[9];    // source linear RGB -> BT.709 linear RGB
+    float srcLuminance;  // nits of the source's white
+    clProfile * profile; // the source's primaries at HDR_GAMMA
+} HDRMeasure;
+
+static int hdrSourceLuminance(clContext * C, clImage * srcImage, int defaultLuminance, clProfilePrimaries * primaries)
+{
+    int srcLuminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, srcImage->profile, primaries, NULL, &srcLuminance);
+    if (srcLuminance == CL_LUMINANCE_UNSPECIFIED) {
+        srcLuminance = defaultLuminance;
+    }
+    return srcLuminance;
+}
+
+// Thresholds are whole nits, and an SDR display is at least 1 nit
+static int hdrThreshold(int srgbLuminance)
+{
+    return (srgbLuminance > 0) ? srgbLuminance : 1;
+}
+
+static void hdrInit(clContext * C, clImage * srcImage, HDRMeasure * hm)
+{
+    clProfilePrimaries srcPrimaries;
+    const int srcLuminance = hdrSourceLuminance(C, srcImage, C->defaultLuminance, &srcPrimaries);
+    clProfilePrimaries bt709Primaries;
+    clContextGetStockPrimaries(C, "bt709", &bt709Primaries);
+
+    float srcToXYZ[9];
+    float bt709ToXYZ[9];
+    float xyzToBT709[9];
+    gamutRGBToXYZ(&srcPrimaries, srcToXYZ);
+    gamutRGBToXYZ(&bt709Primaries, bt709ToXYZ);
+    gamutInvert(bt709ToXYZ, xyzToBT709);
+    gamutMultiply(xyzToBT709, srcToXYZ, hm->toBT709);
+    hm->srcLuminance = (float)srcLuminance;
+
+    clProfileCurve curve;
+    curve.type = CL_PCT_GAMMA;
+    curve.gamma = HDR_GAMMA;
+    curve.implicitScale = 1.0f;
+    hm->profile = clProfileCreate(C, &srcPrimaries, &curve, srcLuminance, NULL);
+}
+
+// Every intermediate of a span, one array each
+typedef struct HDRSpan
+{
+    float nits[HDR_TILE_SIZE];
+    float peak[HDR_TILE_SIZE]; // nits of the largest BT.709 channel
+    float saturation[HDR_TILE_SIZE];
+    float bt709[3][HDR_TILE_SIZE]; // relative to the source's white
+    int nitsBin[HDR_TILE_SIZE];
+    int peakBin[HDR_TILE_SIZE];
+    int outOfGamut[HDR_TILE_SIZE];
+} HDRSpan;
+
+// Whole nits rounded up, so (bin > t) is exactly (nits > t) for any whole t
+static float hdrBin(float nits)
+{
+    return fminf(fmaxf(ceilf(nits), 0.0f), (float)(HDR_NITS_BINS - 1));
+}
+
+// Branch free so the compiler can vectorize. Everything classified (nits, peak, saturation) is
+// read from clImageMeasureHDR()'s info for the same pixels; only the BT.709 channels the
+// highlight draws fitting pixels with are converted here, from count (up to HDR_TILE_SIZE) pixels.
+static void hdrMeasureSpan(const HDRMeasure * hm, const uint16_t * p, const clImageHDRPixel * info, int count, HDRSpan * span)
+{
+    for (int i = 0; i < count; ++i, p += 4) {
+        float r = (float)p[0] / 65535.0f;
+        float g = (float)p[1] / 65535.0f;
+        float b = (float)p[2] / 65535.0f;
+        r *= r;
+        g *= g;
+        b *= b;
+        const float r709 = (hm->toBT709[0] * r) + (hm->toBT709[1] * g) + (hm->toBT709[2] * b);
+        const float g709 = (hm->toBT709[3] * r) + (hm->toBT709[4] * g) + (hm->toBT709[5] * b);
+        const float b709 = (hm->toBT709[6] * r) + (hm->toBT709[7] * g) + (hm->toBT709[8] * b);
+
+        // Black has no peak, the division is discarded
+        const float nits = info[i].nits;
+        const int lit = info[i].maxNits > 0.0f;
+        const float safeMaxNits = lit ? info[i].maxNits : 1.0f;
+        const float peak = lit ? ((nits * (float)HDR_REFERENCE_LUMINANCE) / safeMaxNits) : 0.0f;
+        const float saturation = info[i].saturation;
+        span->nits[i] = nits;
+        span->peak[i] = peak;
+        span->saturation[i] = saturation;
+        span->bt709[0][i] = r709;
+        span->bt709[1][i] = g709;
+        span->bt709[2][i] = b709;
+        span->nitsBin[i] = (int)hdrBin(nits);
+        span->peakBin[i] = (int)hdrBin(peak);
+        span->outOfGamut[i] = saturation > (1.0f + HDR_GAMUT_TOLERANCE);
+    }
+}
+
+// clImageMeasureHDR() over rows, which come from the source's own pixels: fills info (sized for
+// the rows) and stats, with the brightest pixel moved to image coordinates (y0 down). Colorist
+// always builds a highlight, it's dropped.
+static void hdrMeasureRows(clContext * C, clImage * rows, int y0, clImageHDRPixelInfo * info, clImageHDRStats * stats)
+{
+    clImage * highlight = NULL;
+    clImageHDRQuantization quant;
+    clImageMeasureHDR(C, rows, HDR_REFERENCE_LUMINANCE, 0.0f, &highlight, stats, info, &quant);
+    if (highlight) {
+        clImageDestroy(C, highlight);
+    }
+    stats->brightestPixelY += y0;
+}
+
+// Writes a span's plane values, the channels in nits over HDR_NITS_MAX back at gamma 2.0
+static void hdrPackSpan(const HDRMeasure * hm, const HDRSpan * span, int count, uint16_t * dst)
+{
+    const float scale = hm->srcLuminance / (float)HDR_NITS_MAX;
+    for (int i = 0; i < count; ++i, dst += 4) {
+        for (int c = 0; c < 3; ++c) {
+            const float v = fminf(fmaxf(span->bt709[c][i] * scale, 0.0f), 1.0f);
+            dst[c] = (uint16_t)((sqrtf(v) * 65535.0f) + 0.5f);
+        }
+        dst[3] = (uint16_t)(span->peakBin[i] | (span->outOfGamut[i] << HDR_CODE_OUTOFGAMUT_SHIFT));
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Planes
+
+typedef struct HDRBrightest
+{
+    float nits; // -1 until a pixel is measured
+    int x;
+    int y;
+} HDRBrightest;
+
+typedef struct HDRPlanesJobs
+{
+    clContext * C;
+    clImage * srcImage;
+    const HDRMeasure * hm;
+    HDRPlanes * planes;
+    int * histograms;         // per job, the in gamut peak, out of gamut peak and nits histograms in a row
+    HDRBrightest * brightest; // per job
+    int * jobFailed;
+} HDRPlanesJobs;
+
+// Brighter, or as bright and earlier in row order, so any reduction order picks the same pixel
+static int hdrBrighter(float nits, int x, int y, const HDRBrightest * than)
+{
+    if (nits != than->nits) {
+        return nits > than->nits;
+    }
+    return (y < than->y) || ((y == than->y) && (x < than->x));
+}
+
+static void hdrMeasureTileRows(void * userData, int jobIndex, int first, int count)
+{
+    HDRPlanesJobs * hj = (HDRPlanesJobs *)userData;
+    const HDRMeasure * hm = hj->hm;
+    HDRPlanes * planes = hj->planes;
+    int * peakHistograms = &hj->histograms[(size_t)jobIndex * 3 * HDR_NITS_BINS];
+    int * nitsHistogram = &peakHistograms[2 * HDR_NITS_BINS];
+    HDRBrightest * brightest = &hj->brightest[jobIndex];
+
+    // Each job measures and converts its own bands of the source
+    clContext * C = jobsCreateContext(hj->C);
+    clProfile * profile = clProfileClone(C, hm->profile);
+    clImageHDRPixelInfo * info = clImageHDRPixelInfoCreate(C, planes->width * HDR_TILE_SIZE);
+    HDRSpan * span = (HDRSpan *)malloc(sizeof(HDRSpan));
+    for (int ty = first; ty < (first + count); ++ty) {
+        const int y0 = ty * HDR_TILE_SIZE;
+        const int rowCount = ((planes->height - y0) < HDR_TILE_SIZE) ? (planes->height - y0) : HDR_TILE_SIZE;
+        clImage * rows = clImageCrop(C, hj->srcImage, 0, y0, planes->width, rowCount, clTrue);
+        clImage * band = rows ? clImageConvert(C, rows, 16, profile, CL_TONEMAP_OFF, NULL) : NULL;
+        if (!band) {
+            if (rows) {
+                clImageDestroy(C, rows);
+            }
+            hj->jobFailed[jobIndex] = 1;
+            break;
+        }
+        clImageHDRStats stats;
+        hdrMeasureRows(C, rows, y0, info, &stats);
+        clImageDestroy(C, rows);
+        clImagePrepareReadPixels(C, band, CL_PIXELFORMAT_U16);
+
+        for (int j = 0; j < rowCount; ++j) {
+            const int y = y0 + j;
+            for (int x0 = 0; x0 < planes->width; x0 += HDR_TILE_SIZE) {
+                const int spanCount = ((planes->width - x0) < HDR_TILE_SIZE) ? (planes->width - x0) : HDR_TILE_SIZE;
+                const size_t offset = ((size_t)j * planes->width) + x0;
+                hdrMeasureSpan(hm, &band->pixelsU16[offset * 4], &info->pixels[offset], spanCount, span);
+                hdrPackSpan(hm, span, spanCount, &planes->pixels[(((size_t)y * planes->width) + x0) * 4]);
+
+                for (int i = 0; i < spanCount; ++i) {
+                    ++peakHistograms[(span->outOfGamut[i] * HDR_NITS_BINS) + span->peakBin[i]];
+                    ++nitsHistogram[span->nitsBin[i]];
+                }
+            }
+        }
+
+        // Colorist's pick within the band, a job's bands are in row order so the first of a tie is kept
+        if (stats.brightestPixelNits > brightest->nits) {
+            brightest->nits = stats.brightestPixelNits;
+            brightest->x = stats.brightestPixelX;
+            brightest->y = stats.brightestPixelY;
+        }
+        clImageDestroy(C, band);
+    }
+    free(span);
+    clImageHDRPixelInfoDestroy(C, info);
+    clProfileDestroy(C, profile);
+    clContextDestroy(C);
+}
+
+HDRPlanes * hdrPlanesCreate(clContext * C, clImage * srcImage)
+{
+    HDRMeasure hm;
+    hdrInit(C, srcImage, &hm);
+
+    HDRPlanes * planes = (HDRPlanes *)calloc(1, sizeof(HDRPlanes));
+    planes->source = srcImage;
+    planes->width = srcImage->width;
+    planes->height = srcImage->height;
+    planes->srcLuminance = hm.srcLuminance;
+    planes->pixels = (uint16_t *)malloc((size_t)planes->width * planes->height * 4 * sizeof(uint16_t));
+    planes->histogramSize = HDR_NITS_BINS;
+    planes->peakHistogram = (int *)calloc(HDR_NITS_BINS, sizeof(int));
+    planes->peakHistogramOutOfGamut = (int *)calloc(HDR_NITS_BINS, sizeof(int));
+    planes->nitsHistogram = (int *)calloc(HDR_NITS_BINS, sizeof(int));
+
+    const int jobs = jobsCount(C);
+    HDRPlanesJobs hj;
+    hj.C = C;
+    hj.srcImage = srcImage;
+    hj.hm = &hm;
+    hj.planes = planes;
+    hj.histograms = (int *)calloc((size_t)jobs * 3 * HDR_NITS_BINS, sizeof(int));
+    hj.brightest = (HDRBrightest *)calloc(jobs, sizeof(HDRBrightest));
+    for (int j = 0; j < jobs; ++j) {
+        hj.brightest[j].nits = -1.0f;
+    }
+    hj.jobFailed = (int *)calloc(jobs, sizeof(int));
+
+    clImagePrepareReadPixels(C, srcImage, (srcImage->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    const int tilesY = (srcImage->height + HDR_TILE_SIZE - 1) / HDR_TILE_SIZE;
+    jobsParallelFor(C, tilesY, hdrMeasureTileRows, &hj);
+
+    int failed = 0;
+    HDRBrightest total;
+    total.nits = -1.0f;
+    total.x = 0;
+    total.y = 0;
+    for (int j = 0; j < jobs; ++j) {
+        failed |= hj.jobFailed[j];
+
+        const int * histograms = &hj.histograms[(size_t)j * 3 * HDR_NITS_BINS];
+        for (int i = 0; i < HDR_NITS_BINS; ++i) {
+            planes->peakHistogram[i] += histograms[i];
+            planes->peakHistogramOutOfGamut[i] += histograms[HDR_NITS_BINS + i];
+            planes->nitsHistogram[i] += histograms[(2 * HDR_NITS_BINS) + i];
+        }
+
+        // The tie break keeps the earliest band's, as a serial scan would
+        const HDRBrightest * brightest = &hj.brightest[j];
+        if ((brightest->nits >= 0.0f) && hdrBrighter(brightest->nits, brightest->x, brightest->y, &total)) {
+            total = *brightest;
+        }
+    }
+    free(hj.histograms);
+    free(hj.brightest);
+    free(hj.jobFailed);
+    clProfileDestroy(C, hm.profile);
+    if (failed) {
+        hdrPlanesDestroy(C, planes);
+        return NULL;
+    }
+
+    for (int i = 0; i < HDR_NITS_BINS; ++i) {
+        planes->outOfGamutPixelCount += planes->peakHistogramOutOfGamut[i];
+    }
+    planes->brightestPixelX = total.x;
+    planes->brightestPixelY = total.y;
+    planes->brightestPixelNits = (total.nits >= 0.0f) ? total.nits : 0.0f;
+    return planes;
+}
+
+int hdrPlanesMatch(clContext * C, const HDRPlanes * planes, clImage * srcImage)
+{
+    if (!planes || (planes->source != srcImage) || (planes->width != srcImage->width) || (planes->height != srcImage->height)) {
+        return 0;
+    }
+    return planes->srcLuminance == (float)hdrSourceLuminance(C, srcImage, C->defaultLuminance, NULL);
+}
+
+void hdrPlanesStats(const HDRPlanes * planes, int srgbLuminance, clImageHDRStats * stats)
+{
+    const int threshold = hdrThreshold(srgbLuminance);
+
+    memset(stats, 0, sizeof(clImageHDRStats));
+    stats->pixelCount = planes->width * planes->height;
+    for (int i = threshold + 1; i < planes->histogramSize; ++i) {
+        stats->overbrightPixelCount += planes->peakHistogram[i];
+        stats->bothPixelCount += planes->peakHistogramOutOfGamut[i];
+        stats->hdrPixelCount += planes->nitsHistogram[i];
+    }
+    stats->outOfGamutPixelCount = planes->outOfGamutPixelCount - stats->bothPixelCount;
+    stats->brightestPixelX = planes->brightestPixelX;
+    stats->brightestPixelY = planes->brightestPixelY;
+    stats->brightestPixelNits = planes->brightestPixelNits;
+}
+
+void hdrPlanesDestroy(clContext * C, HDRPlanes * planes)
+{
+    (void)C;
+
+    free(planes->pixels);
+    free(planes->peakHistogram);
+    free(planes->peakHistogramOutOfGamut);
+    free(planes->nitsHistogram);
+    free(planes);
+}
+
+HDRPlanes * hdrPlanesCreateProxy(clContext * C, const HDRPlanes * planes, int width, int height)
+{
+    (void)C;
+
+    HDRPlanes * proxy = (HDRPlanes *)calloc(1, sizeof(HDRPlanes));
+    proxy->source = planes->source;
+    proxy->width = width;
+    proxy->height = height;
+    proxy->srcLuminance = planes->srcLuminance;
+    proxy->pixels = (uint16_t *)malloc((size_t)width * height * 4 * sizeof(uint16_t));
+
+    // Each proxy pixel is the plane pixel under its center
+    for (int y = 0; y < height; ++y) {
+        const int planeY = (int)((((int64_t)y * 2 + 1) * planes->height) / ((int64_t)height * 2));
+        const uint16_t * src = &planes->pixels[(size_t)planeY * planes->width * 4];
+        uint16_t * dst = &proxy->pixels[(size_t)y * width * 4];
+        for (int x = 0; x < width; ++x, dst += 4) {
+            const int planeX = (int)((((int64_t)x * 2 + 1) * planes->width) / ((int64_t)width * 2));
+            memcpy(dst, &src[(size_t)planeX * 4], 4 * sizeof(uint16_t));
+        }
+    }
+    return proxy;
+}
+
+// --------------------------------------------------------------------------------------
+// Highlight
+
+typedef struct HDRHighlight
+{
+    const HDRPlanes * planes;
+    uint8_t * dst;
+    int threshold;
+    float scale; // 16 bit plane channel -> 8 bit highlight channel, both gamma 2.0
+} HDRHighlight;
+
+// Branch free, the flag colors are a select away from the rescaled plane
+static void hdrHighlightRows(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    HDRHighlight * hh = (HDRHighlight *)userData;
+    const size_t rowValues = (size_t)hh->planes->width * 4;
+    const uint16_t * src = &hh->planes->pixels[(size_t)first * rowValues];
+    uint8_t * dst = &hh->dst[(size_t)first * rowValues];
+    const size_t pixelCount = (size_t)count * hh->planes->width;
+    for (size_t i = 0; i < pixelCount; ++i, src += 4, dst += 4) {
+        const int code = src[3];
+        const int hdrClass = ((code & HDR_CODE_PEAK) > hh->threshold) | ((code >> HDR_CODE_OUTOFGAMUT_SHIFT) << 1);
+        const int fits = hdrClass == HDRCLASS_FITS;
+        const uint8_t r = (uint8_t)fminf(((float)src[0] * hh->scale) + 0.5f, 255.0f);
+        const uint8_t g = (uint8_t)fminf(((float)src[1] * hh->scale) + 0.5f, 255.0f);
+        const uint8_t b = (uint8_t)fminf(((float)src[2] * hh->scale) + 0.5f, 255.0f);
+        dst[0] = fits ? r : ((hdrClass & HDRCLASS_OUTOFGAMUT) ? HDR_FLAG_ON : 0);
+        dst[1] = fits ? g : 0;
+        dst[2] = fits ? b : ((hdrClass & HDRCLASS_OVERBRIGHT) ? HDR_FLAG_ON : 0);
+        dst[3] = 255;
+    }
+}
+
+clImage * hdrPlanesHighlight(clContext * C, const HDRPlanes * planes, int srgbLuminance, clImage * highlight)
+{
+    const int threshold = hdrThreshold(srgbLuminance);
+
+    clProfilePrimaries bt709Primaries;
+    clContextGetStockPrimaries(C, "bt709", &bt709Primaries);
+    clProfileCurve curve;
+    curve.type = CL_PCT_GAMMA;
+    curve.gamma = HDR_GAMMA;
+    curve.implicitScale = 1.0f;
+    clProfile * highlightProfile = clProfileCreate(C, &bt709Primaries, &curve, threshold, NULL);
+    if (highlight && ((highlight->width != planes->width) || (highlight->height != planes->height) || (highlight->depth != 8))) {
+        clImageDestroy(C, highlight);
+        highlight = NULL;
+    }
+    if (highlight) {
+        // Only the white moved
+        clProfileDestroy(C, highlight->profile);
+        highlight->profile = highlightProfile;
+    } else {
+        highlight = clImageCreate(C, planes->width, planes->height, 8, highlightProfile);
+        clProfileDestroy(C, highlightProfile);
+    }
+
+    HDRHighlight hh;
+    hh.planes = planes;
+    hh.threshold = threshold;
+
+    // Fitting pixels are at most the threshold on every BT.709 channel. It's only ever shown, so
+    // 8 bits at gamma 2.0 are plenty and half the size of the planes.
+    hh.scale = sqrtf((float)HDR_NITS_MAX / (float)threshold) * (255.0f / 65535.0f);
+    clImagePrepareWritePixels(C, highlight, CL_PIXELFORMAT_U8);
+    hh.dst = highlight->pixelsU8;
+    jobsParallelFor(C, planes->height, hdrHighlightRows, &hh);
+    return highlight;
+}
+
+// --------------------------------------------------------------------------------------
+// Light levels
+
+typedef union HDRFloatBits
+{
+    float f;
+    uint32_t u;
+} HDRFloatBits;
+
+// Positive floats order the same as their bits, so the top bits are a log scale
+static int hdrLightBin(float nits)
+{
+    HDRFloatBits bits;
+    bits.f = fmaxf(nits, 0.0f);
+    const int bin = (int)(bits.u >> (23 - HDR_LIGHT_MANTISSA_BITS)) - ((127 + HDR_LIGHT_MIN_EXPONENT) << HDR_LIGHT_MANTISSA_BITS) + 1;
+    return (bin < 0) ? 0 : ((bin > (HDR_LIGHT_BINS - 1)) ? (HDR_LIGHT_BINS - 1) : bin);
+}
+
+// The middle of a bin, 0 for the one below the range
+static float hdrLightBinNits(int bin)
+{
+    if (bin <= 0) {
+        return 0.0f;
+    }
+    HDRFloatBits bits;
+    bits.u = ((uint32_t)(bin - 1 + ((127 + HDR_LIGHT_MIN_EXPONENT) << HDR_LIGHT_MANTISSA_BITS)) << (23 - HDR_LIGHT_MANTISSA_BITS)) |
+             (1u << (22 - HDR_LIGHT_MANTISSA_BITS));
+    return bits.f;
+}
+
+typedef struct HDRLightSpan
+{
+    float brightest[HDR_TILE_SIZE]; // nits of the largest source channel
+    int bin[HDR_TILE_SIZE];         // of the luminance
+} HDRLightSpan;
+
+// Branch free like hdrMeasureSpan(). The brightest channel is in the source's own primaries
+// (CTA-861.3 content light levels aren't something colorist measures), luminance is
+// clImageMeasureHDR()'s.
+static void hdrMeasureLightSpan(const HDRMeasure * hm, const uint16_t * p, const clImageHDRPixel * info, int count, HDRLightSpan * span)
+{
+    for (int i = 0; i < count; ++i, p += 4) {
+        float r = (float)p[0] / 65535.0f;
+        float g = (float)p[1] / 65535.0f;
+        float b = (float)p[2] / 65535.0f;
+        r *= r;
+        g *= g;
+        b *= b;
+        const float rg = (r > g) ? r : g;
+        const float maxChannel = (rg > b) ? rg : b;
+        span->brightest[i] = maxChannel * hm->srcLuminance;
+        span->bin[i] = hdrLightBin(info[i].nits);
+    }
+}
+
+typedef struct HDRLightJobs
+{
+    clContext * C;
+    JobsCancel * cancel;
+    clImage * srcImage;
+    const HDRMeasure * hm;
+    int width;
+    int height;
+    int * histograms;  // per job
+    float * maxCLL;    // per job
+    double * bandSums; // per band, of every pixel's brightest channel
+    int * jobFailed;
+} HDRLightJobs;
+
+static void hdrMeasureLightRows(void * userData, int jobIndex, int first, int count)
+{
+    HDRLightJobs * lj = (HDRLightJobs *)userData;
+    const HDRMeasure * hm = lj->hm;
+    int * histogram = &lj->histograms[(size_t)jobIndex * HDR_LIGHT_BINS];
+    float maxCLL = lj->maxCLL[jobIndex];
+
+    clContext * C = jobsCreateContext(lj->C);
+    clProfile * profile = clProfileClone(C, hm->profile);
+    clImageHDRPixelInfo * info = clImageHDRPixelInfoCreate(C, lj->width * HDR_TILE_SIZE);
+    HDRLightSpan * span = (HDRLightSpan *)malloc(sizeof(HDRLightSpan));
+    for (int ty = first; ty < (first + count); ++ty) {
+        const int y0 = ty * HDR_TILE_SIZE;
+        const int rowCount = ((lj->height - y0) < HDR_TILE_SIZE) ? (lj->height - y0) : HDR_TILE_SIZE;
+        clImage * rows = jobsCropRows(C, lj->cancel, lj->srcImage, y0, rowCount);
+        clImage * band = rows ? clImageConvert(C, rows, 16, profile, CL_TONEMAP_OFF, NULL) : NULL;
+        if (!band) {
+            if (rows) {
+                clImageDestroy(C, rows);
+            }
+            lj->jobFailed[jobIndex] = 1;
+            break;
+        }
+        clImageHDRStats stats;
+        hdrMeasureRows(C, rows, y0, info, &stats);
+        clImageDestroy(C, rows);
+        clImagePrepareReadPixels(C, band, CL_PIXELFORMAT_U16);
+
+        double bandSum = 0.0;
+        const size_t pixelCount = (size_t)rowCount * lj->width;
+        for (size_t x0 = 0; x0 < pixelCount; x0 += HDR_TILE_SIZE) {
+            const int spanCount = ((pixelCount - x0) < HDR_TILE_SIZE) ? (int)(pixelCount - x0) : HDR_TILE_SIZE;
+            hdrMeasureLightSpan(hm, &band->pixelsU16[x0 * 4], &info->pixels[x0], spanCount, span);
+            for (int i = 0; i < spanCount; ++i) {
+                ++histogram[span->bin[i]];
+                bandSum += span->brightest[i];
+                maxCLL = fmaxf(maxCLL, span->brightest[i]);
+            }
+        }
+        lj->bandSums[ty] = bandSum;
+        clImageDestroy(C, band);
+    }
+    lj->maxCLL[jobIndex] = maxCLL;
+    free(span);
+    clImageHDRPixelInfoDestroy(C, info);
+    clProfileDestroy(C, profile);
+    clContextDestroy(C);
+}
+
+// Nearest rank: the first bin the cumulative count reaches fraction of total in
+static float hdrPercentile(const int * histogram, int total, double fraction)
+{
+    long long rank = (long long)ceil(fraction * (double)total);
+    if (rank < 1) {
+        rank = 1;
+    }
+    long long seen = 0;
+    for (int i = 0; i < HDR_LIGHT_BINS; ++i) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return hdrLightBinNits(i);
+        }
+    }
+    return 0.0f;
+}
+
+int hdrMeasureLightLevels(clContext * C, clImage * srcImage, JobsCancel * cancel, HDRLightLevels * levels)
+{
+    memset(levels, 0, sizeof(HDRLightLevels));
+    if (!jobsReadBegin(cancel)) {
+        return 0;
+    }
+    HDRMeasure hm;
+    hdrInit(C, srcImage, &hm);
+    const int width = srcImage->width;
+    const int height = srcImage->height;
+
+    clImagePrepareReadPixels(C, srcImage, (srcImage->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    jobsReadEnd(cancel);
+
+    const int jobs = jobsCount(C);
+    const int tilesY = (height + HDR_TILE_SIZE - 1) / HDR_TILE_SIZE;
+    HDRLightJobs lj;
+    lj.C = C;
+    lj.cancel = cancel;
+    lj.srcImage = srcImage;
+    lj.hm = &hm;
+    lj.width = width;
+    lj.height = height;
+    lj.histograms = (int *)calloc((size_t)jobs * HDR_LIGHT_BINS, sizeof(int));
+    lj.maxCLL = (float *)calloc(jobs, sizeof(float));
+    lj.bandSums = (double *)calloc(tilesY, sizeof(double));
+    lj.jobFailed = (int *)calloc(jobs, sizeof(int));
+    jobsParallelFor(C, tilesY, hdrMeasureLightRows, &lj);
+
+    int failed = 0;
+    float maxCLL = 0.0f;
+    int * histogram = lj.histograms; // job 0's, the others are added to it
+    for (int j = 0; j < jobs; ++j) {
+        failed |= lj.jobFailed[j];
+        maxCLL = fmaxf(maxCLL, lj.maxCLL[j]);
+        if (j > 0) {
+            const int * jobHistogram = &lj.histograms[(size_t)j * HDR_LIGHT_BINS];
+            for (int i = 0; i < HDR_LIGHT_BINS; ++i) {
+                histogram[i] += jobHistogram[i];
+            }
+        }
+    }
+
+    // Summed in band order, so the average doesn't depend on the job count
+    double sum = 0.0;
+    for (int ty = 0; ty < tilesY; ++ty) {
+        sum += lj.bandSums[ty];
+    }
+
+    // A cancelled measurement matches nothing, so it's retried
+    const int cancelled = jobsCancelled(cancel);
+    failed |= cancelled;
+    const int pixelCount = width * height;
+    if (!cancelled) {
+        levels->source = srcImage;
+        levels->srcLuminance = hm.srcLuminance;
+    }
+    if (!failed) {
+        levels->maxCLL = maxCLL;
+        levels->maxFALL = (pixelCount > 0) ? (float)(sum / (double)pixelCount) : 0.0f;
+        levels->p50 = hdrPercentile(histogram, pixelCount, 0.5);
+        levels->p90 = hdrPercentile(histogram, pixelCount, 0.9);
+        levels->p99 = hdrPercentile(histogram, pixelCount, 0.99);
+        levels->p999 = hdrPercentile(histogram, pixelCount, 0.999);
+    }
+    free(lj.histograms);
+    free(lj.maxCLL);
+    free(lj.bandSums);
+    free(lj.jobFailed);
+    clProfileDestroy(C, hm.profile);
+    return !failed;
+}
+
+int hdrLightLevelsMatch(clContext * C, const HDRLightLevels * levels, clImage * srcImage, int defaultLuminance)
+{
+    if (!levels->source || (levels->source != srcImage)) {
+        return 0;
+    }
+    return levels->srcLuminance == (float)hdrSourceLuminance(C, srcImage, defaultLuminance, NULL);
+}
+
+// --------------------------------------------------------------------------------------
+// Background light levels
+
+struct HDRLightLevelsTask
+{
+    clContext * C; // its default luminance is the one measured at
+    clTask * task;
+    JobsCancel * cancel;
+    clImage * srcImage;
+    float srcLuminance; // the levels' once measured, for matching while the task runs
+    HDRLightLevels levels;
+    int valid;
+    atomic_int finished; // released once levels and valid are set
+};
+
+static void hdrLightLevelsTaskFunc(void * userData)
+{
+    HDRLightLevelsTask * task = (HDRLightLevelsTask *)userData;
+    task->valid = hdrMeasureLightLevels(task->C, task->srcImage, task->cancel, &task->levels);
+    atomic_store_explicit(&task->finished, 1, memory_order_release);
+}
+
+HDRLightLevelsTask * hdrLightLevelsTaskCreate(clContext * C, clImage * srcImage, int defaultLuminance)
+{
+    HDRLightLevelsTask * task = (HDRLightLevelsTask *)calloc(1, sizeof(HDRLightLevelsTask));
+    task->C = clContextCreate(NULL);
+    task->C->params.jobs = C->params.jobs;
+    task->C->defaultLuminance = defaultLuminance;
+    task->cancel = jobsCancelCreate();
+
+    clImagePrepareReadPixels(C, srcImage, (srcImage->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    task->srcImage = srcImage;
+    task->srcLuminance = (float)hdrSourceLuminance(C, srcImage, defaultLuminance, NULL);
+    atomic_init(&task->finished, 0);
+    task->task = clTaskCreate(task->C, hdrLightLevelsTaskFunc, task);
+    return task;
+}
+
+int hdrLightLevelsTaskMatch(clContext * C, const HDRLightLevelsTask * task, clImage * srcImage, int defaultLuminance)
+{
+    if (task->srcImage != srcImage) {
+        return 0;
+    }
+    return task->srcLuminance == (float)hdrSourceLuminance(C, srcImage, defaultLuminance, NULL);
+}
+
+int hdrLightLevelsTaskFinished(HDRLightLevelsTask * task)
+{
+    return atomic_load_explicit(&task->finished, memory_order_acquire);
+}
+
+int hdrLightLevelsTaskFinish(HDRLightLevelsTask * task, HDRLightLevels * levels)
+{
+    clTaskJoin(task->C, task->task);
+    clTaskDestroy(task->C, task->task);
+    jobsCancelDestroy(task->cancel);
+    clContextDestroy(task->C);
+
+    const int valid = task->valid;
+    if (levels) {
+        *levels = task->levels;
+    }
+    free(task);
+    return valid;
+}
+
+void hdrLightLevelsTaskCancel(HDRLightLevelsTask * task)
+{
+    jobsCancel(task->cancel);
+    hdrLightLevelsTaskFinish(task, NULL);
+}
+
+static uint32_t hdrReadBE(const uint8_t * p, int bytes)
+{
+    uint32_t v = 0;
+    for (int i = 0; i < bytes; ++i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+// PNG's CRC-32 (ISO 3309), crc starts at 0xffffffff and is inverted once done
+static uint32_t hdrCRC32(uint32_t crc, const uint8_t * p, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= p[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+        }
+    }
+    return crc;
+}
+
+// fseek() only takes a long
+static int hdrSkip(FILE * f, uint64_t bytes)
+{
+    while (bytes > 0) {
+        const uint64_t step = (bytes > 0x40000000u) ? 0x40000000u : bytes;
+        if (fseek(f, (long)step, SEEK_CUR)) {
+            return 0;
+        }
+        bytes -= step;
+    }
+    return 1;
+}
+
+// Walks the chunks after the signature up to the image data. A cLLI chunk is two 32 bit values in
+// 1/10000 nits, accepted under the draft's name (cLLi) too and only with a matching CRC.
+static int hdrReadPNGContentLightLevel(FILE * f, HDRContentLightLevel * clli)
+{
+    uint8_t header[8];
+    while (fread(header, 1, sizeof(header), f) == sizeof(header)) {
+        const uint32_t length = hdrReadBE(header, 4);
+        const uint32_t type = hdrReadBE(&header[4], 4);
+        if ((length > 0x7fffffffu) || (type == HDR_FOURCC('I', 'D', 'A', 'T')) || (type == HDR_FOURCC('I', 'E', 'N', 'D'))) {
+            return 0;
+        }
+        if ((length == 8) && ((type == HDR_FOURCC('c', 'L', 'L', 'I')) || (type == HDR_FOURCC('c', 'L', 'L', 'i')))) {
+            uint8_t data[12]; // and the CRC
+            if (fread(data, 1, sizeof(data), f) != sizeof(data)) {
+                return 0;
+            }
+            const uint32_t crc = hdrCRC32(hdrCRC32(0xffffffffu, &header[4], 4), data, 8) ^ 0xffffffffu;
+            if (crc != hdrReadBE(&data[8], 4)) {
+                return 0;
+            }
+            clli->present = 1;
+            clli->maxCLL = (float)hdrReadBE(data, 4) / 10000.0f;
+            clli->maxFALL = (float)hdrReadBE(&data[4], 4) / 10000.0f;
+            return 1;
+        }
+        if (!hdrSkip(f, (uint64_t)length + 4)) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+// An ISOBMFF box within [p, end): its type and contents. Returns its whole size, 0 if it doesn't
+// fit (a size of 0 runs to end).
+static size_t hdrBox(const uint8_t * p, const uint8_t * end, uint32_t * type, const uint8_t ** contents, size_t * contentsSize)
+{
+    const size_t available = (size_t)(end - p);
+    if (available < 8) {
+        return 0;
+    }
+    uint64_t size = hdrReadBE(p, 4);
+    size_t headerSize = 8;
+    if (size == 1) {
+        if (available < 16) {
+            return 0;
+        }
+        size = ((uint64_t)hdrReadBE(&p[8], 4) << 32) | hdrReadBE(&p[12], 4);
+        headerSize = 16;
+    } else if (size == 0) {
+        size = available;
+    }
+    if ((size < headerSize) || (size > available)) {
+        return 0;
+    }
+    *type = hdrReadBE(&p[4], 4);
+    *contents = p + headerSize;
+    *contentsSize = (size_t)size - headerSize;
+    return (size_t)size;
+}
+
+// The clli property ipma associates with the primary item, from a meta box's contents (after its
+// version and flags). A clli box is two 16 bit values in nits.
+static int hdrReadMetaContentLightLevel(const uint8_t * meta, size_t metaSize, HDRContentLightLevel * clli)
+{
+    const uint8_t * end = meta + metaSize;
+    const uint8_t * ipco = NULL;
+    size_t ipcoSize = 0;
+    const uint8_t * ipmas[4]; // a file may split associations over several
+    size_t ipmaSizes[4];
+    int ipmaCount = 0;
+    int hasPrimary = 0;
+    uint32_t primaryID = 0;
+
+    uint32_t type;
+    const uint8_t * contents;
+    size_t contentsSize;
+    for (const uint8_t * p = meta; p < end;) {
+        const size_t boxSize = hdrBox(p, end, &type, &contents, &contentsSize);
+        if (!boxSize) {
+            return 0;
+        }
+        if (type == HDR_FOURCC('p', 'i', 't', 'm')) {
+            const size_t idSize = (contentsSize >= 4) && (contents[0] != 0) ? 4 : 2;
+            if (contentsSize < (4 + idSize)) {
+                return 0;
+            }
+            primaryID = hdrReadBE(&contents[4], (int)idSize);
+            hasPrimary = 1;
+        } else if (type == HDR_FOURCC('i', 'p', 'r', 'p')) {
+            const uint8_t * iprpEnd = contents + contentsSize;
+            uint32_t propertyType;
+            const uint8_t * property;
+            size_t propertySize;
+            for (const uint8_t * q = contents; q < iprpEnd;) {
+                const size_t propertyBoxSize = hdrBox(q, iprpEnd, &propertyType, &property, &propertySize);
+                if (!propertyBoxSize) {
+                    return 0;
+                }
+                if (propertyType == HDR_FOURCC('i', 'p', 'c', 'o')) {
+                    ipco = property;
+                    ipcoSize = propertySize;
+                } else if ((propertyType == HDR_FOURCC('i', 'p', 'm', 'a')) && (ipmaCount < 4)) {
+                    ipmas[ipmaCount] = property;
+                    ipmaSizes[ipmaCount] = propertySize;
+                    ++ipmaCount;
+                }
+                q += propertyBoxSize;
+            }
+        }
+        p += boxSize;
+    }
+    if (!hasPrimary || !ipco) {
+        return 0;
+    }
+
+    for (int m = 0; m < ipmaCount; ++m) {
+        const uint8_t * p = ipmas[m];
+        const uint8_t * ipmaEnd = p + ipmaSizes[m];
+        if (ipmaSizes[m] < 8) {
+            return 0;
+        }
+        const int idSize = (p[0] < 1) ? 2 : 4;
+        const int wideIndices = p[3] & 1;
+        const uint32_t entryCount = hdrReadBE(&p[4], 4);
+        p += 8;
+        for (uint32_t e = 0; e < entryCount; ++e) {
+            if ((size_t)(ipmaEnd - p) < (size_t)(idSize + 1)) {
+                return 0;
+            }
+            const uint32_t itemID = hdrReadBE(p, idSize);
+            const int associationCount = p[idSize];
+            p += idSize + 1;
+            const size_t associationSize = wideIndices ? 2 : 1;
+            if ((size_t)(ipmaEnd - p) < (associationCount * associationSize)) {
+                return 0;
+            }
+            for (int a = 0; (itemID == primaryID) && (a < associationCount); ++a) {
+                // 1 based into ipco, 0 is "no property"
+                const uint32_t index = hdrReadBE(&p[a * associationSize], (int)associationSize) & (wideIndices ? 0x7fffu : 0x7fu);
+                const uint8_t * q = ipco;
+                const uint8_t * ipcoEnd = ipco + ipcoSize;
+                for (uint32_t i = 1; (index > 0) && (i <= index); ++i) {
+                    const size_t propertyBoxSize = hdrBox(q, ipcoEnd, &type, &contents, &contentsSize);
+                    if (!propertyBoxSize) {
+                        return 0;
+                    }
+                    if ((i == index) && (type == HDR_FOURCC('c', 'l', 'l', 'i')) && (contentsSize >= 4)) {
+                        clli->present = 1;
+                        clli->maxCLL = (float)hdrReadBE(contents, 2);
+                        clli->maxFALL = (float)hdrReadBE(&contents[2], 2);
+                        return 1;
+                    }
+                    q += propertyBoxSize;
+                }
+            }
+            p += associationCount * associationSize;
+        }
+    }
+    return 0;
+}
+
+// Walks the top level boxes to the meta box, reading only that
+static int hdrReadISOBMFFContentLightLevel(FILE * f, HDRContentLightLevel * clli)
+{
+    uint8_t header[16];
+    while (fread(header, 1, 8, f) == 8) {
+        uint64_t size = hdrReadBE(header, 4);
+        uint64_t headerSize = 8;
+        if (size == 1) {
+            if (fread(&header[8], 1, 8, f) != 8) {
+                return 0;
+            }
+            size = ((uint64_t)hdrReadBE(&header[8], 4) << 32) | hdrReadBE(&header[12], 4);
+            headerSize = 16;
+        }
+        if ((size != 0) && (size < headerSize)) {
+            return 0;
+        }
+        if (hdrReadBE(&header[4], 4) != HDR_FOURCC('m', 'e', 't', 'a')) {
+            if ((size == 0) || !hdrSkip(f, size - headerSize)) {
+                return 0; // a box running to the end of the file is the last
+            }
+            continue;
+        }
+
+        // A full box, its version and flags come first
+        const uint64_t contentsSize = (size != 0) ? (size - headerSize) : HDR_CLLI_MAX_META_BYTES;
+        if ((contentsSize < 4) || (contentsSize > HDR_CLLI_MAX_META_BYTES)) {
+            return 0;
+        }
+        uint8_t * meta = (uint8_t *)malloc((size_t)contentsSize);
+        const size_t metaSize = fread(meta, 1, (size_t)contentsSize, f);
+        int found = 0;
+        if ((metaSize == contentsSize) || ((size == 0) && (metaSize >= 4))) {
+            found = hdrReadMetaContentLightLevel(meta + 4, metaSize - 4, clli);
+        }
+        free(meta);
+        return found;
+    }
+    return 0;
+}
+
+int hdrReadContentLightLevel(const char * filename, HDRContentLightLevel * clli)
+{
+    memset(clli, 0, sizeof(HDRContentLightLevel));
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        return 0;
+    }
+
+    static const uint8_t pngSignature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+    uint8_t head[8];
+    if (fread(head, 1, sizeof(head), f) == sizeof(head)) {
+        if (!memcmp(head, pngSignature, sizeof(pngSignature))) {
+            hdrReadPNGContentLightLevel(f, clli);
+        } else if (hdrReadBE(&head[4], 4) == HDR_FOURCC('f', 't', 'y', 'p')) {
+            // Back to the start, ftyp is an ordinary top level box
+            if (!fseek(f, 0, SEEK_SET)) {
+                hdrReadISOBMFFContentLightLevel(f, clli);
+            }
+        }
+    }
+    fclose(f);
+    return clli->present;
+}
+
+static int hdrWithinDeclared(float measured, float declared)
+{
+    return (declared <= 0.0f) || (measured <= ((declared * (1.0f + HDR_CLLI_TOLERANCE)) + HDR_CLLI_TOLERANCE_NITS));
+}
+
+int hdrContentLightLevelValid(const HDRContentLightLevel * clli, const HDRLightLevels * levels)
+{
+    if (!clli->present) {
+        return 1;
+    }
+    return hdrWithinDeclared(levels->maxCLL, clli->maxCLL) && hdrWithinDeclared(levels->maxFALL, clli->maxFALL);
+}
+
+// --------------------------------------------------------------------------------------
+// Pixel
+
+int hdrMeasurePixel(clContext * C, clImage * srcImage, int srgbLuminance, int x, int y, clImageHDRPixel * pixel)
+{
+    if ((x < 0) || (y < 0) || (x >= srcImage->width) || (y >= srcImage->height)) {
+        return 0;
+    }
+
+    clImage * cropped = clImageCrop(C, srcImage, x, y, 1, 1, clTrue);
+    if (!cropped) {
+        return 0;
+    }
+
+    // Colorist's own measurement, as the planes' bands are
+    clImageHDRPixelInfo * info = clImageHDRPixelInfoCreate(C, 1);
+    clImage * highlight = NULL;
+    clImageHDRStats stats;
+    clImageHDRQuantization quant;
+    clImageMeasureHDR(C, cropped, hdrThreshold(srgbLuminance), 0.0f, &highlight, &stats, info, &quant);
+    *pixel = info->pixels[0];
+    if (highlight) {
+        clImageDestroy(C, highlight);
+    }
+    clImageHDRPixelInfoDestroy(C, info);
+    clImageDestroy(C, cropped);
+    return 1;
+}
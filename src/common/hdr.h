@@ -0,0 +1,130 @@
+#ifndef HDR_H
+#define HDR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+#include "jobs.h"
+
+// What an SDR (sRGB) display with white at srgbLuminance nits can't show of an image. Each
+// pixel's values are clImageMeasureHDR()'s, run on jobs a band of rows at a time:
+//   nits       - luminance of the pixel
+//   maxNits    - luminance of the brightest BT.709 color with the pixel's chromaticity, its
+//                largest channel at srgbLuminance. A pixel brighter than that is overbright,
+//                which is the same as its largest channel (its peak) being over srgbLuminance.
+//   saturation - (max - min) / max of the BT.709 channels. Past 1 a channel is negative, so the
+//                pixel is out of gamut.
+// Stats count overbright, out of gamut and both as separate (exclusive) classes, and HDR pixels
+// as anything over srgbLuminance. The brightest pixel is the first (in row order) of the
+// highest nits.
+
+// Everything about a source's pixels that doesn't depend on srgbLuminance, measured once in a
+// tile parallel pass. Peak and nits are binned by whole nits (rounded up), so every integer
+// threshold lands on a bin edge: stats at any threshold are sums over the histograms, and the
+// highlight is a single classification pass over pixels.
+typedef struct HDRPlanes
+{
+    clImage * source; // borrowed, see hdrPlanesMatch()
+    int width;
+    int height;
+    float srcLuminance; // nits of the source's white when it was measured
+    uint16_t * pixels;  // 4 per pixel: BT.709 R, G, B (gamma 2.0 over 0 to 10000 nits, clipped) and a peak bin / gamut code
+    int * peakHistogram;           // in gamut pixels per peak bin (0 is black, the last is over 10000 nits)
+    int * peakHistogramOutOfGamut; // out of gamut pixels per peak bin
+    int * nitsHistogram;           // pixels per nits bin
+    int histogramSize;
+    int outOfGamutPixelCount;
+    int brightestPixelX;
+    int brightestPixelY;
+    float brightestPixelNits;
+} HDRPlanes;
+
+// NULL if the source failed to convert
+HDRPlanes * hdrPlanesCreate(clContext * C, clImage * srcImage);
+
+// Nonzero if planes still describe srcImage: the same image, and (for an unspecified luminance)
+// the same C->defaultLuminance. Replacing an image at the same address is up to the caller.
+int hdrPlanesMatch(clContext * C, const HDRPlanes * planes, clImage * srcImage);
+void hdrPlanesStats(const HDRPlanes * planes, int srgbLuminance, clImageHDRStats * stats);
+void hdrPlanesDestroy(clContext * C, HDRPlanes * planes);
+
+// A width x height copy of planes for a quick highlight, each pixel point sampled (codes can't be
+// averaged). It has no histograms, stats come from the full planes.
+HDRPlanes * hdrPlanesCreateProxy(clContext * C, const HDRPlanes * planes, int width, int height);
+
+// Returns the highlight at srgbLuminance: an 8 bit image white at srgbLuminance, matching the
+// source where it fits and flagging the rest (overbright in blue, out of gamut in red, both in
+// magenta). highlight (NULL for a new one) is rewritten in place if its size matches.
+clImage * hdrPlanesHighlight(clContext * C, const HDRPlanes * planes, int srgbLuminance, clImage * highlight);
+
+// Content light levels (CTA-861.3) and luminance percentiles of an image, in nits, measured in
+// one tile parallel pass. MaxCLL is the brightest channel of any pixel and MaxFALL the average of
+// every pixel's brightest channel (an image being a single frame), both in the source's own
+// primaries. Percentiles are of clImageMeasureHDR()'s luminance (nits), read off a histogram binned
+// by the top bits of each value's float representation (under 1% wide), so nothing is sorted.
+typedef struct HDRLightLevels
+{
+    clImage * source; // borrowed, see hdrLightLevelsMatch()
+    float srcLuminance;
+    float maxCLL;
+    float maxFALL;
+    float p50;
+    float p90;
+    float p99;
+    float p999;
+} HDRLightLevels;
+
+// Returns 0 if the source failed to convert, leaving levels zeroed but matching srcImage so the
+// failure isn't retried. Cancelling (cancel may be NULL) also returns 0, matching nothing.
+int hdrMeasureLightLevels(clContext * C, clImage * srcImage, JobsCancel * cancel, HDRLightLevels * levels);
+
+// Nonzero if levels still describe srcImage: the same image, and (for an unspecified luminance)
+// the same defaultLuminance. The caller's own luminance is passed rather than C's, which is only
+// brought up to date by a prepare.
+int hdrLightLevelsMatch(clContext * C, const HDRLightLevels * levels, clImage * srcImage, int defaultLuminance);
+
+// Runs hdrMeasureLightLevels() on a worker thread with a private clContext at defaultLuminance.
+// srcImage is borrowed and must stay alive (and unmodified) until the task is finished or
+// cancelled. Opaque, as it holds C11 atomics.
+typedef struct HDRLightLevelsTask HDRLightLevelsTask;
+
+HDRLightLevelsTask * hdrLightLevelsTaskCreate(clContext * C, clImage * srcImage, int defaultLuminance);
+int hdrLightLevelsTaskMatch(clContext * C, const HDRLightLevelsTask * task, clImage * srcImage, int defaultLuminance); // as hdrLightLevelsMatch()
+int hdrLightLevelsTaskFinished(HDRLightLevelsTask * task); // nonzero once the levels are ready, never blocks
+
+// Blocks, destroys task and returns what hdrMeasureLightLevels() did, with the levels in levels
+int hdrLightLevelsTaskFinish(HDRLightLevelsTask * task, HDRLightLevels * levels);
+
+// Stops reading srcImage at once and destroys task, waiting out only the bands under way
+void hdrLightLevelsTaskCancel(HDRLightLevelsTask * task);
+
+// What a file declares about its light levels: the 'clli' property of an AVIF / HEIF's primary
+// item (found through meta's pitm and iprp/ipma), or a PNG's cLLI chunk (cLLi in drafts) ahead of
+// its image data with a valid CRC. Zero is "unknown", as in the metadata itself.
+typedef struct HDRContentLightLevel
+{
+    int present;
+    float maxCLL;
+    float maxFALL;
+} HDRContentLightLevel;
+
+// Returns clli->present
+int hdrReadContentLightLevel(const char * filename, HDRContentLightLevel * clli);
+
+// Nonzero if the measured levels don't exceed the declared ones, or nothing is declared (as
+// declared levels cover every frame, a single frame may be under them). Measuring 16 bit pixels
+// is allowed a nit or 1% over.
+int hdrContentLightLevelValid(const HDRContentLightLevel * clli, const HDRLightLevels * levels);
+
+// The per pixel values the classification comes from, measured for just (x, y) so nothing per
+// pixel has to be kept around for an info panel. Returns 0 if (x, y) is outside the image or it
+// failed to convert.
+int hdrMeasurePixel(clContext * C, clImage * srcImage, int srgbLuminance, int x, int y, clImageHDRPixel * pixel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
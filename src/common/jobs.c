@@ -0,0 +1,143 @@
+#include "jobs.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+struct JobsCancel
+{
+    atomic_int cancelled;
+    atomic_int reading; // reads of a source under way
+};
+
+typedef struct JobsRange
+{
+    JobsFunc func;
+    void * userData;
+    int jobIndex;
+    int first;
+    int count;
+} JobsRange;
+
+static void jobsRangeFunc(void * userData)
+{
+    JobsRange * range = (JobsRange *)userData;
+    range->func(range->userData, range->jobIndex, range->first, range->count);
+}
+
+int jobsCount(clContext * C)
+{
+    int jobs = C->params.jobs;
+    if (jobs <= 0) {
+        jobs = clTaskLimit();
+    }
+    return (jobs > 0) ? jobs : 1;
+}
+
+void jobsParallelFor(clContext * C, int itemCount, JobsFunc func, void * userData)
+{
+    if (itemCount <= 0) {
+        return;
+    }
+
+    int jobs = jobsCount(C);
+    if (jobs > itemCount) {
+        jobs = itemCount;
+    }
+    if (jobs == 1) {
+        func(userData, 0, 0, itemCount);
+        return;
+    }
+
+    JobsRange * ranges = (JobsRange *)calloc(jobs, sizeof(JobsRange));
+    clTask ** tasks = (clTask **)calloc(jobs, sizeof(clTask *));
+    const int itemsPerJob = itemCount / jobs;
+    const int remainder = itemCount % jobs;
+    int first = 0;
+    for (int i = 0; i < jobs; ++i) {
+        JobsRange * range = &ranges[i];
+        range->func = func;
+        range->userData = userData;
+        range->jobIndex = i;
+        range->first = first;
+        range->count = itemsPerJob + ((i < remainder) ? 1 : 0);
+        first += range->count;
+    }
+
+    for (int i = 1; i < jobs; ++i) {
+        tasks[i] = clTaskCreate(C, jobsRangeFunc, &ranges[i]);
+    }
+    jobsRangeFunc(&ranges[0]);
+    for (int i = 1; i < jobs; ++i) {
+        clTaskJoin(C, tasks[i]);
+        clTaskDestroy(C, tasks[i]);
+    }
+
+    free(tasks);
+    free(ranges);
+}
+
+clContext * jobsCreateContext(clContext * C)
+{
+    clContext * jobC = clContextCreate(NULL);
+    jobC->params.jobs = 1;
+    jobC->defaultLuminance = C->defaultLuminance;
+    return jobC;
+}
+
+JobsCancel * jobsCancelCreate(void)
+{
+    JobsCancel * cancel = (JobsCancel *)malloc(sizeof(JobsCancel));
+    atomic_init(&cancel->cancelled, 0);
+    atomic_init(&cancel->reading, 0);
+    return cancel;
+}
+
+void jobsCancelDestroy(JobsCancel * cancel)
+{
+    free(cancel);
+}
+
+// A read counts itself in before checking the flag, and jobsCancel() flags before checking the
+// count, so either the read sees the cancel or jobsCancel() sees (and waits out) the read
+void jobsCancel(JobsCancel * cancel)
+{
+    atomic_store(&cancel->cancelled, 1);
+    while (atomic_load_explicit(&cancel->reading, memory_order_acquire) > 0) {
+        // Reads are crops (a copy of a band of rows) at most, far shorter than the work after them
+    }
+}
+
+int jobsCancelled(JobsCancel * cancel)
+{
+    return cancel && atomic_load_explicit(&cancel->cancelled, memory_order_relaxed);
+}
+
+int jobsReadBegin(JobsCancel * cancel)
+{
+    if (!cancel) {
+        return 1;
+    }
+    atomic_fetch_add(&cancel->reading, 1);
+    if (atomic_load(&cancel->cancelled)) {
+        atomic_fetch_sub_explicit(&cancel->reading, 1, memory_order_release);
+        return 0;
+    }
+    return 1;
+}
+
+void jobsReadEnd(JobsCancel * cancel)
+{
+    if (cancel) {
+        atomic_fetch_sub_explicit(&cancel->reading, 1, memory_order_release);
+    }
+}
+
+clImage * jobsCropRows(clContext * C, JobsCancel * cancel, clImage * image, int y, int rowCount)
+{
+    if (!jobsReadBegin(cancel)) {
+        return NULL;
+    }
+    clImage * rows = clImageCrop(C, image, 0, y, image->width, rowCount, clTrue);
+    jobsReadEnd(cancel);
+    return rows;
+}
@@ -0,0 +1,52 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+
+// Called once per job with a contiguous range of items [first, first + count)
+typedef void (*JobsFunc)(void * userData, int jobIndex, int first, int count);
+
+// Number of jobs jobsParallelFor() will split work into (C->params.jobs, or every core if unset)
+int jobsCount(clContext * C);
+
+// Splits itemCount items into jobsCount() contiguous ranges and runs them on clTasks, using the
+// calling thread for the first range. The split only depends on itemCount and the job count, so
+// anything reduced per job comes out the same on every run.
+void jobsParallelFor(clContext * C, int itemCount, JobsFunc func, void * userData);
+
+// Cancellation for work that runs in the background over a borrowed source. Kept opaque, as it's
+// made of C11 atomics.
+typedef struct JobsCancel JobsCancel;
+
+JobsCancel * jobsCancelCreate(void);
+void jobsCancelDestroy(JobsCancel * cancel);
+
+// Flags cancel, then waits out any reads under way on it, so once this returns nothing reads the
+// sources any more (the work itself winds down on its own)
+void jobsCancel(JobsCancel * cancel);
+int jobsCancelled(JobsCancel * cancel); // NULL is never cancelled
+
+// Background work only touches its source (pixels, size or profile) between these. Begin returns
+// 0 (and needs no end) once cancelled. Both do nothing with a NULL cancel.
+int jobsReadBegin(JobsCancel * cancel);
+void jobsReadEnd(JobsCancel * cancel);
+
+// Rows [y, y + rowCount) of image, read between jobsReadBegin() and jobsReadEnd(). NULL if
+// cancelled. This copies image's own pixels, so callers clImagePrepareReadPixels() it in its own
+// format (U16 past 8 bits, U8 otherwise) before any job runs. Tasks do that when they're created,
+// on the UI thread, so it never races the UI thread preparing the same image.
+clImage * jobsCropRows(clContext * C, JobsCancel * cancel, clImage * image, int y, int rowCount);
+
+// Single threaded context (inheriting C's default luminance) for colorist calls made from inside
+// a job, as contexts can't be shared across threads. Destroy it with clContextDestroy().
+clContext * jobsCreateContext(clContext * C);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
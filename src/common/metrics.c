@@ -0,0 +1,586 @@
+#include "metrics.h"
+
+#include "diff.h"
+#include "jobs.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --------------------------------------------------------------------------------------
+// Constants
+
+// SMPTE ST.2084
+static const float PQ_C1 = 0.8359375f;
+static const float PQ_C2 = 18.8515625f;
+static const float PQ_C3 = 18.6875f;
+static const float PQ_M1 = 0.1593017578125f;
+static const float PQ_M2 = 78.84375f;
+
+// BT.2408 HDR reference white, the most deltaE 2000 treats as diffuse white
+static const float METRICS_MAX_DIFFUSE_WHITE = 203.0f;
+
+// Rows converted at a time by the per pixel pass
+#define METRICS_BAND_ROWS 64
+
+// SSIM windows, constants are for values in [0, 1]
+#define SSIM_WINDOW 8
+#define SSIM_STRIDE 4
+static const double SSIM_C1 = 0.0001; // (0.01)^2
+static const double SSIM_C2 = 0.0009; // (0.03)^2
+
+#define MSSSIM_SCALES 5
+static const double MSSSIM_WEIGHTS[MSSSIM_SCALES] = { 0.0448, 0.2856, 0.3001, 0.2363, 0.1333 };
+
+// Heatmap color ramp over deltaE ITP (1 is about one just noticeable difference)
+#define HEATMAP_STOPS 5
+static const float HEATMAP_STOP_VALUES[HEATMAP_STOPS] = { 0.0f, 1.0f, 2.0f, 4.0f, 8.0f };
+static const float HEATMAP_STOP_COLORS[HEATMAP_STOPS][3] = {
+    { 0, 0, 0 }, { 0, 0, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 },
+};
+
+// --------------------------------------------------------------------------------------
+// Color
+
+static float metricsPQEncode(float nits)
+{
+    float y = powf(fmaxf(nits, 0.0f) / 10000.0f, PQ_M1);
+    return powf((PQ_C1 + (PQ_C2 * y)) / (1.0f + (PQ_C3 * y)), PQ_M2);
+}
+
+// BT.2020 linear nits -> ICtCp, with Ct halved (the T of ITP)
+static void metricsITP(const float rgb[3], float itp[3])
+{
+    float l = metricsPQEncode(((1688.0f * rgb[0]) + (2146.0f * rgb[1]) + (262.0f * rgb[2])) / 4096.0f);
+    float m = metricsPQEncode(((683.0f * rgb[0]) + (2951.0f * rgb[1]) + (462.0f * rgb[2])) / 4096.0f);
+    float s = metricsPQEncode(((99.0f * rgb[0]) + (309.0f * rgb[1]) + (3688.0f * rgb[2])) / 4096.0f);
+    itp[0] = 0.5f * (l + m);
+    itp[1] = 0.5f * (((6610.0f * l) - (13613.0f * m) + (7003.0f * s)) / 4096.0f);
+    itp[2] = ((17933.0f * l) - (17390.0f * m) - (543.0f * s)) / 4096.0f;
+}
+
+// BT.2020 linear (relative to diffuse white) -> CIELAB, D65 (white from the matrix rows so it lands on a = b = 0)
+static void metricsLab(const float rgb[3], float lab[3])
+{
+    float xyz[3];
+    xyz[0] = ((0.6370f * rgb[0]) + (0.1446f * rgb[1]) + (0.1689f * rgb[2])) / 0.9505f;
+    xyz[1] = (0.2627f * rgb[0]) + (0.6780f * rgb[1]) + (0.0593f * rgb[2]);
+    xyz[2] = ((0.0281f * rgb[1]) + (1.0610f * rgb[2])) / 1.0891f;
+    for (int i = 0; i < 3; ++i) {
+        xyz[i] = (xyz[i] > 0.008856f) ? cbrtf(xyz[i]) : ((7.787f * xyz[i]) + (16.0f / 116.0f));
+    }
+    lab[0] = (116.0f * xyz[1]) - 16.0f;
+    lab[1] = 500.0f * (xyz[0] - xyz[1]);
+    lab[2] = 200.0f * (xyz[1] - xyz[2]);
+}
+
+static float metricsDegrees(float radians)
+{
+    float degrees = radians * (180.0f / 3.14159265f);
+    return (degrees < 0.0f) ? (degrees + 360.0f) : degrees;
+}
+
+static float metricsRadians(float degrees)
+{
+    return degrees * (3.14159265f / 180.0f);
+}
+
+// CIEDE2000 (kL = kC = kH = 1)
+static float metricsDeltaE2000(const float lab1[3], const float lab2[3])
+{
+    const float pow25To7 = 6103515625.0f;
+
+    float c1 = sqrtf((lab1[1] * lab1[1]) + (lab1[2] * lab1[2]));
+    float c2 = sqrtf((lab2[1] * lab2[1]) + (lab2[2] * lab2[2]));
+    float cBar7 = powf(0.5f * (c1 + c2), 7.0f);
+    float g = 0.5f * (1.0f - sqrtf(cBar7 / (cBar7 + pow25To7)));
+    float a1 = (1.0f + g) * lab1[1];
+    float a2 = (1.0f + g) * lab2[1];
+    float c1p = sqrtf((a1 * a1) + (lab1[2] * lab1[2]));
+    float c2p = sqrtf((a2 * a2) + (lab2[2] * lab2[2]));
+    float h1p = ((a1 == 0.0f) && (lab1[2] == 0.0f)) ? 0.0f : metricsDegrees(atan2f(lab1[2], a1));
+    float h2p = ((a2 == 0.0f) && (lab2[2] == 0.0f)) ? 0.0f : metricsDegrees(atan2f(lab2[2], a2));
+
+    float dLp = lab2[0] - lab1[0];
+    float dCp = c2p - c1p;
+    float dhp = 0.0f;
+    if ((c1p * c2p) != 0.0f) {
+        dhp = h2p - h1p;
+        if (dhp > 180.0f) {
+            dhp -= 360.0f;
+        } else if (dhp < -180.0f) {
+            dhp += 360.0f;
+        }
+    }
+    float dHp = 2.0f * sqrtf(c1p * c2p) * sinf(metricsRadians(dhp * 0.5f));
+
+    float lBarp = 0.5f * (lab1[0] + lab2[0]);
+    float cBarp = 0.5f * (c1p + c2p);
+    float hBarp = h1p + h2p;
+    if ((c1p * c2p) != 0.0f) {
+        if (fabsf(h1p - h2p) <= 180.0f) {
+            hBarp *= 0.5f;
+        } else if (hBarp < 360.0f) {
+            hBarp = (hBarp + 360.0f) * 0.5f;
+        } else {
+            hBarp = (hBarp - 360.0f) * 0.5f;
+        }
+    }
+
+    float t = 1.0f - (0.17f * cosf(metricsRadians(hBarp - 30.0f))) + (0.24f * cosf(metricsRadians(2.0f * hBarp))) +
+              (0.32f * cosf(metricsRadians((3.0f * hBarp) + 6.0f))) - (0.20f * cosf(metricsRadians((4.0f * hBarp) - 63.0f)));
+    float dTheta = 30.0f * expf(-powf((hBarp - 275.0f) / 25.0f, 2.0f));
+    float cBarp7 = powf(cBarp, 7.0f);
+    float rc = 2.0f * sqrtf(cBarp7 / (cBarp7 + pow25To7));
+    float lBarp50 = (lBarp - 50.0f) * (lBarp - 50.0f);
+    float sl = 1.0f + ((0.015f * lBarp50) / sqrtf(20.0f + lBarp50));
+    float sc = 1.0f + (0.045f * cBarp);
+    float sh = 1.0f + (0.015f * cBarp * t);
+    float rt = -sinf(metricsRadians(2.0f * dTheta)) * rc;
+
+    float l = dLp / sl;
+    float c = dCp / sc;
+    float h = dHp / sh;
+    return sqrtf(fmaxf((l * l) + (c * c) + (h * h) + (rt * c * h), 0.0f));
+}
+
+static void metricsHeatmapColor(float value, uint8_t * pixel)
+{
+    int stop = 1;
+    while ((stop < (HEATMAP_STOPS - 1)) && (value > HEATMAP_STOP_VALUES[stop])) {
+        ++stop;
+    }
+    float t = (value - HEATMAP_STOP_VALUES[stop - 1]) / (HEATMAP_STOP_VALUES[stop] - HEATMAP_STOP_VALUES[stop - 1]);
+    t = CL_CLAMP(t, 0.0f, 1.0f);
+    for (int c = 0; c < 3; ++c) {
+        float from = HEATMAP_STOP_COLORS[stop - 1][c];
+        float to = HEATMAP_STOP_COLORS[stop][c];
+        pixel[c] = (uint8_t)(from + ((to - from) * t) + 0.5f);
+    }
+    pixel[3] = 255;
+}
+
+// --------------------------------------------------------------------------------------
+// Per pixel pass
+
+typedef struct MetricsPartial
+{
+    int failed; // a band failed to convert
+    double codeSquaredError;
+    double pqSquaredError;
+    double deltaEITPSum;
+    double deltaEITPMax;
+    double deltaE2000Sum;
+    double deltaE2000Max;
+} MetricsPartial;
+
+typedef struct MetricsPixels
+{
+    clContext * C;
+    clImage * image1;
+    clImage * image2;
+    int convert2; // image2 has to be converted to image1's profile and depth first
+    clProfile * pqProfile;
+    const float * pqTable; // 16 bit PQ code -> nits
+    float diffuseWhite;
+    int width;
+    uint16_t * luma1; // PQ luma, for SSIM
+    uint16_t * luma2;
+    float * deltaEITP; // both NULL for summaries only
+    uint8_t * heatmap;
+    MetricsPartial * partials;
+} MetricsPixels;
+
+// Pixel pointers for one band of rows, b indexes the band and p the whole image
+typedef struct MetricsBand
+{
+    const uint8_t * code1U8;
+    const uint8_t * code2U8;
+    const uint16_t * code1U16;
+    const uint16_t * code2U16;
+    const uint16_t * pq1;
+    const uint16_t * pq2;
+} MetricsBand;
+
+static void metricsPixelBand(MetricsPixels * mp, MetricsPartial * partial, const MetricsBand * band, size_t first, size_t count)
+{
+    for (size_t b = 0; b < count; ++b) {
+        const size_t p = first + b;
+        for (int c = 0; c < 3; ++c) {
+            double codeError = band->code1U8 ? ((double)band->code1U8[(b * 4) + c] - (double)band->code2U8[(b * 4) + c])
+                                             : ((double)band->code1U16[(b * 4) + c] - (double)band->code2U16[(b * 4) + c]);
+            double pqError = ((double)band->pq1[(b * 4) + c] - (double)band->pq2[(b * 4) + c]) / 65535.0;
+            partial->codeSquaredError += codeError * codeError;
+            partial->pqSquaredError += pqError * pqError;
+        }
+
+        const uint16_t * pq1 = &band->pq1[b * 4];
+        const uint16_t * pq2 = &band->pq2[b * 4];
+        mp->luma1[p] = (uint16_t)((0.2627f * pq1[0]) + (0.6780f * pq1[1]) + (0.0593f * pq1[2]) + 0.5f);
+        mp->luma2[p] = (uint16_t)((0.2627f * pq2[0]) + (0.6780f * pq2[1]) + (0.0593f * pq2[2]) + 0.5f);
+
+        float rgb1[3] = { mp->pqTable[pq1[0]], mp->pqTable[pq1[1]], mp->pqTable[pq1[2]] };
+        float rgb2[3] = { mp->pqTable[pq2[0]], mp->pqTable[pq2[1]], mp->pqTable[pq2[2]] };
+
+        float itp1[3];
+        float itp2[3];
+        metricsITP(rgb1, itp1);
+        metricsITP(rgb2, itp2);
+        float dI = itp1[0] - itp2[0];
+        float dT = itp1[1] - itp2[1];
+        float dP = itp1[2] - itp2[2];
+        float deltaEITP = 720.0f * sqrtf((dI * dI) + (dT * dT) + (dP * dP));
+        partial->deltaEITPSum += deltaEITP;
+        partial->deltaEITPMax = fmax(partial->deltaEITPMax, deltaEITP);
+        if (mp->deltaEITP) {
+            mp->deltaEITP[p] = deltaEITP;
+            metricsHeatmapColor(deltaEITP, &mp->heatmap[p * 4]);
+        }
+
+        for (int c = 0; c < 3; ++c) {
+            rgb1[c] /= mp->diffuseWhite;
+            rgb2[c] /= mp->diffuseWhite;
+        }
+        float lab1[3];
+        float lab2[3];
+        metricsLab(rgb1, lab1);
+        metricsLab(rgb2, lab2);
+        float deltaE2000 = metricsDeltaE2000(lab1, lab2);
+        partial->deltaE2000Sum += deltaE2000;
+        partial->deltaE2000Max = fmax(partial->deltaE2000Max, deltaE2000);
+    }
+}
+
+// Converts a band of rows at a time: image2 into image1's color volume (if needed), then both
+// into PQ, so none of the converted images ever exist in full
+static void metricsPixelRows(void * userData, int jobIndex, int first, int count)
+{
+    MetricsPixels * mp = (MetricsPixels *)userData;
+    MetricsPartial * partial = &mp->partials[jobIndex];
+
+    clContext * C = jobsCreateContext(mp->C);
+    clProfile * codeProfile = mp->convert2 ? clProfileClone(C, mp->image1->profile) : NULL;
+    clProfile * pqProfile = clProfileClone(C, mp->pqProfile);
+    const int depth = mp->image1->depth;
+    for (int y = first; y < (first + count); y += METRICS_BAND_ROWS) {
+        const int rowCount = ((first + count - y) < METRICS_BAND_ROWS) ? (first + count - y) : METRICS_BAND_ROWS;
+        const size_t rowOffset = (size_t)y * mp->width;
+
+        // PQ goes through image1's color volume, so both measure the same (clipped) second image
+        clImage * code2 = NULL;
+        clImage * pq2 = NULL;
+        if (mp->convert2) {
+            code2 = diffConvertRows(C, mp->image2, y, rowCount, depth, codeProfile);
+            if (code2) {
+                pq2 = diffConvertRows(C, code2, 0, rowCount, 16, pqProfile);
+            }
+        } else {
+            pq2 = diffConvertRows(C, mp->image2, y, rowCount, 16, pqProfile);
+        }
+        clImage * pq1 = diffConvertRows(C, mp->image1, y, rowCount, 16, pqProfile);
+
+        if (pq1 && pq2) {
+            MetricsBand band;
+            memset(&band, 0, sizeof(band));
+            clImagePrepareReadPixels(C, pq1, CL_PIXELFORMAT_U16);
+            clImagePrepareReadPixels(C, pq2, CL_PIXELFORMAT_U16);
+            band.pq1 = pq1->pixelsU16;
+            band.pq2 = pq2->pixelsU16;
+            if (depth > 8) {
+                band.code1U16 = &mp->image1->pixelsU16[rowOffset * 4];
+                if (code2) {
+                    clImagePrepareReadPixels(C, code2, CL_PIXELFORMAT_U16);
+                    band.code2U16 = code2->pixelsU16;
+                } else {
+                    band.code2U16 = &mp->image2->pixelsU16[rowOffset * 4];
+                }
+            } else {
+                band.code1U8 = &mp->image1->pixelsU8[rowOffset * 4];
+                if (code2) {
+                    clImagePrepareReadPixels(C, code2, CL_PIXELFORMAT_U8);
+                    band.code2U8 = code2->pixelsU8;
+                } else {
+                    band.code2U8 = &mp->image2->pixelsU8[rowOffset * 4];
+                }
+            }
+            metricsPixelBand(mp, partial, &band, rowOffset, (size_t)rowCount * mp->width);
+        } else {
+            partial->failed = 1;
+        }
+
+        if (code2) {
+            clImageDestroy(C, code2);
+        }
+        if (pq1) {
+            clImageDestroy(C, pq1);
+        }
+        if (pq2) {
+            clImageDestroy(C, pq2);
+        }
+        if (partial->failed) {
+            break;
+        }
+    }
+    if (mp->convert2) {
+        clProfileDestroy(C, codeProfile);
+    }
+    clProfileDestroy(C, pqProfile);
+    clContextDestroy(C);
+}
+
+// --------------------------------------------------------------------------------------
+// SSIM
+
+typedef struct MetricsSSIM
+{
+    const uint16_t * luma1;
+    const uint16_t * luma2;
+    int width;
+    int windowsX;
+    double * jobSSIM; // sums over windows
+    double * jobCS;   // contrast * structure only, for MS-SSIM
+} MetricsSSIM;
+
+static void metricsSSIMRows(void * userData, int jobIndex, int first, int count)
+{
+    MetricsSSIM * ms = (MetricsSSIM *)userData;
+    const double n = (double)(SSIM_WINDOW * SSIM_WINDOW);
+    double ssimSum = 0.0;
+    double csSum = 0.0;
+    for (int wy = first; wy < first + count; ++wy) {
+        for (int wx = 0; wx < ms->windowsX; ++wx) {
+            double sum1 = 0.0;
+            double sum2 = 0.0;
+            double sumSq1 = 0.0;
+            double sumSq2 = 0.0;
+            double sum12 = 0.0;
+            for (int j = 0; j < SSIM_WINDOW; ++j) {
+                const size_t row = ((size_t)((wy * SSIM_STRIDE) + j) * ms->width) + (wx * SSIM_STRIDE);
+                const uint16_t * l1 = &ms->luma1[row];
+                const uint16_t * l2 = &ms->luma2[row];
+                for (int i = 0; i < SSIM_WINDOW; ++i) {
+                    double v1 = (double)l1[i];
+                    double v2 = (double)l2[i];
+                    sum1 += v1;
+                    sum2 += v2;
+                    sumSq1 += v1 * v1;
+                    sumSq2 += v2 * v2;
+                    sum12 += v1 * v2;
+                }
+            }
+            const double scale = 1.0 / (65535.0 * 65535.0);
+            double mean1 = sum1 / n;
+            double mean2 = sum2 / n;
+            double var1 = ((sumSq1 / n) - (mean1 * mean1)) * scale;
+            double var2 = ((sumSq2 / n) - (mean2 * mean2)) * scale;
+            double covar = ((sum12 / n) - (mean1 * mean2)) * scale;
+            mean1 /= 65535.0;
+            mean2 /= 65535.0;
+
+            double luminance = ((2.0 * mean1 * mean2) + SSIM_C1) / ((mean1 * mean1) + (mean2 * mean2) + SSIM_C1);
+            double cs = ((2.0 * covar) + SSIM_C2) / (var1 + var2 + SSIM_C2);
+            ssimSum += luminance * cs;
+            csSum += cs;
+        }
+    }
+    ms->jobSSIM[jobIndex] = ssimSum;
+    ms->jobCS[jobIndex] = csSum;
+}
+
+// Returns 0 if the planes are smaller than one window
+static int metricsSSIM(clContext * C,
+                       const uint16_t * luma1,
+                       const uint16_t * luma2,
+                       int width,
+                       int height,
+                       double * ssim,
+                       double * cs)
+{
+    if ((width < SSIM_WINDOW) || (height < SSIM_WINDOW)) {
+        return 0;
+    }
+
+    const int jobs = jobsCount(C);
+    MetricsSSIM ms;
+    ms.luma1 = luma1;
+    ms.luma2 = luma2;
+    ms.width = width;
+    ms.windowsX = ((width - SSIM_WINDOW) / SSIM_STRIDE) + 1;
+    ms.jobSSIM = (double *)calloc(jobs, sizeof(double));
+    ms.jobCS = (double *)calloc(jobs, sizeof(double));
+    const int windowsY = ((height - SSIM_WINDOW) / SSIM_STRIDE) + 1;
+    jobsParallelFor(C, windowsY, metricsSSIMRows, &ms);
+
+    double ssimSum = 0.0;
+    double csSum = 0.0;
+    for (int j = 0; j < jobs; ++j) {
+        ssimSum += ms.jobSSIM[j];
+        csSum += ms.jobCS[j];
+    }
+    const double windowCount = (double)ms.windowsX * (double)windowsY;
+    *ssim = ssimSum / windowCount;
+    *cs = csSum / windowCount;
+    free(ms.jobSSIM);
+    free(ms.jobCS);
+    return 1;
+}
+
+// 2x2 average, in place (dst may alias src)
+static void metricsDownsample(uint16_t * plane, int width, int height, int * outWidth, int * outHeight)
+{
+    const int w = width / 2;
+    const int h = height / 2;
+    for (int j = 0; j < h; ++j) {
+        for (int i = 0; i < w; ++i) {
+            const uint16_t * s = &plane[((size_t)(j * 2) * width) + (i * 2)];
+            uint32_t sum = (uint32_t)s[0] + s[1] + s[width] + s[width + 1];
+            plane[((size_t)j * w) + i] = (uint16_t)((sum + 2) / 4);
+        }
+    }
+    *outWidth = w;
+    *outHeight = h;
+}
+
+// --------------------------------------------------------------------------------------
+// Public
+
+static double metricsPSNR(double squaredError, double sampleCount, double peak)
+{
+    if (squaredError <= 0.0) {
+        return INFINITY;
+    }
+    return 10.0 * log10((peak * peak) / (squaredError / sampleCount));
+}
+
+DiffMetrics * metricsCreate(clContext * C, clImage * image1, clImage * image2, int perPixel)
+{
+    if ((image1->width != image2->width) || (image1->height != image2->height)) {
+        return NULL;
+    }
+
+    int luminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, image1->profile, NULL, NULL, &luminance);
+    if (luminance == CL_LUMINANCE_UNSPECIFIED) {
+        luminance = C->defaultLuminance;
+    }
+
+    clProfilePrimaries primaries;
+    clContextGetStockPrimaries(C, "bt2020", &primaries);
+    clProfileCurve curve;
+    curve.type = CL_PCT_PQ;
+    curve.gamma = 1.0f;
+    curve.implicitScale = 1.0f;
+    clProfile * pqProfile = clProfileCreate(C, &primaries, &curve, 10000, NULL);
+
+    const int width = image1->width;
+    const int height = image1->height;
+    const size_t pixelCount = (size_t)width * (size_t)height;
+
+    DiffMetrics * metrics = (DiffMetrics *)calloc(1, sizeof(DiffMetrics));
+    if (perPixel) {
+        metrics->deltaEITP = (float *)malloc(sizeof(float) * pixelCount);
+        metrics->heatmap = diffCreateVisualization(C, width, height);
+        clImagePrepareWritePixels(C, metrics->heatmap, CL_PIXELFORMAT_U8);
+    }
+
+    MetricsPixels mp;
+    memset(&mp, 0, sizeof(mp));
+    mp.C = C;
+    mp.image1 = image1;
+    mp.image2 = image2;
+    mp.pqProfile = pqProfile;
+    mp.convert2 = !clProfileMatches(C, image1->profile, image2->profile) || (image1->depth != image2->depth);
+    clImagePrepareReadPixels(C, image1, (image1->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    clImagePrepareReadPixels(C, image2, (image2->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    float * pqTable = (float *)malloc(sizeof(float) * 65536);
+    for (int i = 0; i < 65536; ++i) {
+        float n = powf((float)i / 65535.0f, 1.0f / PQ_M2);
+        float l = fmaxf(n - PQ_C1, 0.0f) / (PQ_C2 - (PQ_C3 * n));
+        pqTable[i] = powf(l, 1.0f / PQ_M1) * 10000.0f;
+    }
+    mp.pqTable = pqTable;
+    mp.diffuseWhite = fminf((float)luminance, METRICS_MAX_DIFFUSE_WHITE);
+    mp.width = width;
+    mp.luma1 = (uint16_t *)malloc(sizeof(uint16_t) * pixelCount);
+    mp.luma2 = (uint16_t *)malloc(sizeof(uint16_t) * pixelCount);
+    mp.deltaEITP = metrics->deltaEITP;
+    mp.heatmap = perPixel ? metrics->heatmap->pixelsU8 : NULL;
+    const int jobs = jobsCount(C);
+    mp.partials = (MetricsPartial *)calloc(jobs, sizeof(MetricsPartial));
+    jobsParallelFor(C, height, metricsPixelRows, &mp);
+    clProfileDestroy(C, pqProfile);
+
+    MetricsPartial total;
+    memset(&total, 0, sizeof(total));
+    for (int j = 0; j < jobs; ++j) {
+        total.failed |= mp.partials[j].failed;
+        total.codeSquaredError += mp.partials[j].codeSquaredError;
+        total.pqSquaredError += mp.partials[j].pqSquaredError;
+        total.deltaEITPSum += mp.partials[j].deltaEITPSum;
+        total.deltaEITPMax = fmax(total.deltaEITPMax, mp.partials[j].deltaEITPMax);
+        total.deltaE2000Sum += mp.partials[j].deltaE2000Sum;
+        total.deltaE2000Max = fmax(total.deltaE2000Max, mp.partials[j].deltaE2000Max);
+    }
+    free(mp.partials);
+    free(pqTable);
+    if (total.failed) {
+        free(mp.luma1);
+        free(mp.luma2);
+        metricsDestroy(C, metrics);
+        return NULL;
+    }
+
+    const double sampleCount = (double)pixelCount * 3.0;
+    metrics->psnr = metricsPSNR(total.codeSquaredError, sampleCount, (double)((1 << image1->depth) - 1));
+    metrics->psnrPQ = metricsPSNR(total.pqSquaredError, sampleCount, 1.0);
+    metrics->deltaEITPMean = total.deltaEITPSum / (double)pixelCount;
+    metrics->deltaEITPMax = total.deltaEITPMax;
+    metrics->deltaE2000Mean = total.deltaE2000Sum / (double)pixelCount;
+    metrics->deltaE2000Max = total.deltaE2000Max;
+
+    // MS-SSIM: contrast/structure at every scale, full SSIM at the coarsest one reached. The
+    // first scale is plain SSIM.
+    int scaleWidth = width;
+    int scaleHeight = height;
+    double weightSum = 0.0;
+    double logMSSSIM = 0.0;
+    for (int scale = 0; scale < MSSSIM_SCALES; ++scale) {
+        double ssim;
+        double cs;
+        if (!metricsSSIM(C, mp.luma1, mp.luma2, scaleWidth, scaleHeight, &ssim, &cs)) {
+            break;
+        }
+        if (scale == 0) {
+            metrics->ssim = ssim;
+        }
+        const int last = (scale == (MSSSIM_SCALES - 1)) || ((scaleWidth / 2) < SSIM_WINDOW) || ((scaleHeight / 2) < SSIM_WINDOW);
+        const double value = last ? ssim : cs;
+        logMSSSIM += MSSSIM_WEIGHTS[scale] * log(fmax(value, DBL_MIN));
+        weightSum += MSSSIM_WEIGHTS[scale];
+        if (last) {
+            break;
+        }
+        int nextWidth;
+        int nextHeight;
+        metricsDownsample(mp.luma1, scaleWidth, scaleHeight, &nextWidth, &nextHeight);
+        metricsDownsample(mp.luma2, scaleWidth, scaleHeight, &nextWidth, &nextHeight);
+        scaleWidth = nextWidth;
+        scaleHeight = nextHeight;
+    }
+    // Renormalized when the image is too small for every scale
+    metrics->msssim = (weightSum > 0.0) ? exp(logMSSSIM / weightSum) : metrics->ssim;
+
+    free(mp.luma1);
+    free(mp.luma2);
+    return metrics;
+}
+
+void metricsDestroy(clContext * C, DiffMetrics * metrics)
+{
+    if (metrics->heatmap) {
+        clImageDestroy(C, metrics->heatmap);
+    }
+    free(metrics->deltaEITP);
+    free(metrics);
+}
@@ -0,0 +1,37 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+
+// Objective comparison of a diff pair. Code value PSNR uses the images as given, everything else
+// is measured on both converted to BT.2020 PQ (absolute nits). PSNRs are INFINITY for identical
+// inputs.
+typedef struct DiffMetrics
+{
+    double psnr;           // code values, RGB
+    double psnrPQ;         // PQ code values, RGB
+    double ssim;           // PQ luma, 8x8 windows
+    double msssim;         // PQ luma, 5 scales
+    double deltaEITPMean;  // ITU-R BT.2124
+    double deltaEITPMax;
+    double deltaE2000Mean; // CIELAB relative to the first image's diffuse white
+    double deltaE2000Max;
+    float * deltaEITP;     // per pixel, NULL unless asked for
+    clImage * heatmap;     // deltaEITP through a color ramp (see diffCreateVisualization()), NULL unless asked for
+} DiffMetrics;
+
+// image2 must share image1's dimensions, it's measured in image1's profile and depth (converted a band
+// of rows at a time if it differs). Without perPixel only the summaries are kept, sparing a full
+// size heatmap and deltaEITP plane.
+DiffMetrics * metricsCreate(clContext * C, clImage * image1, clImage * image2, int perPixel);
+void metricsDestroy(clContext * C, DiffMetrics * metrics);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,355 @@
+#include "prepare.h"
+
+#include "gamut.h"
+#include "jobs.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --------------------------------------------------------------------------------------
+// Prepared formats
+
+// 4x4 Bayer matrix, used to dither the 16 -> 8 bit quantization
+static const uint32_t bayer4x4[4][4] = {
+    { 0, 8, 2, 10 },
+    { 12, 4, 14, 6 },
+    { 3, 11, 1, 9 },
+    { 15, 7, 13, 5 },
+};
+
+// Rows each job converts and packs at a time
+static const int PREPARE_BAND_ROWS = 64;
+
+static void preparePackRGB10A2(const uint16_t * src, uint32_t * dst, size_t pixelCount)
+{
+    for (size_t i = 0; i < pixelCount; ++i) {
+        const uint16_t * s = &src[i * 4];
+        uint32_t r = ((uint32_t)s[0] * 1023 + 32767) / 65535;
+        uint32_t g = ((uint32_t)s[1] * 1023 + 32767) / 65535;
+        uint32_t b = ((uint32_t)s[2] * 1023 + 32767) / 65535;
+        uint32_t a = ((uint32_t)s[3] * 3 + 32767) / 65535;
+        dst[i] = r | (g << 10) | (b << 20) | (a << 30);
+    }
+}
+
+// y is the first row's, so the dither pattern lines up across bands
+static void preparePackRGBA8(const uint16_t * src, uint8_t * dst, int width, int y, int rowCount)
+{
+    for (int j = 0; j < rowCount; ++j) {
+        const uint16_t * srcRow = &src[(size_t)j * width * 4];
+        uint8_t * dstRow = &dst[(size_t)j * width * 4];
+        const uint32_t * bayerRow = bayer4x4[(y + j) & 3];
+        for (int i = 0; i < width; ++i) {
+            // Offsets span (0, 65535) with a mean of 32767, so this averages out to rounding
+            const uint32_t dither = (bayerRow[i & 3] * 2 + 1) * 65535 / 32;
+            const uint16_t * s = &srcRow[i * 4];
+            uint8_t * d = &dstRow[i * 4];
+            d[0] = (uint8_t)(((uint32_t)s[0] * 255 + dither) / 65535);
+            d[1] = (uint8_t)(((uint32_t)s[1] * 255 + dither) / 65535);
+            d[2] = (uint8_t)(((uint32_t)s[2] * 255 + dither) / 65535);
+            d[3] = (uint8_t)(((uint32_t)s[3] * 255 + 32767) / 65535);
+        }
+    }
+}
+
+typedef struct PrepareConvertJobs
+{
+    clContext * C;
+    clImage * srcImage;
+    JobsCancel * cancel;
+    clProfile * dstProfile;
+    clTonemapParams * tonemapParams;
+    PreparedFormat format;
+    clImage * dstImage;
+    int * jobFailed;
+} PrepareConvertJobs;
+
+static void prepareConvertBands(void * userData, int jobIndex, int first, int count)
+{
+    PrepareConvertJobs * pj = (PrepareConvertJobs *)userData;
+    clImage * dstImage = pj->dstImage;
+    const int width = dstImage->width;
+
+    // Each job converts its own bands of the source
+    clContext * C = jobsCreateContext(pj->C);
+    clProfile * profile = clProfileClone(C, pj->dstProfile);
+    for (int band = first; band < (first + count); ++band) {
+        const int y = band * PREPARE_BAND_ROWS;
+        const int rowCount = ((dstImage->height - y) < PREPARE_BAND_ROWS) ? (dstImage->height - y) : PREPARE_BAND_ROWS;
+        clImage * rows = jobsCropRows(C, pj->cancel, pj->srcImage, y, rowCount);
+        clImage * converted = rows ? clImageConvert(C, rows, 16, profile, CL_TONEMAP_AUTO, pj->tonemapParams) : NULL;
+        if (rows) {
+            clImageDestroy(C, rows);
+        }
+        if (!converted) {
+            pj->jobFailed[jobIndex] = 1;
+            break;
+        }
+        clImagePrepareReadPixels(C, converted, CL_PIXELFORMAT_U16);
+
+        const size_t offset = (size_t)y * width * 4;
+        const size_t pixelCount = (size_t)width * rowCount;
+        switch (pj->format) {
+            case PREPAREDFORMAT_RGBA16:
+                memcpy(&dstImage->pixelsU16[offset], converted->pixelsU16, pixelCount * 4 * sizeof(uint16_t));
+                break;
+            case PREPAREDFORMAT_RGB10A2:
+                preparePackRGB10A2(converted->pixelsU16, (uint32_t *)&dstImage->pixelsU8[offset], pixelCount);
+                break;
+            case PREPAREDFORMAT_RGBA8:
+                preparePackRGBA8(converted->pixelsU16, &dstImage->pixelsU8[offset], width, y, rowCount);
+                break;
+        }
+        clImageDestroy(C, converted);
+    }
+    clProfileDestroy(C, profile);
+    clContextDestroy(C);
+}
+
+clImage * prepareConvert(clContext * C,
+                         clImage * srcImage,
+                         clProfile * dstProfile,
+                         clTonemapParams * tonemapParams,
+                         PreparedFormat format,
+                         JobsCancel * cancel)
+{
+    if (!jobsReadBegin(cancel)) {
+        return NULL;
+    }
+    const int width = srcImage->width;
+    const int height = srcImage->height;
+
+    clImagePrepareReadPixels(C, srcImage, (srcImage->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    jobsReadEnd(cancel);
+
+    const int packed = (format != PREPAREDFORMAT_RGBA16);
+    clImage * dstImage = clImageCreate(C, width, height, packed ? 8 : 16, dstProfile);
+    clImagePrepareWritePixels(C, dstImage, packed ? CL_PIXELFORMAT_U8 : CL_PIXELFORMAT_U16);
+
+    const int jobs = jobsCount(C);
+    PrepareConvertJobs pj;
+    pj.C = C;
+    pj.srcImage = srcImage;
+    pj.cancel = cancel;
+    pj.dstProfile = dstProfile;
+    pj.tonemapParams = tonemapParams;
+    pj.format = format;
+    pj.dstImage = dstImage;
+    pj.jobFailed = (int *)calloc(jobs, sizeof(int));
+
+    const int bandCount = (height + PREPARE_BAND_ROWS - 1) / PREPARE_BAND_ROWS;
+    jobsParallelFor(C, bandCount, prepareConvertBands, &pj);
+
+    int failed = 0;
+    for (int j = 0; j < jobs; ++j) {
+        failed |= pj.jobFailed[j];
+    }
+    free(pj.jobFailed);
+    if (failed) {
+        clImageDestroy(C, dstImage);
+        return NULL;
+    }
+    return dstImage;
+}
+
+// --------------------------------------------------------------------------------------
+// Proxy prepare
+
+// Don't bother with a proxy unless it skips at least this many source pixels per proxy pixel
+static const int PROXY_MIN_REDUCTION = 4;
+
+int prepareProxySize(int srcW, int srcH, int maxW, int maxH, int * proxyW, int * proxyH)
+{
+    if ((srcW < 1) || (srcH < 1) || (maxW < 1) || (maxH < 1)) {
+        return 0;
+    }
+
+    int w;
+    int h;
+    if (((float)maxW / (float)maxH) < ((float)srcW / (float)srcH)) {
+        w = maxW;
+        h = (int)(((float)maxW / (float)srcW) * (float)srcH + 0.5f);
+    } else {
+        h = maxH;
+        w = (int)(((float)maxH / (float)srcH) * (float)srcW + 0.5f);
+    }
+    w = CL_CLAMP(w, 1, srcW);
+    h = CL_CLAMP(h, 1, srcH);
+
+    if (((float)srcW * (float)srcH) < ((float)w * (float)h * PROXY_MIN_REDUCTION)) {
+        return 0;
+    }
+    *proxyW = w;
+    *proxyH = h;
+    return 1;
+}
+
+clImage * prepareCreateProxy(clContext * C, clImage * srcImage, int maxW, int maxH)
+{
+    int proxyW;
+    int proxyH;
+    if (!srcImage || !prepareProxySize(srcImage->width, srcImage->height, maxW, maxH, &proxyW, &proxyH)) {
+        return NULL;
+    }
+    return clImageResize(C, srcImage, proxyW, proxyH, CL_FILTER_BOX);
+}
+
+// --------------------------------------------------------------------------------------
+// Background prepare
+
+struct PrepareTask
+{
+    clContext * C;
+    clTask * task;
+    JobsCancel * cancel;
+    clImage * srcImage;
+    clProfile * dstProfile;
+    clTonemapParams tonemapParams;
+    int tonemapParamsValid;
+    PreparedFormat format;
+    PrepareStages stages;
+    clImage * result;
+    atomic_int finished; // released once result (and the stages' results) are set
+    PrepareTask * next;  // in the abandoned list
+};
+
+static void prepareTaskFunc(void * userData)
+{
+    PrepareTask * task = (PrepareTask *)userData;
+    clImage * image = task->srcImage;
+    if (task->stages.gamutCompress) {
+        task->stages.gamutCompressed = gamutCompress(task->C, image, task->cancel);
+        if (task->stages.gamutCompressed) {
+            image = task->stages.gamutCompressed;
+        }
+    }
+    clTonemapParams * tonemapParams = task->tonemapParamsValid ? &task->tonemapParams : NULL;
+    if (task->stages.localTonemap) {
+        task->stages.localTonemapped =
+            tonemapLocal(task->C, image, &task->stages.localTonemapParams, task->stages.localTonemapLuminance, task->cancel);
+        if (task->stages.localTonemapped) {
+            image = task->stages.localTonemapped;
+            tonemapParams = NULL;
+        }
+    }
+    if (!jobsCancelled(task->cancel)) {
+        task->result = prepareConvert(task->C, image, task->dstProfile, tonemapParams, task->format, task->cancel);
+    }
+    atomic_store_explicit(&task->finished, 1, memory_order_release);
+}
+
+PrepareTask * prepareTaskCreate(clContext * C,
+                                clImage * srcImage,
+                                clProfile * dstProfile,
+                                clTonemapParams * tonemapParams,
+                                PreparedFormat format,
+                                const PrepareStages * stages)
+{
+    PrepareTask * task = (PrepareTask *)calloc(1, sizeof(PrepareTask));
+    task->C = clContextCreate(NULL);
+    task->C->params.jobs = C->params.jobs;
+    task->C->defaultLuminance = C->defaultLuminance;
+    task->cancel = jobsCancelCreate();
+
+    // srcImage is the only image the task borrows, the stages make their own results
+    clImagePrepareReadPixels(C, srcImage, (srcImage->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    task->srcImage = srcImage;
+    task->dstProfile = clProfileClone(task->C, dstProfile);
+    if (tonemapParams) {
+        memcpy(&task->tonemapParams, tonemapParams, sizeof(clTonemapParams));
+        task->tonemapParamsValid = 1;
+    }
+    task->format = format;
+    if (stages) {
+        task->stages = *stages;
+    }
+    task->stages.gamutCompressed = NULL;
+    task->stages.localTonemapped = NULL;
+    atomic_init(&task->finished, 0);
+    task->task = clTaskCreate(task->C, prepareTaskFunc, task);
+    return task;
+}
+
+int prepareTaskFinished(PrepareTask * task)
+{
+    return atomic_load_explicit(&task->finished, memory_order_acquire);
+}
+
+// Joins the task and frees everything but the results
+static void prepareTaskDestroy(PrepareTask * task)
+{
+    clTaskJoin(task->C, task->task);
+    clTaskDestroy(task->C, task->task);
+    clProfileDestroy(task->C, task->dstProfile);
+    jobsCancelDestroy(task->cancel);
+}
+
+// Both contexts use the default allocator, so only the profile needs to change hands
+static clImage * prepareTaskAdopt(clContext * C, PrepareTask * task, clImage * image)
+{
+    if (image) {
+        clProfile * profile = clProfileClone(C, image->profile);
+        clProfileDestroy(task->C, image->profile);
+        image->profile = profile;
+    }
+    return image;
+}
+
+clImage * prepareTaskFinish(clContext * C, PrepareTask * task, PrepareStages * stages)
+{
+    prepareTaskDestroy(task);
+
+    clImage * result = prepareTaskAdopt(C, task, task->result);
+    if (stages) {
+        stages->gamutCompressed = prepareTaskAdopt(C, task, task->stages.gamutCompressed);
+        stages->localTonemapped = prepareTaskAdopt(C, task, task->stages.localTonemapped);
+    } else {
+        if (task->stages.gamutCompressed) {
+            clImageDestroy(task->C, task->stages.gamutCompressed);
+        }
+        if (task->stages.localTonemapped) {
+            clImageDestroy(task->C, task->stages.localTonemapped);
+        }
+    }
+
+    clContextDestroy(task->C);
+    free(task);
+    return result;
+}
+
+void prepareTaskCancel(PrepareTask * task, PrepareTask ** abandoned)
+{
+    jobsCancel(task->cancel);
+    task->next = *abandoned;
+    *abandoned = task;
+}
+
+void prepareTaskReap(PrepareTask ** abandoned, int wait)
+{
+    PrepareTask ** link = abandoned;
+    while (*link) {
+        PrepareTask * task = *link;
+        if (!wait && !prepareTaskFinished(task)) {
+            link = &task->next;
+            continue;
+        }
+
+        *link = task->next;
+        clImage * gamutCompressed = task->stages.gamutCompressed;
+        clImage * localTonemapped = task->stages.localTonemapped;
+        clImage * result = task->result;
+        prepareTaskDestroy(task);
+        if (gamutCompressed) {
+            clImageDestroy(task->C, gamutCompressed);
+        }
+        if (localTonemapped) {
+            clImageDestroy(task->C, localTonemapped);
+        }
+        if (result) {
+            clImageDestroy(task->C, result);
+        }
+        clContextDestroy(task->C);
+        free(task);
+    }
+}
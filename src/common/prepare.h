@@ -0,0 +1,96 @@
+#ifndef PREPARE_H
+#define PREPARE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+#include "jobs.h"
+#include "tonemap.h"
+
+// --------------------------------------------------------------------------------------
+// Prepared formats
+
+// How the prepared image's pixels are laid out for upload. Packed formats reuse the image's
+// 8 bit plane (pixelsU8, 4 bytes per pixel); for RGB10A2 each pixel is a little endian uint32
+// with R in the low 10 bits, matching DXGI_FORMAT_R10G10B10A2_UNORM / MTLPixelFormatRGB10A2Unorm.
+//
+// An RGB10A2 image is only a container: colorist still sees an 8 bit RGBA clImage, so anything
+// but uploading its pixels and clImageDestroy() (converting, resizing, cropping, writing, reading
+// a pixel) would misread it. RGBA8 images are ordinary 8 bit images.
+typedef enum PreparedFormat
+{
+    PREPAREDFORMAT_RGBA16 = 0, // pixelsU16
+    PREPAREDFORMAT_RGB10A2,    // pixelsU8, 2 bit alpha
+    PREPAREDFORMAT_RGBA8       // pixelsU8, ordered dither
+} PreparedFormat;
+
+// Converts srcImage to 16 bits in dstProfile (CL_TONEMAP_AUTO with tonemapParams, which may be
+// NULL) and packs it into format. Jobs convert and pack a band of rows at a time, so a packed
+// format never has a full size 16 bit copy. srcImage is only read. NULL if a band failed or
+// cancel (which may be NULL) was set.
+clImage * prepareConvert(clContext * C,
+                         clImage * srcImage,
+                         clProfile * dstProfile,
+                         clTonemapParams * tonemapParams,
+                         PreparedFormat format,
+                         JobsCancel * cancel);
+
+// --------------------------------------------------------------------------------------
+// Proxy prepare
+
+// Returns a box-filtered copy of srcImage that fits in maxW x maxH (same depth and profile),
+// or NULL if srcImage isn't meaningfully larger than that and a proxy wouldn't save anything.
+clImage * prepareCreateProxy(clContext * C, clImage * srcImage, int maxW, int maxH);
+
+// The size prepareCreateProxy() would make a srcW x srcH proxy, returns 0 where it wouldn't make one
+int prepareProxySize(int srcW, int srcH, int maxW, int maxH, int * proxyW, int * proxyH);
+
+// --------------------------------------------------------------------------------------
+// Background prepare
+
+// Full resolution work a background prepare does on the source before converting it, for what
+// the caller doesn't have cached. Their results are handed back by prepareTaskFinish() (C-owned,
+// NULL for a stage that didn't run or left the source as is) so they can be.
+typedef struct PrepareStages
+{
+    int gamutCompress;         // gamutCompress() the source first
+    clImage * gamutCompressed; // result
+
+    int localTonemap; // then tonemapLocal() it, converting without tonemapParams if that succeeds
+    LocalTonemapParams localTonemapParams;
+    int localTonemapLuminance;
+    clImage * localTonemapped; // result
+} PrepareStages;
+
+// Runs the stages and prepareConvert() on a worker thread with a private clContext, as colorist
+// contexts aren't meant to be shared across threads. srcImage is borrowed and must stay alive
+// (and unmodified) until the task is finished or cancelled. Opaque, as it holds C11 atomics.
+typedef struct PrepareTask PrepareTask;
+
+PrepareTask * prepareTaskCreate(clContext * C,
+                                clImage * srcImage,
+                                clProfile * dstProfile,
+                                clTonemapParams * tonemapParams,
+                                PreparedFormat format,
+                                const PrepareStages * stages); // NULL for none
+int prepareTaskFinished(PrepareTask * task); // nonzero once the result is ready, never blocks
+
+// Blocks, destroys task and returns a C-owned image. The stages' results land in stages, or are
+// destroyed if it's NULL.
+clImage * prepareTaskFinish(clContext * C, PrepareTask * task, PrepareStages * stages);
+
+// Abandons task without waiting for its work: it stops at its next band and is pushed onto the
+// abandoned list, to be freed by prepareTaskReap(). Only waits out reads of srcImage already under
+// way (see jobsCancel()), so srcImage may be destroyed as soon as this returns.
+void prepareTaskCancel(PrepareTask * task, PrepareTask ** abandoned);
+
+// Destroys the abandoned tasks that have stopped. With wait, joins the rest too (on shutdown).
+void prepareTaskReap(PrepareTask ** abandoned, int wait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,242 @@
+#include "regions.h"
+
+#include "jobs.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// --------------------------------------------------------------------------------------
+// Runs
+
+// A horizontal span [x0, x1) of over threshold pixels on row y
+typedef struct RegionRun
+{
+    int y;
+    int x0;
+    int x1;
+    int maxDiff;
+    int parent; // union-find, band local until the bands are stitched
+} RegionRun;
+
+typedef struct RegionBand
+{
+    RegionRun * runs;
+    int runCount;
+    int runCapacity;
+    int firstRowEnd;  // runs [0, firstRowEnd) are on the band's first row
+    int lastRowStart; // runs [lastRowStart, runCount) are on the band's last row
+} RegionBand;
+
+typedef struct RegionLabel
+{
+    const ImageDiff * diff;
+    int width;
+    int threshold;
+    RegionBand * bands; // one per job
+} RegionLabel;
+
+static int regionsFind(RegionRun * runs, int index)
+{
+    int root = index;
+    while (runs[root].parent != root) {
+        root = runs[root].parent;
+    }
+    while (runs[index].parent != root) {
+        int next = runs[index].parent;
+        runs[index].parent = root;
+        index = next;
+    }
+    return root;
+}
+
+// The lower index becomes the root, which keeps every label deterministic
+static void regionsUnion(RegionRun * runs, int a, int b)
+{
+    a = regionsFind(runs, a);
+    b = regionsFind(runs, b);
+    if (a < b) {
+        runs[b].parent = a;
+    } else if (b < a) {
+        runs[a].parent = b;
+    }
+}
+
+// Unions every run in [aFirst, aEnd) with the runs in [bFirst, bEnd) on the next row that touch
+// it, diagonals included. Both ranges are sorted by x.
+static void regionsUnionRows(RegionRun * runs, int aFirst, int aEnd, int bFirst, int bEnd)
+{
+    int a = aFirst;
+    int b = bFirst;
+    while ((a < aEnd) && (b < bEnd)) {
+        if ((runs[a].x0 <= runs[b].x1) && (runs[b].x0 <= runs[a].x1)) {
+            regionsUnion(runs, a, b);
+        }
+        // Advance whichever run ends first, the other may still touch the next one
+        if (runs[a].x1 < runs[b].x1) {
+            ++a;
+        } else {
+            ++b;
+        }
+    }
+}
+
+static void regionsPushRun(RegionBand * band, int y, int x0, int x1, int maxDiff)
+{
+    if (band->runCount == band->runCapacity) {
+        band->runCapacity = (band->runCapacity > 0) ? (band->runCapacity * 2) : 256;
+        band->runs = (RegionRun *)realloc(band->runs, sizeof(RegionRun) * band->runCapacity);
+    }
+    RegionRun * run = &band->runs[band->runCount];
+    run->y = y;
+    run->x0 = x0;
+    run->x1 = x1;
+    run->maxDiff = maxDiff;
+    run->parent = band->runCount;
+    ++band->runCount;
+}
+
+static void regionsLabelRows(void * userData, int jobIndex, int first, int count)
+{
+    RegionLabel * rl = (RegionLabel *)userData;
+    RegionBand * band = &rl->bands[jobIndex];
+    int previousRowStart = 0;
+    int previousRowEnd = 0;
+    uint16_t * diffs = (uint16_t *)malloc(sizeof(uint16_t) * rl->width);
+    for (int y = first; y < (first + count); ++y) {
+        diffLevelReadRow(&rl->diff->levels[0], y, diffs);
+        const int rowStart = band->runCount;
+        for (int x = 0; x < rl->width; ++x) {
+            if (diffs[x] <= rl->threshold) {
+                continue;
+            }
+            const int x0 = x;
+            int maxDiff = diffs[x];
+            while (((x + 1) < rl->width) && (diffs[x + 1] > rl->threshold)) {
+                ++x;
+                maxDiff = (diffs[x] > maxDiff) ? diffs[x] : maxDiff;
+            }
+            regionsPushRun(band, y, x0, x + 1, maxDiff);
+        }
+        if (y > first) {
+            regionsUnionRows(band->runs, previousRowStart, previousRowEnd, rowStart, band->runCount);
+        } else {
+            band->firstRowEnd = band->runCount;
+        }
+        band->lastRowStart = rowStart;
+        previousRowStart = rowStart;
+        previousRowEnd = band->runCount;
+    }
+    free(diffs);
+}
+
+// --------------------------------------------------------------------------------------
+// Regions
+
+static int regionsCompareSeverity(const void * a, const void * b)
+{
+    const DiffRegion * region1 = (const DiffRegion *)a;
+    const DiffRegion * region2 = (const DiffRegion *)b;
+    if (region1->maxDiff != region2->maxDiff) {
+        return (region1->maxDiff < region2->maxDiff) ? 1 : -1;
+    }
+    if (region1->pixelCount != region2->pixelCount) {
+        return (region1->pixelCount < region2->pixelCount) ? 1 : -1;
+    }
+    if (region1->y != region2->y) {
+        return (region1->y < region2->y) ? -1 : 1;
+    }
+    return (region1->x < region2->x) ? -1 : ((region1->x > region2->x) ? 1 : 0);
+}
+
+DiffRegions * regionsCreate(clContext * C, const ImageDiff * diff, int threshold)
+{
+    DiffRegions * regions = (DiffRegions *)calloc(1, sizeof(DiffRegions));
+    regions->threshold = threshold;
+    if (diff->overThresholdCount == 0) {
+        return regions;
+    }
+
+    const int width = diff->levels[0].width;
+    const int height = diff->levels[0].height;
+    const int jobs = jobsCount(C);
+    RegionLabel rl;
+    rl.diff = diff;
+    rl.width = width;
+    rl.threshold = threshold;
+    rl.bands = (RegionBand *)calloc(jobs, sizeof(RegionBand));
+    jobsParallelFor(C, height, regionsLabelRows, &rl);
+
+    // Concatenate the bands in order, rebasing their parents
+    int runCount = 0;
+    for (int j = 0; j < jobs; ++j) {
+        runCount += rl.bands[j].runCount;
+    }
+    RegionRun * runs = (RegionRun *)malloc(sizeof(RegionRun) * runCount);
+    int * bandOffsets = (int *)calloc(jobs, sizeof(int));
+    int offset = 0;
+    for (int j = 0; j < jobs; ++j) {
+        RegionBand * band = &rl.bands[j];
+        bandOffsets[j] = offset;
+        for (int i = 0; i < band->runCount; ++i) {
+            runs[offset + i] = band->runs[i];
+            runs[offset + i].parent += offset;
+        }
+        offset += band->runCount;
+    }
+
+    // Stitch each band's last row to the next band's first row (bands are consecutive rows)
+    for (int j = 0; (j + 1) < jobs; ++j) {
+        const RegionBand * above = &rl.bands[j];
+        const RegionBand * below = &rl.bands[j + 1];
+        regionsUnionRows(runs,
+                         bandOffsets[j] + above->lastRowStart,
+                         bandOffsets[j] + above->runCount,
+                         bandOffsets[j + 1],
+                         bandOffsets[j + 1] + below->firstRowEnd);
+    }
+    for (int j = 0; j < jobs; ++j) {
+        free(rl.bands[j].runs);
+    }
+    free(rl.bands);
+    free(bandOffsets);
+
+    // Roots come before the rest of their runs, so one pass assigns region indices in order
+    int * regionIndices = (int *)malloc(sizeof(int) * runCount);
+    regions->regions = (DiffRegion *)malloc(sizeof(DiffRegion) * runCount);
+    for (int i = 0; i < runCount; ++i) {
+        const RegionRun * run = &runs[i];
+        const int root = regionsFind(runs, i);
+        DiffRegion * region;
+        if (root == i) {
+            regionIndices[i] = regions->count++;
+            region = &regions->regions[regionIndices[i]];
+            region->x = run->x0;
+            region->y = run->y;
+            region->w = run->x1 - run->x0;
+            region->h = 1;
+            region->pixelCount = 0;
+            region->maxDiff = 0;
+        } else {
+            region = &regions->regions[regionIndices[root]];
+            const int x0 = (run->x0 < region->x) ? run->x0 : region->x;
+            const int x1 = (run->x1 > (region->x + region->w)) ? run->x1 : (region->x + region->w);
+            region->x = x0;
+            region->w = x1 - x0;
+            region->h = run->y - region->y + 1; // runs are in row order, and the root's row comes first
+        }
+        region->pixelCount += run->x1 - run->x0;
+        region->maxDiff = (run->maxDiff > region->maxDiff) ? run->maxDiff : region->maxDiff;
+    }
+    free(regionIndices);
+    free(runs);
+    regions->regions = (DiffRegion *)realloc(regions->regions, sizeof(DiffRegion) * regions->count);
+
+    qsort(regions->regions, regions->count, sizeof(DiffRegion), regionsCompareSeverity);
+    return regions;
+}
+
+void regionsDestroy(DiffRegions * regions)
+{
+    free(regions->regions);
+    free(regions);
+}
@@ -0,0 +1,40 @@
+#ifndef REGIONS_H
+#define REGIONS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+
+#include "diff.h"
+
+// An 8-connected group of pixels whose diff is over the threshold
+typedef struct DiffRegion
+{
+    int x; // bounding box, in image pixels
+    int y;
+    int w;
+    int h;
+    int pixelCount;
+    int maxDiff;
+} DiffRegion;
+
+typedef struct DiffRegions
+{
+    DiffRegion * regions; // most severe first: largest maxDiff, then most pixels
+    int count;
+    int threshold;
+} DiffRegions;
+
+// Labels runs of over threshold pixels one band of rows per job, unioning them with the row
+// above, then stitches the bands together at their borders. Cheap enough to redo whenever the
+// threshold changes.
+DiffRegions * regionsCreate(clContext * C, const ImageDiff * diff, int threshold);
+void regionsDestroy(DiffRegions * regions);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+#include "sequence.h"
+
+#include "diff.h"
+#include "dyn.h"
+#include "jobs.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest file kept in memory for the workers to decode from (see SequenceSource), larger ones are
+// reread by clContextRead() for every frame
+static const long SEQUENCE_MAX_SOURCE_BYTES = 256 * 1024 * 1024;
+
+// Diff stats of one frame pair. Everything but the over threshold cache is written by a worker
+// before it releases state, and never touched again.
+typedef struct SequenceFrame
+{
+    int * histogram; // pixel count per diff value, taken from the frame's ImageDiff
+    int histogramSize;
+    int pixelCount;
+    int largestChannelDiff;
+    int identical;
+    atomic_int state; // SequenceFrameState
+
+    // Owned by the thread calling sequenceDiffOverThreshold()
+    int countThreshold;
+    int overThresholdCount;
+} SequenceFrame;
+
+// One file of the pair. Up to SEQUENCE_MAX_SOURCE_BYTES, it's read into memory once and every
+// worker decodes its frames from there, rather than each frame reopening and rereading the whole
+// file. That buffer is the file's size, held until the sequence diff is destroyed.
+typedef struct SequenceSource
+{
+    char * filename;
+    clRaw raw;         // empty until the task reads it
+    clFormat * format; // NULL if the file couldn't be read or detected or is too large, frames then go through clContextRead()
+    char * formatName;
+} SequenceSource;
+
+struct SequenceDiff
+{
+    clContext * C;
+    clTask * task;
+    SequenceSource sources[2];
+    int frameCount;
+    int firstFrame;
+    int workerCount;
+    DiffAlignment alignment; // applied to every frame pair if aligned
+    int aligned;
+    SequenceFrame * frames;
+    atomic_int cancelled;
+    atomic_int finished;
+};
+
+// --------------------------------------------------------------------------------------
+// Sources
+
+static uint8_t * sequenceReadFile(const char * filename, size_t * outSize)
+{
+    FILE * f = fopen(filename, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if ((size <= 0) || (size > SEQUENCE_MAX_SOURCE_BYTES)) {
+        fclose(f);
+        return NULL;
+    }
+
+    uint8_t * data = (uint8_t *)malloc((size_t)size);
+    if (fread(data, 1, (size_t)size, f) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    *outSize = (size_t)size;
+    return data;
+}
+
+static void sequenceSourceOpen(clContext * C, SequenceSource * source)
+{
+    const char * formatName = clFormatDetect(C, source->filename);
+    clFormat * format = formatName ? clContextFindFormat(C, formatName) : NULL;
+    if (!format || !format->readFunc) {
+        return;
+    }
+    size_t size = 0;
+    source->raw.ptr = sequenceReadFile(source->filename, &size);
+    if (source->raw.ptr) {
+        source->raw.size = size;
+        source->format = format;
+        dsCopy(&source->formatName, formatName);
+    }
+}
+
+// Only reads source, so every worker can decode from it at once. The frame is cropped, rotated
+// and mirrored as the reader asks, like the viewer's.
+static clImage * sequenceSourceRead(clContext * C, SequenceSource * source, int frameIndex)
+{
+    C->params.frameIndex = frameIndex;
+    clImage * image;
+    if (source->format) {
+        clRaw raw = source->raw;
+        memset(&C->readExtraInfo, 0, sizeof(C->readExtraInfo));
+        image = source->format->readFunc(C, source->formatName, NULL, &raw);
+    } else {
+        image = clContextRead(C, source->filename, NULL, NULL);
+    }
+    return alignReadTransform(C, image, &C->readExtraInfo);
+}
+
+static void sequenceSourceClose(SequenceSource * source)
+{
+    free(source->raw.ptr);
+    dsDestroy(&source->formatName);
+    dsDestroy(&source->filename);
+}
+
+// --------------------------------------------------------------------------------------
+// Workers
+
+static void sequenceDiffFrame(SequenceDiff * sd, clContext * C, int frameIndex)
+{
+    SequenceFrame * frame = &sd->frames[frameIndex];
+
+    clImage * image1 = sequenceSourceRead(C, &sd->sources[0], frameIndex);
+    clImage * image2 = sequenceSourceRead(C, &sd->sources[1], frameIndex);
+
+    if (image1 && image2 && sd->aligned) {
+        image1 = alignCrop(C, image1, &sd->alignment, 0);
+        image2 = alignCrop(C, image2, &sd->alignment, 1);
+    }
+
+    ImageDiff * diff = NULL;
+    if (image1 && image2) {
+        diff = diffCreate(C, image1, image2, 0.0f, 0);
+    }
+    if (diff) {
+        frame->histogram = diff->histogram;
+        frame->histogramSize = diff->histogramSize;
+        frame->pixelCount = diff->pixelCount;
+        frame->largestChannelDiff = diff->largestChannelDiff;
+        frame->identical = diff->identical;
+        diff->histogram = NULL;
+        diffDestroy(C, diff);
+    }
+    if (image1) {
+        clImageDestroy(C, image1);
+    }
+    if (image2) {
+        clImageDestroy(C, image2);
+    }
+    atomic_store_explicit(&frame->state, frame->histogram ? SEQUENCEFRAME_DONE : SEQUENCEFRAME_FAILED, memory_order_release);
+}
+
+// Worker jobIndex takes every workerCount'th frame from firstFrame on, wrapping around
+static void sequenceDiffWorker(void * userData, int jobIndex, int first, int count)
+{
+    (void)first;
+    (void)count;
+
+    SequenceDiff * sd = (SequenceDiff *)userData;
+    clContext * C = jobsCreateContext(sd->C);
+    for (int i = jobIndex; (i < sd->frameCount) && !atomic_load_explicit(&sd->cancelled, memory_order_acquire);
+         i += sd->workerCount) {
+        sequenceDiffFrame(sd, C, (sd->firstFrame + i) % sd->frameCount);
+    }
+    clContextDestroy(C);
+}
+
+static void sequenceDiffTaskFunc(void * userData)
+{
+    SequenceDiff * sd = (SequenceDiff *)userData;
+    sequenceSourceOpen(sd->C, &sd->sources[0]);
+    sequenceSourceOpen(sd->C, &sd->sources[1]);
+    jobsParallelFor(sd->C, sd->workerCount, sequenceDiffWorker, sd);
+    atomic_store_explicit(&sd->finished, 1, memory_order_release);
+}
+
+// --------------------------------------------------------------------------------------
+// Sequence diff
+
+SequenceDiff * sequenceDiffCreate(clContext * C,
+                                  const char * filename1,
+                                  const char * filename2,
+                                  int frameCount,
+                                  int firstFrame,
+                                  const DiffAlignment * alignment)
+{
+    SequenceDiff * sd = (SequenceDiff *)calloc(1, sizeof(SequenceDiff));
+    sd->workerCount = jobsCount(C);
+    if (sd->workerCount > frameCount) {
+        sd->workerCount = frameCount;
+    }
+    sd->C = clContextCreate(NULL);
+    sd->C->params.jobs = sd->workerCount;
+    sd->C->defaultLuminance = C->defaultLuminance;
+    dsCopy(&sd->sources[0].filename, filename1);
+    dsCopy(&sd->sources[1].filename, filename2);
+    sd->frameCount = frameCount;
+    if (alignment) {
+        sd->alignment = *alignment;
+        sd->aligned = 1;
+    }
+    sd->firstFrame = ((firstFrame >= 0) && (firstFrame < frameCount)) ? firstFrame : 0;
+    sd->frames = (SequenceFrame *)calloc(frameCount, sizeof(SequenceFrame));
+    for (int i = 0; i < frameCount; ++i) {
+        atomic_init(&sd->frames[i].state, SEQUENCEFRAME_PENDING);
+        sd->frames[i].countThreshold = -1;
+    }
+    atomic_init(&sd->cancelled, 0);
+    atomic_init(&sd->finished, 0);
+    sd->task = clTaskCreate(sd->C, sequenceDiffTaskFunc, sd);
+    return sd;
+}
+
+int sequenceDiffFinished(SequenceDiff * sd)
+{
+    return atomic_load_explicit(&sd->finished, memory_order_acquire);
+}
+
+int sequenceDiffCompletedCount(SequenceDiff * sd)
+{
+    int completed = 0;
+    for (int i = 0; i < sd->frameCount; ++i) {
+        if (sequenceDiffFrameState(sd, i) != SEQUENCEFRAME_PENDING) {
+            ++completed;
+        }
+    }
+    return completed;
+}
+
+int sequenceDiffFrameCount(SequenceDiff * sd)
+{
+    return sd->frameCount;
+}
+
+int sequenceDiffAlignment(SequenceDiff * sd, DiffAlignment * alignment)
+{
+    if (sd->aligned) {
+        *alignment = sd->alignment;
+    }
+    return sd->aligned;
+}
+
+SequenceFrameState sequenceDiffFrameState(SequenceDiff * sd, int frameIndex)
+{
+    return (SequenceFrameState)atomic_load_explicit(&sd->frames[frameIndex].state, memory_order_acquire);
+}
+
+int sequenceDiffLargestChannelDiff(SequenceDiff * sd, int frameIndex)
+{
+    if (sequenceDiffFrameState(sd, frameIndex) != SEQUENCEFRAME_DONE) {
+        return -1;
+    }
+    return sd->frames[frameIndex].largestChannelDiff;
+}
+
+int sequenceDiffOverThreshold(SequenceDiff * sd, int frameIndex, int threshold)
+{
+    SequenceFrame * frame = &sd->frames[frameIndex];
+    if (sequenceDiffFrameState(sd, frameIndex) != SEQUENCEFRAME_DONE) {
+        return -1;
+    }
+    if (frame->countThreshold != threshold) {
+        frame->countThreshold = threshold;
+        frame->overThresholdCount = 0;
+        for (int i = threshold + 1; i < frame->histogramSize; ++i) {
+            frame->overThresholdCount += frame->histogram[i];
+        }
+    }
+    return frame->overThresholdCount;
+}
+
+void sequenceDiffDestroy(SequenceDiff * sd)
+{
+    atomic_store_explicit(&sd->cancelled, 1, memory_order_release);
+    clTaskJoin(sd->C, sd->task);
+    clTaskDestroy(sd->C, sd->task);
+    for (int i = 0; i < sd->frameCount; ++i) {
+        free(sd->frames[i].histogram);
+    }
+    free(sd->frames);
+    sequenceSourceClose(&sd->sources[0]);
+    sequenceSourceClose(&sd->sources[1]);
+    clContextDestroy(sd->C);
+    free(sd);
+}
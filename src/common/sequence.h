@@ -0,0 +1,53 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+
+#include "align.h"
+
+typedef enum SequenceFrameState
+{
+    SEQUENCEFRAME_PENDING = 0,
+    SEQUENCEFRAME_DONE,
+    SEQUENCEFRAME_FAILED // either frame failed to decode, or their dimensions differ
+} SequenceFrameState;
+
+// Diffs every frame of two sequences (.avifs, .mp4, ...) in the background. Each file (up to a size
+// cap) is read into memory once, and each worker decodes and diffs its own frame pairs from it with
+// a private clContext, starting from firstFrame and stepping forward by the worker count, so frames
+// complete roughly in order ahead of the one on screen. Only each frame's histogram is kept, which
+// is enough to recount it at any threshold. alignment (NULL for none) is what lined up the frame on
+// screen, every frame is cropped to its overlap. Opaque, as workers publish frames through C11 atomics.
+typedef struct SequenceDiff SequenceDiff;
+
+SequenceDiff * sequenceDiffCreate(clContext * C,
+                                  const char * filename1,
+                                  const char * filename2,
+                                  int frameCount,
+                                  int firstFrame,
+                                  const DiffAlignment * alignment);
+int sequenceDiffFinished(SequenceDiff * sd);       // nonzero once every frame is done or failed, never blocks
+int sequenceDiffCompletedCount(SequenceDiff * sd); // frames done or failed so far
+int sequenceDiffFrameCount(SequenceDiff * sd);
+int sequenceDiffAlignment(SequenceDiff * sd, DiffAlignment * alignment); // nonzero (filling alignment) if frames are aligned
+void sequenceDiffDestroy(SequenceDiff * sd);       // blocks until the workers notice they're cancelled
+
+// What's known of frameIndex so far, never blocks
+SequenceFrameState sequenceDiffFrameState(SequenceDiff * sd, int frameIndex);
+
+// Largest channel difference in frameIndex, or -1 if it isn't done (yet)
+int sequenceDiffLargestChannelDiff(SequenceDiff * sd, int frameIndex);
+
+// Pixels over threshold in frameIndex, or -1 if it isn't done (yet). Recounted from the histogram
+// only when the threshold changes, so a timeline can call it for every frame on every redraw.
+int sequenceDiffOverThreshold(SequenceDiff * sd, int frameIndex, int threshold);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
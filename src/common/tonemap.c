@@ -0,0 +1,878 @@
+#include "tonemap.h"
+
+#include "jobs.h"
+#include "prepare.h"
+
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --------------------------------------------------------------------------------------
+// Constants
+
+// Darkest luminance considered (relative to SDR white), keeps log2() finite
+static const float MIN_RELATIVE_LUMINANCE = 1.0f / 65536.0f;
+
+// Base layers never span more than this many stops, so a few black pixels can't flatten the image
+static const float MAX_BASE_RANGE = 24.0f;
+
+// Rows each job decodes to PQ at a time
+static const int LOCAL_BAND_ROWS = 64;
+
+// SMPTE ST.2084
+static const float PQ_C1 = 0.8359375f;
+static const float PQ_C2 = 18.8515625f;
+static const float PQ_C3 = 18.6875f;
+static const float PQ_M1 = 0.1593017578125f;
+static const float PQ_M2 = 78.84375f;
+
+// --------------------------------------------------------------------------------------
+// Helpers
+
+static clProfile * tonemapCreateProfilePrimaries(clContext * C,
+                                                 const clProfilePrimaries * primaries,
+                                                 clProfileCurveType curveType,
+                                                 float gamma,
+                                                 int luminance)
+{
+    clProfilePrimaries profilePrimaries = *primaries;
+
+    clProfileCurve curve;
+    curve.type = curveType;
+    curve.gamma = gamma;
+    curve.implicitScale = 1.0f;
+    return clProfileCreate(C, &profilePrimaries, &curve, luminance, NULL);
+}
+
+static clProfile * tonemapCreateProfile(clContext * C, clProfileCurveType curveType, float gamma, int luminance)
+{
+    clProfilePrimaries primaries;
+    clContextGetStockPrimaries(C, "bt709", &primaries);
+    return tonemapCreateProfilePrimaries(C, &primaries, curveType, gamma, luminance);
+}
+
+// 16 bit PQ code -> nits
+static float * tonemapCreatePQTable(void)
+{
+    float * table = (float *)malloc(sizeof(float) * 65536);
+    for (int i = 0; i < 65536; ++i) {
+        float n = powf((float)i / 65535.0f, 1.0f / PQ_M2);
+        float l = fmaxf(n - PQ_C1, 0.0f) / (PQ_C2 - (PQ_C3 * n));
+        table[i] = powf(l, 1.0f / PQ_M1) * 10000.0f;
+    }
+    return table;
+}
+
+// 16 bit linear -> 16 bit gamma 2.2
+static uint16_t * tonemapCreateGammaTable(void)
+{
+    uint16_t * table = (uint16_t *)malloc(sizeof(uint16_t) * 65536);
+    for (int i = 0; i < 65536; ++i) {
+        table[i] = (uint16_t)(powf((float)i / 65535.0f, 1.0f / 2.2f) * 65535.0f + 0.5f);
+    }
+    return table;
+}
+
+// --------------------------------------------------------------------------------------
+// Box filter (separable running sums, clamped windows)
+
+typedef struct BoxFilter
+{
+    const float * src;
+    float * dst; // may alias src
+    float * tmp;
+    int width;
+    int height;
+    int radius;
+} BoxFilter;
+
+static void boxFilterRows(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    BoxFilter * box = (BoxFilter *)userData;
+    const int w = box->width;
+    const int r = box->radius;
+    for (int j = first; j < (first + count); ++j) {
+        const float * src = &box->src[(size_t)j * w];
+        float * tmp = &box->tmp[(size_t)j * w];
+
+        double sum = 0.0;
+        for (int i = 0; (i <= r) && (i < w); ++i) {
+            sum += src[i];
+        }
+        for (int i = 0; i < w; ++i) {
+            const int lo = (i - r > 0) ? (i - r) : 0;
+            const int hi = (i + r < w - 1) ? (i + r) : (w - 1);
+            tmp[i] = (float)(sum / (double)(hi - lo + 1));
+            if ((i + r + 1) < w) {
+                sum += src[i + r + 1];
+            }
+            if ((i - r) >= 0) {
+                sum -= src[i - r];
+            }
+        }
+    }
+}
+
+static void boxFilterColumns(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    BoxFilter * box = (BoxFilter *)userData;
+    const int w = box->width;
+    const int h = box->height;
+    const int r = box->radius;
+
+    // Walk down a band of columns a row at a time, so every access is contiguous
+    double * sums = (double *)calloc(count, sizeof(double));
+    for (int j = 0; (j <= r) && (j < h); ++j) {
+        const float * tmp = &box->tmp[(size_t)j * w + first];
+        for (int i = 0; i < count; ++i) {
+            sums[i] += tmp[i];
+        }
+    }
+    for (int j = 0; j < h; ++j) {
+        const int lo = (j - r > 0) ? (j - r) : 0;
+        const int hi = (j + r < h - 1) ? (j + r) : (h - 1);
+        const double scale = 1.0 / (double)(hi - lo + 1);
+        float * dst = &box->dst[(size_t)j * w + first];
+        for (int i = 0; i < count; ++i) {
+            dst[i] = (float)(sums[i] * scale);
+        }
+        if ((j + r + 1) < h) {
+            const float * add = &box->tmp[(size_t)(j + r + 1) * w + first];
+            for (int i = 0; i < count; ++i) {
+                sums[i] += add[i];
+            }
+        }
+        if ((j - r) >= 0) {
+            const float * sub = &box->tmp[(size_t)(j - r) * w + first];
+            for (int i = 0; i < count; ++i) {
+                sums[i] -= sub[i];
+            }
+        }
+    }
+    free(sums);
+}
+
+static void boxFilter(clContext * C, const float * src, float * dst, float * tmp, int width, int height, int radius)
+{
+    BoxFilter box;
+    box.src = src;
+    box.dst = dst;
+    box.tmp = tmp;
+    box.width = width;
+    box.height = height;
+    box.radius = radius;
+    jobsParallelFor(C, height, boxFilterRows, &box);
+    jobsParallelFor(C, width, boxFilterColumns, &box);
+}
+
+// --------------------------------------------------------------------------------------
+// Local tonemapping
+
+typedef struct LocalTonemap
+{
+    int width;
+    int height;
+    float white; // nits
+    const uint16_t * pq;
+    uint16_t * dst;
+    const float * pqTable;
+    const uint16_t * gammaTable;
+    float * lum;  // log2 relative luminance
+    float * a;    // scratch, ends up as the filtered guided filter slope
+    float * b;    // scratch, ends up as the base layer
+    float edge;
+    float compression;
+    float detail;
+    float anchor; // base level that lands on SDR white
+    float * jobBaseMin;
+    float * jobBaseMax;
+} LocalTonemap;
+
+// The source is decoded a band at a time on the jobs, the only time it's read
+typedef struct LocalTonemapDecode
+{
+    clContext * C;
+    clImage * srcImage;
+    JobsCancel * cancel;
+    clProfile * pqProfile;
+    uint16_t * pq;
+    int width;
+    int height;
+    int * jobFailed;
+} LocalTonemapDecode;
+
+static void localTonemapDecodeBands(void * userData, int jobIndex, int first, int count)
+{
+    LocalTonemapDecode * ld = (LocalTonemapDecode *)userData;
+    clContext * C = jobsCreateContext(ld->C);
+    clProfile * profile = clProfileClone(C, ld->pqProfile);
+    for (int band = first; band < (first + count); ++band) {
+        const int y = band * LOCAL_BAND_ROWS;
+        const int rowCount = ((ld->height - y) < LOCAL_BAND_ROWS) ? (ld->height - y) : LOCAL_BAND_ROWS;
+        clImage * rows = jobsCropRows(C, ld->cancel, ld->srcImage, y, rowCount);
+        clImage * decoded = rows ? clImageConvert(C, rows, 16, profile, CL_TONEMAP_OFF, NULL) : NULL;
+        if (rows) {
+            clImageDestroy(C, rows);
+        }
+        if (!decoded) {
+            ld->jobFailed[jobIndex] = 1;
+            break;
+        }
+        clImagePrepareReadPixels(C, decoded, CL_PIXELFORMAT_U16);
+        memcpy(&ld->pq[(size_t)y * ld->width * 4], decoded->pixelsU16, sizeof(uint16_t) * 4 * ld->width * rowCount);
+        clImageDestroy(C, decoded);
+    }
+    clProfileDestroy(C, profile);
+    clContextDestroy(C);
+}
+
+static void localTonemapLuminance(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    LocalTonemap * lt = (LocalTonemap *)userData;
+    for (size_t p = (size_t)first * lt->width; p < (size_t)(first + count) * lt->width; ++p) {
+        const uint16_t * pixel = &lt->pq[p * 4];
+        float Y = 0.2126f * lt->pqTable[pixel[0]] + 0.7152f * lt->pqTable[pixel[1]] + 0.0722f * lt->pqTable[pixel[2]];
+        float l = log2f(fmaxf(Y / lt->white, MIN_RELATIVE_LUMINANCE));
+        lt->lum[p] = l;
+        lt->a[p] = l * l;
+    }
+}
+
+static void localTonemapCoefficients(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    // a holds mean(I^2) and b holds mean(I) on the way in
+    LocalTonemap * lt = (LocalTonemap *)userData;
+    for (size_t p = (size_t)first * lt->width; p < (size_t)(first + count) * lt->width; ++p) {
+        float mean = lt->b[p];
+        float variance = fmaxf(lt->a[p] - (mean * mean), 0.0f);
+        float a = variance / (variance + lt->edge);
+        lt->a[p] = a;
+        lt->b[p] = mean - (a * mean);
+    }
+}
+
+static void localTonemapBase(void * userData, int jobIndex, int first, int count)
+{
+    LocalTonemap * lt = (LocalTonemap *)userData;
+    float baseMin = FLT_MAX;
+    float baseMax = -FLT_MAX;
+    for (size_t p = (size_t)first * lt->width; p < (size_t)(first + count) * lt->width; ++p) {
+        float base = (lt->a[p] * lt->lum[p]) + lt->b[p];
+        lt->b[p] = base;
+        baseMin = fminf(baseMin, base);
+        baseMax = fmaxf(baseMax, base);
+    }
+    lt->jobBaseMin[jobIndex] = baseMin;
+    lt->jobBaseMax[jobIndex] = baseMax;
+}
+
+static void localTonemapApply(void * userData, int jobIndex, int first, int count)
+{
+    (void)jobIndex;
+
+    LocalTonemap * lt = (LocalTonemap *)userData;
+    for (size_t p = (size_t)first * lt->width; p < (size_t)(first + count) * lt->width; ++p) {
+        const float l = lt->lum[p];
+        const float base = lt->b[p];
+        const float outLog = ((base - lt->anchor) * lt->compression) + ((l - base) * lt->detail);
+        const float scale = exp2f(outLog - l) / lt->white;
+
+        const uint16_t * src = &lt->pq[p * 4];
+        uint16_t * dst = &lt->dst[p * 4];
+        for (int c = 0; c < 3; ++c) {
+            float v = CL_CLAMP(lt->pqTable[src[c]] * scale, 0.0f, 1.0f);
+            dst[c] = lt->gammaTable[(int)(v * 65535.0f + 0.5f)];
+        }
+        dst[3] = src[3];
+    }
+}
+
+void tonemapLocalParamsSetDefaults(LocalTonemapParams * params)
+{
+    params->compression = 5.0f;
+    params->detail = 1.0f;
+    params->radius = 2.0f;
+    params->edge = 0.1f;
+}
+
+clImage * tonemapLocal(clContext * C, clImage * srcImage, const LocalTonemapParams * params, int dstLuminance, JobsCancel * cancel)
+{
+    if (!jobsReadBegin(cancel)) {
+        return NULL;
+    }
+    const int width = srcImage->width;
+    const int height = srcImage->height;
+    clImagePrepareReadPixels(C, srcImage, (srcImage->depth > 8) ? CL_PIXELFORMAT_U16 : CL_PIXELFORMAT_U8);
+    jobsReadEnd(cancel);
+
+    // PQ keeps shadow precision at 16 bits without knowing the source's peak
+    const int jobs = jobsCount(C);
+    uint16_t * pq = (uint16_t *)malloc(sizeof(uint16_t) * 4 * (size_t)width * height);
+    LocalTonemapDecode ld;
+    ld.C = C;
+    ld.srcImage = srcImage;
+    ld.cancel = cancel;
+    ld.pqProfile = tonemapCreateProfile(C, CL_PCT_PQ, 1.0f, 10000);
+    ld.pq = pq;
+    ld.width = width;
+    ld.height = height;
+    ld.jobFailed = (int *)calloc(jobs, sizeof(int));
+    jobsParallelFor(C, (height + LOCAL_BAND_ROWS - 1) / LOCAL_BAND_ROWS, localTonemapDecodeBands, &ld);
+    int failed = 0;
+    for (int j = 0; j < jobs; ++j) {
+        failed |= ld.jobFailed[j];
+    }
+    free(ld.jobFailed);
+    clProfileDestroy(C, ld.pqProfile);
+    if (failed) {
+        free(pq);
+        return NULL;
+    }
+
+    const size_t pixelCount = (size_t)width * (size_t)height;
+    const int shorterSide = (width < height) ? width : height;
+    int radius = (int)((float)shorterSide * params->radius / 100.0f + 0.5f);
+    if (radius < 1) {
+        radius = 1;
+    }
+
+    clProfile * dstProfile = tonemapCreateProfile(C, CL_PCT_GAMMA, 2.2f, dstLuminance);
+    clImage * dstImage = clImageCreate(C, width, height, 16, dstProfile);
+    clProfileDestroy(C, dstProfile);
+    clImagePrepareWritePixels(C, dstImage, CL_PIXELFORMAT_U16);
+
+    LocalTonemap lt;
+    memset(&lt, 0, sizeof(lt));
+    lt.width = width;
+    lt.height = height;
+    lt.white = (float)dstLuminance;
+    lt.pq = pq;
+    lt.dst = dstImage->pixelsU16;
+    lt.pqTable = tonemapCreatePQTable();
+    lt.gammaTable = tonemapCreateGammaTable();
+    lt.lum = (float *)malloc(sizeof(float) * pixelCount);
+    lt.a = (float *)malloc(sizeof(float) * pixelCount);
+    lt.b = (float *)malloc(sizeof(float) * pixelCount);
+    lt.edge = fmaxf(params->edge, 0.0001f);
+    lt.detail = params->detail;
+    float * tmp = (float *)malloc(sizeof(float) * pixelCount);
+
+    lt.jobBaseMin = (float *)malloc(sizeof(float) * jobs);
+    lt.jobBaseMax = (float *)malloc(sizeof(float) * jobs);
+    for (int i = 0; i < jobs; ++i) {
+        lt.jobBaseMin[i] = FLT_MAX;
+        lt.jobBaseMax[i] = -FLT_MAX;
+    }
+
+    // Self-guided filter on log luminance (He et al.), the output is the base layer. A cancel
+    // is picked up between passes.
+    jobsParallelFor(C, height, localTonemapLuminance, &lt);
+    boxFilter(C, lt.lum, lt.b, tmp, width, height, radius);
+    boxFilter(C, lt.a, lt.a, tmp, width, height, radius);
+    if (!jobsCancelled(cancel)) {
+        jobsParallelFor(C, height, localTonemapCoefficients, &lt);
+        boxFilter(C, lt.a, lt.a, tmp, width, height, radius);
+        boxFilter(C, lt.b, lt.b, tmp, width, height, radius);
+    }
+    if (!jobsCancelled(cancel)) {
+        jobsParallelFor(C, height, localTonemapBase, &lt);
+
+        float baseMin = FLT_MAX;
+        float baseMax = -FLT_MAX;
+        for (int i = 0; i < jobs; ++i) {
+            baseMin = fminf(baseMin, lt.jobBaseMin[i]);
+            baseMax = fmaxf(baseMax, lt.jobBaseMax[i]);
+        }
+        baseMin = fmaxf(baseMin, baseMax - MAX_BASE_RANGE);
+        lt.anchor = fmaxf(baseMax, 0.0f); // don't brighten images that already fit under white
+        lt.compression = 1.0f;
+        if ((baseMax - baseMin) > params->compression) {
+            lt.compression = params->compression / (baseMax - baseMin);
+        }
+        jobsParallelFor(C, height, localTonemapApply, &lt);
+    }
+
+    free(lt.jobBaseMin);
+    free(lt.jobBaseMax);
+    free(tmp);
+    free(lt.b);
+    free(lt.a);
+    free(lt.lum);
+    free((void *)lt.gammaTable);
+    free((void *)lt.pqTable);
+    free(pq);
+    if (jobsCancelled(cancel)) {
+        clImageDestroy(C, dstImage);
+        return NULL;
+    }
+    return dstImage;
+}
+
+// --------------------------------------------------------------------------------------
+// Parameter fitting
+
+// Histogram of log2(nits)
+#define FIT_HISTOGRAM_MIN_STOP -12
+#define FIT_HISTOGRAM_MAX_STOP 14
+#define FIT_HISTOGRAM_BINS_PER_STOP 8
+#define FIT_HISTOGRAM_BINS ((FIT_HISTOGRAM_MAX_STOP - FIT_HISTOGRAM_MIN_STOP) * FIT_HISTOGRAM_BINS_PER_STOP)
+
+// Largest image the histogram is taken from, bigger sources are box downsampled first
+static const int FIT_PROXY_SIZE = 1024;
+
+// Slider range of every clTonemapParams field
+static const float FIT_PARAM_MIN = 0.001f;
+static const float FIT_PARAM_MAX = 2.0f;
+
+// Targets, relative to SDR white
+static const float FIT_HIGHLIGHT_TARGET = 0.9f;
+static const float FIT_MIDGREY_TARGET = 0.18f;
+static const float FIT_CLIP_LEVEL = 0.999f;
+
+typedef struct FitHistogram
+{
+    const uint16_t * pq;
+    int width;
+    const float * pqTable;
+    double (*jobCounts)[FIT_HISTOGRAM_BINS];
+    double * jobLogSums;
+} FitHistogram;
+
+static float fitBinNits(int bin)
+{
+    return exp2f((float)FIT_HISTOGRAM_MIN_STOP + ((float)bin + 0.5f) / (float)FIT_HISTOGRAM_BINS_PER_STOP);
+}
+
+static void fitHistogramRows(void * userData, int jobIndex, int first, int count)
+{
+    FitHistogram * fh = (FitHistogram *)userData;
+    double * counts = fh->jobCounts[jobIndex];
+    double logSum = 0.0;
+    for (size_t p = (size_t)first * fh->width; p < (size_t)(first + count) * fh->width; ++p) {
+        const uint16_t * pixel = &fh->pq[p * 4];
+        float Y = 0.2126f * fh->pqTable[pixel[0]] + 0.7152f * fh->pqTable[pixel[1]] + 0.0722f * fh->pqTable[pixel[2]];
+        float stops = log2f(fmaxf(Y, exp2f((float)FIT_HISTOGRAM_MIN_STOP)));
+        int bin = (int)((stops - (float)FIT_HISTOGRAM_MIN_STOP) * (float)FIT_HISTOGRAM_BINS_PER_STOP);
+        bin = CL_CLAMP(bin, 0, FIT_HISTOGRAM_BINS - 1);
+        counts[bin] += 1.0;
+        logSum += stops;
+    }
+    fh->jobLogSums[jobIndex] = logSum;
+}
+
+typedef struct FitTarget
+{
+    double counts[FIT_HISTOGRAM_BINS];
+    double total;
+    int highlightBin; // P99
+    int midBin;       // log-average
+    clImage * ramp;   // one pixel per bin, linear at the source's luminance
+    clProfile * dstProfile;
+    float curve[FIT_HISTOGRAM_BINS];
+} FitTarget;
+
+static float fitEvaluate(clContext * C, FitTarget * target, clTonemapParams * params)
+{
+    clImage * out = clImageConvert(C, target->ramp, 16, target->dstProfile, CL_TONEMAP_ON, params);
+    if (!out) {
+        return FLT_MAX;
+    }
+    clImagePrepareReadPixels(C, out, CL_PIXELFORMAT_U16);
+    for (int i = 0; i < FIT_HISTOGRAM_BINS; ++i) {
+        target->curve[i] = (float)out->pixelsU16[(i * 4) + 1] / 65535.0f;
+    }
+    clImageDestroy(C, out);
+
+    double clipped = 0.0;
+    for (int i = 0; i < FIT_HISTOGRAM_BINS; ++i) {
+        if (target->curve[i] >= FIT_CLIP_LEVEL) {
+            clipped += target->counts[i];
+        }
+    }
+    clipped /= target->total;
+
+    float highlightError = target->curve[target->highlightBin] - FIT_HIGHLIGHT_TARGET;
+    float midError = log2f(fmaxf(target->curve[target->midBin], 1.0f / 65535.0f) / FIT_MIDGREY_TARGET);
+    return (4.0f * highlightError * highlightError) + (0.25f * midError * midError) + (2.0f * (float)clipped);
+}
+
+static float * fitParam(clTonemapParams * params, int index)
+{
+    switch (index) {
+        case 0:
+            return &params->contrast;
+        case 1:
+            return &params->clipPoint;
+        case 2:
+            return &params->speed;
+        default:
+            return &params->power;
+    }
+}
+
+int tonemapFitHistogram(clContext * C, clImage * srcImage, int dstLuminance, clTonemapParams * params)
+{
+    int srcLuminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, srcImage->profile, NULL, NULL, &srcLuminance);
+    if (srcLuminance == CL_LUMINANCE_UNSPECIFIED) {
+        srcLuminance = C->defaultLuminance;
+    }
+    if (srcLuminance <= dstLuminance) {
+        return 0;
+    }
+
+    // Histogram pass
+    clImage * proxy = prepareCreateProxy(C, srcImage, FIT_PROXY_SIZE, FIT_PROXY_SIZE);
+    clProfile * pqProfile = tonemapCreateProfile(C, CL_PCT_PQ, 1.0f, 10000);
+    clImage * pqImage = clImageConvert(C, proxy ? proxy : srcImage, 16, pqProfile, CL_TONEMAP_OFF, NULL);
+    clProfileDestroy(C, pqProfile);
+    if (proxy) {
+        clImageDestroy(C, proxy);
+    }
+    if (!pqImage) {
+        return 0;
+    }
+    clImagePrepareReadPixels(C, pqImage, CL_PIXELFORMAT_U16);
+
+    const int jobs = jobsCount(C);
+    FitHistogram fh;
+    fh.pq = pqImage->pixelsU16;
+    fh.width = pqImage->width;
+    fh.pqTable = tonemapCreatePQTable();
+    fh.jobCounts = (double(*)[FIT_HISTOGRAM_BINS])calloc(jobs, sizeof(double[FIT_HISTOGRAM_BINS]));
+    fh.jobLogSums = (double *)calloc(jobs, sizeof(double));
+    jobsParallelFor(C, pqImage->height, fitHistogramRows, &fh);
+
+    FitTarget * target = (FitTarget *)calloc(1, sizeof(FitTarget));
+    double logSum = 0.0;
+    for (int j = 0; j < jobs; ++j) {
+        for (int i = 0; i < FIT_HISTOGRAM_BINS; ++i) {
+            target->counts[i] += fh.jobCounts[j][i];
+        }
+        logSum += fh.jobLogSums[j];
+    }
+    target->total = (double)pqImage->width * (double)pqImage->height;
+    free(fh.jobCounts);
+    free(fh.jobLogSums);
+    free((void *)fh.pqTable);
+    clImageDestroy(C, pqImage);
+
+    double running = 0.0;
+    target->highlightBin = FIT_HISTOGRAM_BINS - 1;
+    for (int i = 0; i < FIT_HISTOGRAM_BINS; ++i) {
+        running += target->counts[i];
+        if (running >= (target->total * 0.99)) {
+            target->highlightBin = i;
+            break;
+        }
+    }
+    float logAverage = (float)(logSum / target->total);
+    target->midBin = (int)((logAverage - (float)FIT_HISTOGRAM_MIN_STOP) * (float)FIT_HISTOGRAM_BINS_PER_STOP);
+    target->midBin = CL_CLAMP(target->midBin, 0, FIT_HISTOGRAM_BINS - 1);
+
+    // One ramp pixel per histogram bin, so a single small conversion samples the whole curve
+    clProfile * srcProfile = tonemapCreateProfile(C, CL_PCT_GAMMA, 1.0f, srcLuminance);
+    target->ramp = clImageCreate(C, FIT_HISTOGRAM_BINS, 1, 16, srcProfile);
+    clProfileDestroy(C, srcProfile);
+    clImagePrepareWritePixels(C, target->ramp, CL_PIXELFORMAT_U16);
+    for (int i = 0; i < FIT_HISTOGRAM_BINS; ++i) {
+        float v = CL_CLAMP(fitBinNits(i) / (float)srcLuminance, 0.0f, 1.0f);
+        uint16_t * pixel = &target->ramp->pixelsU16[i * 4];
+        pixel[0] = pixel[1] = pixel[2] = (uint16_t)(v * 65535.0f + 0.5f);
+        pixel[3] = 65535;
+    }
+    target->dstProfile = tonemapCreateProfile(C, CL_PCT_GAMMA, 1.0f, dstLuminance);
+
+    // Coordinate descent over the four curve parameters, halving the step each round
+    clTonemapParams best = *params;
+    float bestError = fitEvaluate(C, target, &best);
+    for (float step = 0.25f; step >= 0.005f; step *= 0.5f) {
+        int improved = 1;
+        while (improved) {
+            improved = 0;
+            for (int f = 0; f < 4; ++f) {
+                for (int direction = -1; direction <= 1; direction += 2) {
+                    clTonemapParams candidate = best;
+                    float * field = fitParam(&candidate, f);
+                    *field = CL_CLAMP(*field + (step * (float)direction), FIT_PARAM_MIN, FIT_PARAM_MAX);
+                    float error = fitEvaluate(C, target, &candidate);
+                    if (error < bestError) {
+                        bestError = error;
+                        best = candidate;
+                        improved = 1;
+                    }
+                }
+            }
+        }
+    }
+    *params = best;
+
+    clProfileDestroy(C, target->dstProfile);
+    clImageDestroy(C, target->ramp);
+    free(target);
+    return 1;
+}
+
+// --------------------------------------------------------------------------------------
+// Reference fitting
+
+// Longest side of the (box filtered) sample grid both images are reduced to
+static const int REFERENCE_SAMPLE_SIZE = 128;
+
+// Random candidates over the full ranges, then rounds of candidates around the best so far
+static const int REFERENCE_SEARCH_CANDIDATES = 1024;
+static const int REFERENCE_REFINE_CANDIDATES = 256;
+static const int REFERENCE_REFINE_ROUNDS = 6;
+
+// Each worker has its own context (and copy of the samples), colorist contexts aren't shared
+typedef struct ReferenceWorker
+{
+    clContext * C;
+    clImage * samples;
+} ReferenceWorker;
+
+typedef struct ReferenceCandidate
+{
+    clTonemapParams params;
+    int luminance;
+    float deltaE; // mean CIE76
+} ReferenceCandidate;
+
+typedef struct ReferenceFit
+{
+    ReferenceWorker * workers;
+    ReferenceCandidate * candidates;
+    const float * referenceLab;
+    int sampleCount;
+} ReferenceFit;
+
+// Linear BT.709 (relative to SDR white) -> CIELAB, D65
+static void referenceLinearToLab(const float rgb[3], float lab[3])
+{
+    static const float whiteX = 0.95047f;
+    static const float whiteZ = 1.08883f;
+    float xyz[3];
+    xyz[0] = ((0.4124f * rgb[0]) + (0.3576f * rgb[1]) + (0.1805f * rgb[2])) / whiteX;
+    xyz[1] = (0.2126f * rgb[0]) + (0.7152f * rgb[1]) + (0.0722f * rgb[2]);
+    xyz[2] = ((0.0193f * rgb[0]) + (0.1192f * rgb[1]) + (0.9505f * rgb[2])) / whiteZ;
+    for (int i = 0; i < 3; ++i) {
+        xyz[i] = (xyz[i] > 0.008856f) ? cbrtf(xyz[i]) : ((7.787f * xyz[i]) + (16.0f / 116.0f));
+    }
+    lab[0] = (116.0f * xyz[1]) - 16.0f;
+    lab[1] = 500.0f * (xyz[0] - xyz[1]);
+    lab[2] = 200.0f * (xyz[1] - xyz[2]);
+}
+
+static float * referenceCreateLab(const uint16_t * pixels, int sampleCount)
+{
+    float * lab = (float *)malloc(sizeof(float) * 3 * sampleCount);
+    for (int i = 0; i < sampleCount; ++i) {
+        const uint16_t * pixel = &pixels[i * 4];
+        float rgb[3] = { (float)pixel[0] / 65535.0f, (float)pixel[1] / 65535.0f, (float)pixel[2] / 65535.0f };
+        referenceLinearToLab(rgb, &lab[i * 3]);
+    }
+    return lab;
+}
+
+static void referenceEvaluate(void * userData, int jobIndex, int first, int count)
+{
+    ReferenceFit * fit = (ReferenceFit *)userData;
+    ReferenceWorker * worker = &fit->workers[jobIndex];
+    for (int c = first; c < first + count; ++c) {
+        ReferenceCandidate * candidate = &fit->candidates[c];
+        candidate->deltaE = FLT_MAX;
+
+        clProfile * profile = tonemapCreateProfile(worker->C, CL_PCT_GAMMA, 1.0f, candidate->luminance);
+        clImage * out = clImageConvert(worker->C, worker->samples, 16, profile, CL_TONEMAP_AUTO, &candidate->params);
+        clProfileDestroy(worker->C, profile);
+        if (!out) {
+            continue;
+        }
+
+        clImagePrepareReadPixels(worker->C, out, CL_PIXELFORMAT_U16);
+        double total = 0.0;
+        for (int i = 0; i < fit->sampleCount; ++i) {
+            const uint16_t * pixel = &out->pixelsU16[i * 4];
+            const float * ref = &fit->referenceLab[i * 3];
+            float rgb[3] = { (float)pixel[0] / 65535.0f, (float)pixel[1] / 65535.0f, (float)pixel[2] / 65535.0f };
+            float lab[3];
+            referenceLinearToLab(rgb, lab);
+            float dL = lab[0] - ref[0];
+            float da = lab[1] - ref[1];
+            float db = lab[2] - ref[2];
+            total += sqrtf((dL * dL) + (da * da) + (db * db));
+        }
+        candidate->deltaE = (float)(total / (double)fit->sampleCount);
+        clImageDestroy(worker->C, out);
+    }
+}
+
+// xorshift32, so every search is repeatable
+static float referenceRandom(uint32_t * state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)(x >> 8) / (float)(1 << 24);
+}
+
+static const ReferenceCandidate * referenceSearch(clContext * C, ReferenceFit * fit, int count)
+{
+    jobsParallelFor(C, count, referenceEvaluate, fit);
+
+    const ReferenceCandidate * best = &fit->candidates[0];
+    for (int i = 1; i < count; ++i) {
+        if (fit->candidates[i].deltaE < best->deltaE) {
+            best = &fit->candidates[i];
+        }
+    }
+    return best;
+}
+
+// Samples the image down to the sample grid, then converts it to 16 bit in the given profile
+static clImage * referenceCreateSamples(clContext * C, clImage * image, clProfile * profile)
+{
+    clImage * samples = prepareCreateProxy(C, image, REFERENCE_SAMPLE_SIZE, REFERENCE_SAMPLE_SIZE);
+    clImage * converted = clImageConvert(C, samples ? samples : image, 16, profile, CL_TONEMAP_OFF, NULL);
+    if (samples) {
+        clImageDestroy(C, samples);
+    }
+    if (converted) {
+        clImagePrepareReadPixels(C, converted, CL_PIXELFORMAT_U16);
+    }
+    return converted;
+}
+
+int tonemapFitReference(clContext * C,
+                        clImage * hdrImage,
+                        clImage * sdrImage,
+                        int minLuminance,
+                        int maxLuminance,
+                        clTonemapParams * params,
+                        int * luminance,
+                        float * deltaE)
+{
+    if ((hdrImage->width != sdrImage->width) || (hdrImage->height != sdrImage->height)) {
+        return 0;
+    }
+
+    clProfilePrimaries hdrPrimaries;
+    int hdrLuminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, hdrImage->profile, &hdrPrimaries, NULL, &hdrLuminance);
+    if (hdrLuminance == CL_LUMINANCE_UNSPECIFIED) {
+        hdrLuminance = C->defaultLuminance;
+    }
+    int sdrLuminance = CL_LUMINANCE_UNSPECIFIED;
+    clProfileQuery(C, sdrImage->profile, NULL, NULL, &sdrLuminance);
+    if (sdrLuminance == CL_LUMINANCE_UNSPECIFIED) {
+        sdrLuminance = C->defaultLuminance;
+    }
+
+    // HDR samples keep their primaries and luminance so colorist tonemaps them as it would the
+    // image itself. Gamma 2.2 keeps the shadows precise in 16 bits.
+    clProfile * hdrProfile = tonemapCreateProfilePrimaries(C, &hdrPrimaries, CL_PCT_GAMMA, 2.2f, hdrLuminance);
+    clImage * hdrSamples = referenceCreateSamples(C, hdrImage, hdrProfile);
+    clProfileDestroy(C, hdrProfile);
+
+    // The reference is compared relative to its own white, in linear BT.709
+    clProfile * sdrProfile = tonemapCreateProfile(C, CL_PCT_GAMMA, 1.0f, sdrLuminance);
+    clImage * sdrSamples = referenceCreateSamples(C, sdrImage, sdrProfile);
+    clProfileDestroy(C, sdrProfile);
+
+    if (!hdrSamples || !sdrSamples) {
+        if (hdrSamples) {
+            clImageDestroy(C, hdrSamples);
+        }
+        if (sdrSamples) {
+            clImageDestroy(C, sdrSamples);
+        }
+        return 0;
+    }
+
+    ReferenceFit fit;
+    fit.sampleCount = hdrSamples->width * hdrSamples->height;
+    fit.referenceLab = referenceCreateLab(sdrSamples->pixelsU16, fit.sampleCount);
+    clImageDestroy(C, sdrSamples);
+
+    const int jobs = jobsCount(C);
+    fit.workers = (ReferenceWorker *)calloc(jobs, sizeof(ReferenceWorker));
+    for (int j = 0; j < jobs; ++j) {
+        ReferenceWorker * worker = &fit.workers[j];
+        worker->C = jobsCreateContext(C); // parallel across candidates instead
+        clProfile * profile = tonemapCreateProfilePrimaries(worker->C, &hdrPrimaries, CL_PCT_GAMMA, 2.2f, hdrLuminance);
+        worker->samples = clImageCreate(worker->C, hdrSamples->width, hdrSamples->height, 16, profile);
+        clProfileDestroy(worker->C, profile);
+        clImagePrepareWritePixels(worker->C, worker->samples, CL_PIXELFORMAT_U16);
+        memcpy(worker->samples->pixelsU16, hdrSamples->pixelsU16, sizeof(uint16_t) * 4 * fit.sampleCount);
+    }
+    clImageDestroy(C, hdrSamples);
+
+    fit.candidates = (ReferenceCandidate *)calloc(REFERENCE_SEARCH_CANDIDATES, sizeof(ReferenceCandidate));
+
+    // Luminance is searched in stops
+    const float minStops = log2f((float)minLuminance);
+    const float maxStops = log2f((float)maxLuminance);
+    uint32_t seed = 0x9e3779b9;
+
+    // Full range search, the current values are always a candidate
+    ReferenceCandidate best;
+    best.params = *params;
+    best.luminance = CL_CLAMP(*luminance, minLuminance, maxLuminance);
+    fit.candidates[0] = best;
+    for (int i = 1; i < REFERENCE_SEARCH_CANDIDATES; ++i) {
+        ReferenceCandidate * candidate = &fit.candidates[i];
+        for (int f = 0; f < 4; ++f) {
+            *fitParam(&candidate->params, f) = FIT_PARAM_MIN + ((FIT_PARAM_MAX - FIT_PARAM_MIN) * referenceRandom(&seed));
+        }
+        candidate->luminance = (int)(exp2f(minStops + ((maxStops - minStops) * referenceRandom(&seed))) + 0.5f);
+    }
+    best = *referenceSearch(C, &fit, REFERENCE_SEARCH_CANDIDATES);
+
+    // Refine around the best, halving the neighborhood each round
+    float radius = 0.25f;
+    for (int round = 0; round < REFERENCE_REFINE_ROUNDS; ++round) {
+        fit.candidates[0] = best;
+        for (int i = 1; i < REFERENCE_REFINE_CANDIDATES; ++i) {
+            ReferenceCandidate * candidate = &fit.candidates[i];
+            candidate->params = best.params;
+            for (int f = 0; f < 4; ++f) {
+                float * value = fitParam(&candidate->params, f);
+                float offset = radius * (FIT_PARAM_MAX - FIT_PARAM_MIN) * ((referenceRandom(&seed) * 2.0f) - 1.0f);
+                *value = CL_CLAMP(*value + offset, FIT_PARAM_MIN, FIT_PARAM_MAX);
+            }
+            float stops = log2f((float)best.luminance);
+            stops += radius * (maxStops - minStops) * ((referenceRandom(&seed) * 2.0f) - 1.0f);
+            stops = CL_CLAMP(stops, minStops, maxStops);
+            candidate->luminance = (int)(exp2f(stops) + 0.5f);
+        }
+        best = *referenceSearch(C, &fit, REFERENCE_REFINE_CANDIDATES);
+        radius *= 0.5f;
+    }
+
+    for (int j = 0; j < jobs; ++j) {
+        clImageDestroy(fit.workers[j].C, fit.workers[j].samples);
+        clContextDestroy(fit.workers[j].C);
+    }
+    free(fit.workers);
+    free(fit.candidates);
+    free((void *)fit.referenceLab);
+
+    if (best.deltaE == FLT_MAX) {
+        return 0;
+    }
+    *params = best.params;
+    *luminance = best.luminance;
+    *deltaE = best.deltaE;
+    return 1;
+}
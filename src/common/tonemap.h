@@ -0,0 +1,59 @@
+#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "colorist/colorist.h"
+#include "jobs.h"
+
+typedef enum TonemapMode
+{
+    TONEMAPMODE_GLOBAL = 0, // colorist's per-pixel curve (clTonemapParams)
+    TONEMAPMODE_LOCAL       // base/detail decomposition, see tonemapLocal()
+} TonemapMode;
+
+// Parameters for the local operator. Floats are driven by CONTROLFLAG_FLOAT sliders.
+typedef struct LocalTonemapParams
+{
+    float compression; // stops of large scale (base) contrast kept
+    float detail;      // gain on small scale (detail) contrast, 1 keeps it unchanged
+    float radius;      // base filter radius, in percent of the image's shorter side
+    float edge;        // guided filter epsilon (log2 luminance squared), lower keeps edges sharper
+} LocalTonemapParams;
+
+void tonemapLocalParamsSetDefaults(LocalTonemapParams * params);
+
+// Tonemaps srcImage for SDR output with a self-guided filter on log luminance: the smooth base
+// layer is compressed to params->compression stops (brightest base at dstLuminance) and the
+// detail layer is kept. Jobs decode the source a band at a time. Returns a BT.709 gamma 2.2 image
+// at dstLuminance, or NULL if decoding failed or cancel (which may be NULL) was set.
+clImage * tonemapLocal(clContext * C, clImage * srcImage, const LocalTonemapParams * params, int dstLuminance, JobsCancel * cancel);
+
+// Fits params (starting from their current values) so that colorist's curve keeps srcImage's P99
+// luminance just under SDR white, lands the log-average on mid grey and clips as little as
+// possible. Works on a log luminance histogram of a downsampled copy, and samples the real curve
+// by converting a small ramp per candidate. Returns 0 (params untouched) if dstLuminance wouldn't
+// tonemap srcImage at all.
+int tonemapFitHistogram(clContext * C, clImage * srcImage, int dstLuminance, clTonemapParams * params);
+
+// Searches params and luminance (within [minLuminance, maxLuminance]) for the global tonemap of
+// hdrImage that best reproduces sdrImage, a same sized SDR grade. Both images are box sampled down
+// to a small grid and compared by mean CIE76 delta E, relative to each one's SDR white. Candidates
+// are evaluated in parallel. On success the best fit and its delta E are returned through the
+// pointers (params and luminance also seed the search).
+int tonemapFitReference(clContext * C,
+                        clImage * hdrImage,
+                        clImage * sdrImage,
+                        int minLuminance,
+                        int maxLuminance,
+                        clTonemapParams * params,
+                        int * luminance,
+                        float * deltaE);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -42,6 +42,14 @@ static const int SRGB_LUMINANCE_DEF = 80;
 static const int SRGB_LUMINANCE_MAX = 1000;
 static const int SRGB_LUMINANCE_STEP = 5;
 
+// Seconds each image stays on screen while flickering
+static const double FLICKER_INTERVAL = 0.5;
+
+// Exposure slider (EV, in thousandths)
+static const int EXPOSURE_MIN = -6000;
+static const int EXPOSURE_MAX = 6000;
+static const int EXPOSURE_STEP = 100;
+
 // --------------------------------------------------------------------------------------
 // SMPTE ST.2084: https://ieeexplore.ieee.org/servlet/opac?punumber=7291450
 
@@ -79,6 +87,9 @@ static void controlInitSlider(Control * control, int * value, int min, int max,
 // Forward declarations for statics
 
 static void vantageUpdateCIEBackground(Vantage * V, clProfile * profile);
+static void vantagePrepareCurrentMode(Vantage * V);
+static int vantageDiffLevel(Vantage * V);
+static void vantageCreateDiff(Vantage * V);
 
 // --------------------------------------------------------------------------------------
 // Creation / destruction
@@ -104,20 +115,60 @@ Vantage * vantageCreate(void)
     V->diffMode_ = DIFFMODE_SHOWDIFF;
     V->diffIntensity_ = DIFFINTENSITY_BRIGHT;
     V->diffThreshold_ = 0;
+    V->flicker_ = 0;
+    V->flickerStart_ = 0.0;
     V->srgbHighlight_ = 0;
     V->srgbLuminance_ = SRGB_LUMINANCE_DEF;
     V->unspecLuminance_ = SRGB_LUMINANCE_DEF;
+    V->exposure_ = 0.0f;
 
     V->image_ = NULL;
     V->image2_ = NULL;
+    V->gainMap_ = NULL;
+    V->gainMapApplied_ = NULL;
+    V->gainMapHeadroom_ = 0.0f;
+    V->gainMapLuminance_ = 0;
     V->forcedProfile_ = NULL;
     V->imageFont_ = NULL;
     V->imageCIEBackground_ = NULL;
     V->imageCIECrosshair_ = NULL;
     V->imageDiff_ = NULL;
+    V->diffLevel_ = -1;
+    V->diffMetrics_ = NULL;
+    V->diffRegions_ = NULL;
+    V->diffRegionIndex_ = -1;
+    V->sequenceDiff_ = NULL;
     V->imageHighlight_ = NULL;
+    V->localTonemapped_ = NULL;
+    V->localTonemappedSource_ = NULL;
+    V->localTonemappedGamut_ = 0;
+    V->localTonemappedLuminance_ = 0;
+    memset(&V->localTonemappedParams_, 0, sizeof(V->localTonemappedParams_));
+    V->gamutCompressed_ = NULL;
+    V->gamutCompressedSource_ = NULL;
     V->preparedImage_ = NULL;
-    V->highlightInfo_ = NULL;
+    V->prepareTask_ = NULL;
+    V->abandonedPrepares_ = NULL;
+    memset(&V->prepareStages_, 0, sizeof(V->prepareStages_));
+    V->prepareStagesSource_ = NULL;
+    V->prepareStagesGamut_ = 0;
+    V->preparedFormat_ = PREPAREDFORMAT_RGBA16;
+    V->preparedSerial_ = 0;
+    V->preparedSerialNext_ = 0;
+    memset(V->preparedSlots_, 0, sizeof(V->preparedSlots_));
+    V->highlightPlanes_ = NULL;
+    V->highlightProxyPlanes_ = NULL;
+    V->highlightLuminance_ = 0;
+    V->prepareLive_ = 0;
+    V->highlightSource_ = NULL;
+    V->highlightPixelX_ = -1;
+    V->highlightPixelY_ = -1;
+    V->shownSource_ = NULL;
+    memset(&V->lightLevels_, 0, sizeof(V->lightLevels_));
+    V->lightLevelsValid_ = 0;
+    V->lightLevelsTask_ = NULL;
+    memset(&V->imageCLLI_, 0, sizeof(V->imageCLLI_));
+    memset(&V->imageCLLI2_, 0, sizeof(V->imageCLLI2_));
 
     V->dragging_ = 0;
     V->dragLastX_ = 0;
@@ -134,9 +185,15 @@ Vantage * vantageCreate(void)
     V->imageInfoY_ = -1;
     V->imageLuminance_ = CL_LUMINANCE_UNSPECIFIED;
     V->imageDirty_ = 0;
+    V->imageCIEBackgroundDirty_ = 0;
+    V->preparedUnspecLuminance_ = 0;
     V->imageVideoFrameNextIndex_ = 0;
     V->imageVideoFrameIndex_ = 0;
     V->imageVideoFrameCount_ = 0;
+    V->timelineX_ = 0;
+    V->timelineY_ = 0;
+    V->timelineW_ = 0;
+    V->timelineH_ = 0;
 
     // Setup tonemapping for SDR mode (default values here are completely subjective)
     clTonemapParamsSetDefaults(V->C, &V->preparedTonemap_);
@@ -152,6 +209,16 @@ Vantage * vantageCreate(void)
                       SRGB_LUMINANCE_STEP,
                       CONTROLFLAG_PREPARE);
     V->tonemapSlidersEnabled_ = 0;
+    V->gamutMode_ = GAMUTMODE_CLIP;
+    V->tonemapAuto_ = 0;
+    V->tonemapAutoSource_ = NULL;
+    V->tonemapAutoGamut_ = 0;
+    V->tonemapMode_ = TONEMAPMODE_GLOBAL;
+    tonemapLocalParamsSetDefaults(&V->localTonemap_);
+    controlInitSlider(&V->localTonemapCompressionSlider_, (int *)&V->localTonemap_.compression, 1000, 16000, 250, CONTROLFLAG_PREPARE | CONTROLFLAG_FLOAT);
+    controlInitSlider(&V->localTonemapDetailSlider_, (int *)&V->localTonemap_.detail, 0, 3000, 50, CONTROLFLAG_PREPARE | CONTROLFLAG_FLOAT);
+    controlInitSlider(&V->localTonemapRadiusSlider_, (int *)&V->localTonemap_.radius, 250, 25000, 250, CONTROLFLAG_PREPARE | CONTROLFLAG_FLOAT);
+    controlInitSlider(&V->localTonemapEdgeSlider_, (int *)&V->localTonemap_.edge, 10, 2000, 10, CONTROLFLAG_PREPARE | CONTROLFLAG_FLOAT);
 
     clRaw rawFont;
     rawFont.ptr = monoBinaryData;
@@ -179,8 +246,10 @@ Vantage * vantageCreate(void)
     daCreate(&V->activeControls_, 0);
 
     controlInitSlider(&V->srgbLuminanceSlider_, &V->srgbLuminance_, SRGB_LUMINANCE_MIN, SRGB_LUMINANCE_MAX, SRGB_LUMINANCE_STEP, CONTROLFLAG_PREPARE);
-    controlInitSlider(&V->unspecLuminanceSlider_, &V->unspecLuminance_, SRGB_LUMINANCE_MIN, SRGB_LUMINANCE_MAX, SRGB_LUMINANCE_STEP, CONTROLFLAG_PREPARE);
+    controlInitSlider(&V->unspecLuminanceSlider_, &V->unspecLuminance_, SRGB_LUMINANCE_MIN, SRGB_LUMINANCE_MAX, SRGB_LUMINANCE_STEP, CONTROLFLAG_GAIN);
     controlInitSlider(&V->imageVideoFrameIndexSlider_, &V->imageVideoFrameIndex_, 0, 0, 1, CONTROLFLAG_RELOAD);
+    controlInitSlider(&V->exposureSlider_, (int *)&V->exposure_, EXPOSURE_MIN, EXPOSURE_MAX, EXPOSURE_STEP, CONTROLFLAG_FLOAT);
+    V->exposureSliderEnabled_ = 0;
 
     V->glyphs_ = dmCreate(DKF_INTEGER, 0);
     int glyphCount = sizeof(monoGlyphs) / sizeof(monoGlyphs[0]);
@@ -196,9 +265,19 @@ Vantage * vantageCreate(void)
     return V;
 }
 
+static void vantageDestroySequenceDiff(Vantage * V)
+{
+    if (V->sequenceDiff_) {
+        sequenceDiffDestroy(V->sequenceDiff_);
+        V->sequenceDiff_ = NULL;
+    }
+}
+
 void vantageDestroy(Vantage * V)
 {
     vantageUnload(V);
+    vantageDestroySequenceDiff(V);
+    prepareTaskReap(&V->abandonedPrepares_, 1);
     if (V->imageFont_) {
         clImageDestroy(V->C, V->imageFont_);
         V->imageFont_ = NULL;
@@ -287,34 +366,6 @@ void vantageFileListAppend(Vantage * V, const char * filename)
     daPush(&V->filenames_, s);
 }
 
-static clImage * vantageTransform(Vantage * V, clImage * image)
-{
-    if (image == NULL) {
-        return image;
-    }
-
-    if ((V->C->readExtraInfo.crop[2] > 0) && (V->C->readExtraInfo.crop[3] > 0)) {
-        int * crop = V->C->readExtraInfo.crop;
-        clImage * cropped = clImageCrop(V->C, image, crop[0], crop[1], crop[2], crop[3], clTrue);
-        if (cropped) {
-            clImageDestroy(V->C, image);
-            image = cropped;
-        }
-    }
-    if (V->C->readExtraInfo.cwRotationsNeeded) {
-        clImage * rotated = clImageRotate(V->C, image, V->C->readExtraInfo.cwRotationsNeeded);
-        clImageDestroy(V->C, image);
-        image = rotated;
-    }
-    if (V->C->readExtraInfo.mirrorNeeded) {
-        const int horizontal = (V->C->readExtraInfo.mirrorNeeded == 1);
-        clImage * mirrored = clImageMirror(V->C, image, horizontal);
-        clImageDestroy(V->C, image);
-        image = mirrored;
-    }
-    return image;
-}
-
 void vantageLoad(Vantage * V, int offset)
 {
     if (daSize(&V->filenames_) < 1) {
@@ -323,6 +374,7 @@ void vantageLoad(Vantage * V, int offset)
 
     dsDestroy(&V->diffFilename1_);
     dsDestroy(&V->diffFilename2_);
+    vantageDestroySequenceDiff(V);
 
     int loadIndex = V->imageFileIndex_ + offset;
     if (loadIndex < 0) {
@@ -349,7 +401,8 @@ void vantageLoad(Vantage * V, int offset)
     const char * outFormatName = NULL;
     V->imageFileSize_ = clFileSize(filename);
     V->imageFileSize2_ = 0;
-    V->image_ = vantageTransform(V, clContextRead(V->C, filename, NULL, &outFormatName));
+    hdrReadContentLightLevel(filename, &V->imageCLLI_);
+    V->image_ = alignReadTransform(V->C, clContextRead(V->C, filename, NULL, &outFormatName), &V->C->readExtraInfo);
     V->imageVideoFrameIndex_ = V->C->readExtraInfo.frameIndex;
     V->imageVideoFrameCount_ = V->C->readExtraInfo.frameCount;
     V->imageVideoFrameIndexSlider_.min = 0;
@@ -375,11 +428,18 @@ void vantageLoad(Vantage * V, int offset)
         V->image_->profile = clProfileClone(V->C, V->forcedProfile_);
     }
 
-    vantagePrepareImage(V);
+    if (V->image_ && !strcmp(outFormatName, "jpg")) {
+        V->gainMap_ = gainMapRead(V->C, filename);
+    }
+
     vantageResetImagePos(V);
+    vantagePrepareImage(V);
     clearOverlay(V);
     if (V->image_) {
         appendOverlay(V, "[%d/%d] Loaded (%s): %s", V->imageFileIndex_ + 1, daSize(&V->filenames_), outFormatName, shortFilename);
+        if (V->gainMap_) {
+            appendOverlay(V, "SDR base + gain map (up to %.2fx)", exp2f(V->gainMap_->metadata.hdrCapacityMax));
+        }
     } else {
         appendOverlay(V, "[%d/%d] Failed to load (%s): %s", V->imageFileIndex_ + 1, daSize(&V->filenames_), outFormatName, shortFilename);
         if (*V->C->readExtraInfo.diagnosticError) {
@@ -394,6 +454,7 @@ void vantageLoadDiff(Vantage * V, const char * filename1, const char * filename2
     if (filename1 && filename2) {
         dsCopy(&V->diffFilename1_, filename1);
         dsCopy(&V->diffFilename2_, filename2);
+        vantageDestroySequenceDiff(V);
     }
     if (!V->diffFilename1_ || !V->diffFilename2_) {
         return;
@@ -406,11 +467,49 @@ void vantageLoadDiff(Vantage * V, const char * filename1, const char * filename2
     vantageFileListClear(V);
     clearOverlay(V);
 
+    // Stepping through a sequence keeps the diff mode, a new pair starts on the diff
+    const int firstLoad = !V->sequenceDiff_;
+
+    // consume the next index and reset it
+    const int frameIndex = V->imageVideoFrameNextIndex_;
+    V->imageVideoFrameNextIndex_ = 0;
+
     const char * failureReason = NULL;
     V->imageFileSize_ = clFileSize(V->diffFilename1_);
     V->imageFileSize2_ = clFileSize(V->diffFilename2_);
-    V->image_ = vantageTransform(V, clContextRead(V->C, V->diffFilename1_, NULL, NULL));
-    V->image2_ = vantageTransform(V, clContextRead(V->C, V->diffFilename2_, NULL, NULL));
+    hdrReadContentLightLevel(V->diffFilename1_, &V->imageCLLI_);
+    hdrReadContentLightLevel(V->diffFilename2_, &V->imageCLLI2_);
+    V->C->params.frameIndex = frameIndex;
+    V->image_ = alignReadTransform(V->C, clContextRead(V->C, V->diffFilename1_, NULL, NULL), &V->C->readExtraInfo);
+    int frameCount = V->C->readExtraInfo.frameCount;
+    V->C->params.frameIndex = frameIndex;
+    V->image2_ = alignReadTransform(V->C, clContextRead(V->C, V->diffFilename2_, NULL, NULL), &V->C->readExtraInfo);
+    if (frameCount > V->C->readExtraInfo.frameCount) {
+        frameCount = V->C->readExtraInfo.frameCount;
+    }
+    V->imageVideoFrameIndex_ = V->C->readExtraInfo.frameIndex;
+    V->imageVideoFrameCount_ = frameCount;
+    V->imageVideoFrameIndexSlider_.min = 0;
+    V->imageVideoFrameIndexSlider_.max = (frameCount > 0) ? frameCount - 1 : 0;
+
+    // A pair off by a few pixels (a crop, a resampling change) would light up every edge, and one
+    // with different dimensions couldn't be diffed at all, so diff the overlap once lined up.
+    // Stepping through a sequence reuses the first frame's alignment, as its background diff does.
+    DiffAlignment alignment;
+    int aligned = 0;
+    if (V->image_ && V->image2_) {
+        if (V->sequenceDiff_) {
+            aligned = sequenceDiffAlignment(V->sequenceDiff_, &alignment);
+        } else if (alignFind(V->C, V->image_, V->image2_, &alignment)) {
+            aligned = alignment.offsetX || alignment.offsetY || (V->image_->width != V->image2_->width) ||
+                      (V->image_->height != V->image2_->height);
+        }
+        if (aligned) {
+            V->image_ = alignCrop(V->C, V->image_, &alignment, 0);
+            V->image2_ = alignCrop(V->C, V->image2_, &alignment, 1);
+        }
+    }
+
     if (!V->image_ || !V->image2_) {
         failureReason = "Both failed to load";
     } else if (!V->image_) {
@@ -455,15 +554,284 @@ void vantageLoadDiff(Vantage * V, const char * filename1, const char * filename2
     appendOverlay(V, "Loaded diff: (in 1st color volume)");
     appendOverlay(V, "* 1: %s", short1);
     appendOverlay(V, "* 2: %s", short2);
+    if (aligned) {
+        appendOverlay(V, "* Aligned: 2nd offset by (%+.2f, %+.2f), diffing the %dx%d overlap", alignment.dx, alignment.dy, alignment.w, alignment.h);
+    }
+    if (frameCount > 1) {
+        appendOverlay(V, "Frame %d of %d, click the timeline to jump", V->imageVideoFrameIndex_, frameCount);
+    }
 
-    V->diffMode_ = DIFFMODE_SHOWDIFF;
-    V->diffIntensity_ = DIFFINTENSITY_BRIGHT;
-    vantagePrepareImage(V);
+    if (firstLoad) {
+        V->diffMode_ = DIFFMODE_SHOWDIFF;
+        V->diffIntensity_ = DIFFINTENSITY_BRIGHT;
+    }
+    if (!V->sequenceDiff_ && (frameCount > 1)) {
+        V->sequenceDiff_ = sequenceDiffCreate(V->C,
+                                              V->diffFilename1_,
+                                              V->diffFilename2_,
+                                              frameCount,
+                                              V->imageVideoFrameIndex_,
+                                              aligned ? &alignment : NULL);
+    }
     vantageResetImagePos(V);
+    vantagePrepareImage(V);
+}
+
+static void vantageCancelPrepare(Vantage * V)
+{
+    if (V->prepareTask_) {
+        prepareTaskCancel(V->prepareTask_, &V->abandonedPrepares_);
+        V->prepareTask_ = NULL;
+    }
+}
+
+// Anything that destroys a source the info panel may be measuring has to call this first
+static void vantageCancelLightLevels(Vantage * V)
+{
+    if (V->lightLevelsTask_) {
+        hdrLightLevelsTaskCancel(V->lightLevelsTask_);
+        V->lightLevelsTask_ = NULL;
+    }
+}
+
+// Replaces (or with NULL, destroys) preparedImage_, giving it a new serial
+static void vantageSetPreparedImage(Vantage * V, clImage * preparedImage)
+{
+    if (V->preparedImage_) {
+        clImageDestroy(V->C, V->preparedImage_);
+    }
+    V->preparedImage_ = preparedImage;
+    V->preparedSerial_ = preparedImage ? ++V->preparedSerialNext_ : 0;
+    V->imageDirty_ = 1;
+}
+
+// Caches gamutCompress() of source (NULL if it already fits in BT.709)
+static void vantageSetGamutCompressed(Vantage * V, clImage * source, clImage * gamutCompressed)
+{
+    if (V->gamutCompressed_) {
+        clImageDestroy(V->C, V->gamutCompressed_);
+    }
+    V->gamutCompressed_ = gamutCompressed;
+    V->gamutCompressedSource_ = source;
+}
+
+// Caches tonemapLocal() of source (gamut compressed first or not), which only depends on the
+// source and the local tonemapping sliders
+static void vantageSetLocalTonemapped(Vantage * V,
+                                      clImage * source,
+                                      int gamut,
+                                      const LocalTonemapParams * params,
+                                      int luminance,
+                                      clImage * localTonemapped)
+{
+    if (V->localTonemapped_) {
+        clImageDestroy(V->C, V->localTonemapped_);
+    }
+    V->localTonemapped_ = localTonemapped;
+    V->localTonemappedSource_ = source;
+    V->localTonemappedGamut_ = gamut;
+    V->localTonemappedParams_ = *params;
+    V->localTonemappedLuminance_ = luminance;
+}
+
+static int vantageLocalTonemappedMatches(Vantage * V, clImage * source, int gamut, int luminance)
+{
+    return source && (V->localTonemappedSource_ == source) && (V->localTonemappedGamut_ == gamut) &&
+           (V->localTonemappedLuminance_ == luminance) &&
+           !memcmp(&V->localTonemappedParams_, &V->localTonemap_, sizeof(LocalTonemapParams));
+}
+
+// Swaps the full resolution prepare in for the proxy (caching what its stages produced),
+// blocking if it isn't done yet
+static void vantageFinishPrepare(Vantage * V)
+{
+    if (!V->prepareTask_) {
+        return;
+    }
+
+    PrepareStages stages;
+    clImage * preparedImage = prepareTaskFinish(V->C, V->prepareTask_, &stages);
+    V->prepareTask_ = NULL;
+    if (V->prepareStages_.gamutCompress) {
+        vantageSetGamutCompressed(V, V->prepareStagesSource_, stages.gamutCompressed);
+    }
+    if (V->prepareStages_.localTonemap) {
+        vantageSetLocalTonemapped(V,
+                                  V->prepareStagesSource_,
+                                  V->prepareStagesGamut_,
+                                  &V->prepareStages_.localTonemapParams,
+                                  V->prepareStages_.localTonemapLuminance,
+                                  stages.localTonemapped);
+    }
+    if (preparedImage) {
+        vantageSetPreparedImage(V, preparedImage);
+    }
+}
+
+// --------------------------------------------------------------------------------------
+// Prepared slots
+
+static void vantageDropPreparedSlot(Vantage * V, DiffMode diffMode)
+{
+    PreparedSlot * slot = &V->preparedSlots_[diffMode];
+    if (slot->image) {
+        clImageDestroy(V->C, slot->image);
+        slot->image = NULL;
+        slot->serial = 0;
+        V->imageDirty_ = 1; // let the platform drop its texture
+    }
+}
+
+// Anything but a diff mode switch (sliders, tonemapping, HDR output, ...) changes what every
+// mode would show
+static void vantageClearPreparedSlots(Vantage * V)
+{
+    vantageDropPreparedSlot(V, DIFFMODE_SHOW1);
+    vantageDropPreparedSlot(V, DIFFMODE_SHOW2);
+    vantageDropPreparedSlot(V, DIFFMODE_SHOWDIFF);
+}
+
+// Parks preparedImage_ in the current mode's slot. A full resolution prepare still in flight is
+// waited on (once) rather than re-preparing on every flip, highlights aren't kept as their stats
+// are per image.
+static void vantageStashPrepared(Vantage * V)
+{
+    if (V->srgbHighlight_) {
+        vantageCancelPrepare(V);
+        vantageSetPreparedImage(V, NULL);
+        return;
+    }
+    vantageFinishPrepare(V);
+    if (!V->preparedImage_) {
+        return;
+    }
+
+    PreparedSlot * slot = &V->preparedSlots_[V->diffMode_];
+    slot->image = V->preparedImage_;
+    slot->serial = V->preparedSerial_;
+    slot->unspecLuminance = V->preparedUnspecLuminance_;
+    slot->imageLuminance = V->imageLuminance_;
+    slot->diffLevel = V->diffLevel_;
+    V->preparedImage_ = NULL;
+    V->preparedSerial_ = 0;
+    V->diffLevel_ = -1;
+}
+
+static clImage * vantageDiffModeSource(Vantage * V, DiffMode diffMode)
+{
+    switch (diffMode) {
+        case DIFFMODE_SHOW1:
+            return V->image_;
+        case DIFFMODE_SHOW2:
+            return V->image2_;
+        case DIFFMODE_SHOWDIFF:
+            break;
+    }
+    return NULL;
+}
+
+static clProfile * vantageDiffModeProfile(Vantage * V, DiffMode diffMode)
+{
+    switch (diffMode) {
+        case DIFFMODE_SHOW1:
+            return V->image_->profile;
+        case DIFFMODE_SHOW2:
+            return V->image2_->profile;
+        case DIFFMODE_SHOWDIFF:
+            break;
+    }
+    return NULL;
+}
+
+// Puts the current mode's slot back on screen, returns 0 if it has to be prepared instead
+static int vantageRestorePrepared(Vantage * V, DiffMode previousMode)
+{
+    PreparedSlot * slot = &V->preparedSlots_[V->diffMode_];
+    if (!slot->image) {
+        return 0;
+    }
+    if ((slot->diffLevel >= 0) && (!V->imageDiff_ || (slot->diffLevel != vantageDiffLevel(V)))) {
+        // Zoomed into another pyramid level since
+        vantageDropPreparedSlot(V, V->diffMode_);
+        return 0;
+    }
+
+    V->preparedImage_ = slot->image;
+    V->preparedSerial_ = slot->serial;
+    V->preparedUnspecLuminance_ = slot->unspecLuminance;
+    V->imageLuminance_ = slot->imageLuminance;
+    V->diffLevel_ = slot->diffLevel;
+    V->shownSource_ = vantageDiffModeSource(V, V->diffMode_);
+    slot->image = NULL;
+    slot->serial = 0;
+
+    // Redrawing the gamut is the only CPU work left, and flicker compares usually share a profile
+    clProfile * profile = vantageDiffModeProfile(V, V->diffMode_);
+    clProfile * previousProfile = vantageDiffModeProfile(V, previousMode);
+    if ((!profile != !previousProfile) || (profile && !clProfileMatches(V->C, profile, previousProfile))) {
+        vantageUpdateCIEBackground(V, profile);
+    }
+    V->imageDirty_ = 1;
+    return 1;
+}
+
+int vantagePreparedSerial(Vantage * V, DiffMode diffMode)
+{
+    if (diffMode == V->diffMode_) {
+        return V->preparedSerial_;
+    }
+    return V->preparedSlots_[diffMode].serial;
+}
+
+static void vantageDestroyDiff(Vantage * V)
+{
+    if (V->imageDiff_) {
+        diffDestroy(V->C, V->imageDiff_);
+        V->imageDiff_ = NULL;
+    }
+    if (V->diffRegions_) {
+        regionsDestroy(V->diffRegions_);
+        V->diffRegions_ = NULL;
+    }
+    V->diffRegionIndex_ = -1;
+}
+
+static void vantageDestroyHighlightProxyPlanes(Vantage * V)
+{
+    if (V->highlightProxyPlanes_) {
+        hdrPlanesDestroy(V->C, V->highlightProxyPlanes_);
+        V->highlightProxyPlanes_ = NULL;
+    }
+}
+
+static void vantageDestroyHighlightPlanes(Vantage * V)
+{
+    vantageDestroyHighlightProxyPlanes(V);
+    if (V->highlightPlanes_) {
+        hdrPlanesDestroy(V->C, V->highlightPlanes_);
+        V->highlightPlanes_ = NULL;
+    }
+}
+
+// Regions only depend on the diff and the threshold
+static void vantageUpdateDiffRegions(Vantage * V)
+{
+    if (!V->imageDiff_ || (V->diffRegions_ && (V->diffRegions_->threshold == V->diffThreshold_))) {
+        return;
+    }
+    if (V->diffRegions_) {
+        regionsDestroy(V->diffRegions_);
+    }
+    V->diffRegions_ = regionsCreate(V->C, V->imageDiff_, V->diffThreshold_);
+    V->diffRegionIndex_ = -1;
 }
 
 void vantageUnload(Vantage * V)
 {
+    vantageCancelPrepare(V);
+    vantageCancelLightLevels(V);
+    V->tonemapAutoSource_ = NULL;
+
     if (V->image_) {
         clImageDestroy(V->C, V->image_);
         V->image_ = NULL;
@@ -472,22 +840,43 @@ void vantageUnload(Vantage * V)
         clImageDestroy(V->C, V->image2_);
         V->image2_ = NULL;
     }
-    if (V->imageDiff_) {
-        clImageDiffDestroy(V->C, V->imageDiff_);
-        V->imageDiff_ = NULL;
+    if (V->gainMap_) {
+        gainMapDestroy(V->C, V->gainMap_);
+        V->gainMap_ = NULL;
+    }
+    if (V->gainMapApplied_) {
+        clImageDestroy(V->C, V->gainMapApplied_);
+        V->gainMapApplied_ = NULL;
+    }
+    vantageDestroyDiff(V);
+    if (V->diffMetrics_) {
+        metricsDestroy(V->C, V->diffMetrics_);
+        V->diffMetrics_ = NULL;
     }
     if (V->imageHighlight_) {
         clImageDestroy(V->C, V->imageHighlight_);
         V->imageHighlight_ = NULL;
     }
-    if (V->preparedImage_) {
-        clImageDestroy(V->C, V->preparedImage_);
-        V->preparedImage_ = NULL;
-    }
-    if (V->highlightInfo_) {
-        clImageHDRPixelInfoDestroy(V->C, V->highlightInfo_);
-        V->highlightInfo_ = NULL;
-    }
+    vantageDestroyHighlightPlanes(V);
+    if (V->localTonemapped_) {
+        clImageDestroy(V->C, V->localTonemapped_);
+        V->localTonemapped_ = NULL;
+    }
+    V->localTonemappedSource_ = NULL;
+    if (V->gamutCompressed_) {
+        clImageDestroy(V->C, V->gamutCompressed_);
+        V->gamutCompressed_ = NULL;
+    }
+    V->gamutCompressedSource_ = NULL;
+    vantageSetPreparedImage(V, NULL);
+    vantageClearPreparedSlots(V);
+    V->highlightSource_ = NULL;
+    V->highlightPixelX_ = -1;
+    V->highlightPixelY_ = -1;
+    V->shownSource_ = NULL;
+    V->lightLevels_.source = NULL;
+    memset(&V->imageCLLI_, 0, sizeof(V->imageCLLI_));
+    memset(&V->imageCLLI2_, 0, sizeof(V->imageCLLI2_));
 
     vantageUpdateCIEBackground(V, NULL);
 
@@ -530,6 +919,16 @@ static clProfile * vantageCreatePreparedProfile(Vantage * V, int luminance)
     return clProfileCreate(V->C, &primaries, &curve, dstLuminance, NULL);
 }
 
+// SDR and PQ output only have 8 or 10 bits per channel to show, so there's no point uploading
+// 16. Linear output needs the precision, and keeps it.
+static PreparedFormat vantageChoosePreparedFormat(Vantage * V)
+{
+    if (V->platformLinear_) {
+        return PREPAREDFORMAT_RGBA16;
+    }
+    return V->imageHDR_ ? PREPAREDFORMAT_RGB10A2 : PREPAREDFORMAT_RGBA8;
+}
+
 static void vantageUpdateCIEBackground(Vantage * V, clProfile * profile)
 {
     float transparent[4] = { 0, 0, 0, 0 };
@@ -562,6 +961,7 @@ static void vantageUpdateCIEBackground(Vantage * V, clProfile * profile)
         clImageDestroy(V->C, srcImage);
         clProfileDestroy(V->C, preparedProfile);
     }
+    V->imageCIEBackgroundDirty_ = 1;
 }
 
 static void vantageReload(Vantage * V)
@@ -623,7 +1023,17 @@ void vantageAdjustThreshold(Vantage * V, int amount)
     }
     if (V->diffThreshold_ != newThreshold) {
         V->diffThreshold_ = newThreshold;
-        vantagePrepareImage(V);
+        if (V->diffMode_ == DIFFMODE_SHOWDIFF) {
+            vantagePrepareCurrentMode(V);
+        } else {
+            // The visualization isn't on screen, only its counts need updating
+            if (V->imageDiff_) {
+                diffUpdate(V->C, V->imageDiff_, V->diffThreshold_);
+                vantageUpdateDiffRegions(V);
+            }
+            vantageDropPreparedSlot(V, DIFFMODE_SHOWDIFF);
+            vantageKickOverlay(V);
+        }
     }
 }
 
@@ -631,26 +1041,50 @@ void vantageSetDiffIntensity(Vantage * V, DiffIntensity diffIntensity)
 {
     if (V->diffIntensity_ != diffIntensity) {
         V->diffIntensity_ = diffIntensity;
-        if (V->imageDiff_) {
-            clImageDiffDestroy(V->C, V->imageDiff_);
-            V->imageDiff_ = NULL;
+        vantageDestroyDiff(V);
+        if (V->diffMode_ == DIFFMODE_SHOWDIFF) {
+            vantagePrepareCurrentMode(V);
+        } else {
+            // Rediffed on the way back into the diff
+            vantageDropPreparedSlot(V, DIFFMODE_SHOWDIFF);
+            vantageKickOverlay(V);
         }
-        vantagePrepareImage(V);
     }
 }
 
 void vantageSetDiffMode(Vantage * V, DiffMode diffMode)
 {
+    if (!V->image2_) {
+        diffMode = DIFFMODE_SHOW1;
+    }
     if (V->diffMode_ != diffMode) {
+        const DiffMode previousMode = V->diffMode_;
+        vantageStashPrepared(V);
         V->diffMode_ = diffMode;
-        if (V->imageDiff_) {
-            if (V->diffMode_ == DIFFMODE_SHOWDIFF) {
-                V->srgbHighlight_ = 0;
-            }
-        } else {
-            V->diffMode_ = DIFFMODE_SHOW1;
+        if (V->diffMode_ == DIFFMODE_SHOWDIFF) {
+            V->srgbHighlight_ = 0;
+        }
+        if (!V->image2_ || !vantageRestorePrepared(V, previousMode)) {
+            vantagePrepareCurrentMode(V);
         }
-        vantagePrepareImage(V);
+    }
+}
+
+void vantageToggleFlicker(Vantage * V)
+{
+    clearOverlay(V);
+    if (!V->image2_) {
+        appendOverlay(V, "Flicker needs a diff");
+        return;
+    }
+
+    V->flicker_ = !V->flicker_;
+    if (V->flicker_) {
+        V->flickerStart_ = now();
+        vantageSetDiffMode(V, DIFFMODE_SHOW1);
+        appendOverlay(V, "Flicker: On (every %.1fs)", FLICKER_INTERVAL);
+    } else {
+        appendOverlay(V, "Flicker: Off");
     }
 }
 
@@ -674,7 +1108,11 @@ void vantageSetVideoFrameIndex(Vantage * V, int videoFrameIndex)
     }
 
     V->imageVideoFrameNextIndex_ = videoFrameIndex;
-    vantageLoad(V, 0);
+    if ((dsLength(&V->diffFilename1_) > 0) && (dsLength(&V->diffFilename2_) > 0)) {
+        vantageLoadDiff(V, NULL, NULL);
+    } else {
+        vantageLoad(V, 0);
+    }
 }
 
 void vantageSetVideoFrameIndexPercentOffset(Vantage * V, int percentOffset)
@@ -703,10 +1141,112 @@ void vantageToggleTonemapSliders(Vantage * V)
     vantageKickOverlay(V);
 }
 
+void vantageToggleLocalTonemap(Vantage * V)
+{
+    V->tonemapMode_ = (V->tonemapMode_ == TONEMAPMODE_LOCAL) ? TONEMAPMODE_GLOBAL : TONEMAPMODE_LOCAL;
+    vantagePrepareImage(V);
+    vantageKickOverlay(V);
+}
+
+void vantageToggleAutoTonemap(Vantage * V)
+{
+    V->tonemapAuto_ = !V->tonemapAuto_;
+    V->tonemapAutoSource_ = NULL;
+    if (V->tonemapAuto_) {
+        // Show the fitted values
+        V->tonemapSlidersEnabled_ = 1;
+    }
+    vantagePrepareImage(V);
+    vantageKickOverlay(V);
+}
+
+void vantageToggleGamutCompression(Vantage * V)
+{
+    V->gamutMode_ = (V->gamutMode_ == GAMUTMODE_COMPRESS) ? GAMUTMODE_CLIP : GAMUTMODE_COMPRESS;
+    clearOverlay(V);
+    appendOverlay(V, "Gamut: %s", (V->gamutMode_ == GAMUTMODE_COMPRESS) ? "Compress" : "Clip");
+    vantagePrepareImage(V);
+}
+
+// The diff pair is read as an HDR master (1) and its SDR grade (2)
+void vantageFitTonemapToReference(Vantage * V)
+{
+    clearOverlay(V);
+    if (!V->image_ || !V->image2_) {
+        appendOverlay(V, "Tonemap fit needs a diff: HDR master (1) and SDR grade (2)");
+        return;
+    }
+
+    V->C->defaultLuminance = V->unspecLuminance_;
+    clTonemapParams params = V->preparedTonemap_;
+    int luminance = V->preparedTonemapLuminance_;
+    float deltaE = 0.0f;
+    if (!tonemapFitReference(V->C, V->image_, V->image2_, SRGB_LUMINANCE_MIN, SRGB_LUMINANCE_MAX, &params, &luminance, &deltaE)) {
+        appendOverlay(V, "Tonemap fit failed");
+        return;
+    }
+
+    V->preparedTonemap_ = params;
+    V->preparedTonemapLuminance_ = luminance;
+    V->tonemapMode_ = TONEMAPMODE_GLOBAL;
+    V->tonemapAuto_ = 0;
+    V->tonemapSlidersEnabled_ = 1;
+    appendOverlay(V, "Tonemap fit to reference: mean dE %.2f", deltaE);
+    appendOverlay(V, "* Contrast %.3f, ClipPoint %.3f", params.contrast, params.clipPoint);
+    appendOverlay(V, "* Speed %.3f, Power %.3f", params.speed, params.power);
+    appendOverlay(V, "* Luminance %d nits", luminance);
+
+    // Show the fitted master, 2 flips to the grade
+    V->diffMode_ = DIFFMODE_SHOW1;
+    vantagePrepareImage(V);
+}
+
+// With HDR output nothing is tonemapped, so an unspecified luminance change is just a scale
+// factor on the prepared image, which vantageDisplayGain() applies at draw time.
+static int vantageUnspecLuminanceIsGain(Vantage * V)
+{
+    if (V->image2_) {
+        // The diff depends on the conversion of image2_, keep it simple
+        return 0;
+    }
+    if (!V->preparedImage_) {
+        return 1;
+    }
+    return V->imageHDR_ && (V->preparedUnspecLuminance_ > 0);
+}
+
 void vantageSetUnspecLuminance(Vantage * V, int unspecLuminance)
 {
     V->unspecLuminance_ = unspecLuminance;
-    vantagePrepareImage(V);
+    if (!vantageUnspecLuminanceIsGain(V)) {
+        // Unspecified sources change their brightness, refit, recompress and remeasure
+        V->tonemapAutoSource_ = NULL;
+        V->gamutCompressedSource_ = NULL;
+        V->localTonemappedSource_ = NULL;
+        if (V->diffMetrics_) {
+            metricsDestroy(V->C, V->diffMetrics_);
+            V->diffMetrics_ = NULL;
+        }
+        const int diffConverts = V->imageDiff_ &&
+                                 (!clProfileMatches(V->C, V->image_->profile, V->image2_->profile) || (V->image_->depth != V->image2_->depth));
+        if (diffConverts) {
+            // Converting image2_ depends on the unspecified luminance, rediff (zooming alone doesn't)
+            vantageDestroyDiff(V);
+        }
+        vantagePrepareImage(V);
+    }
+    vantageKickOverlay(V);
+}
+
+void vantageToggleExposureSlider(Vantage * V)
+{
+    V->exposureSliderEnabled_ = !V->exposureSliderEnabled_;
+    vantageKickOverlay(V);
+}
+
+void vantageResetExposure(Vantage * V)
+{
+    V->exposure_ = 0.0f;
     vantageKickOverlay(V);
 }
 
@@ -754,11 +1294,77 @@ void vantageCalcImageSize(Vantage * V)
     V->imagePosH_ *= V->imagePosS_;
 }
 
+// Diff pyramid level matching the current zoom
+static int vantageDiffLevel(Vantage * V)
+{
+    return diffLevelForScale(V->imageDiff_, (float)V->image_->width / V->imagePosW_);
+}
+
+// Reprepares the diff if zooming crossed into another pyramid level
+static void vantageRefreshDiffLevel(Vantage * V)
+{
+    if ((V->diffLevel_ >= 0) && V->imageDiff_ && (V->diffLevel_ != vantageDiffLevel(V))) {
+        vantagePrepareCurrentMode(V);
+    }
+}
+
 void vantageResetImagePos(Vantage * V)
 {
     V->imagePosS_ = 1.0f;
     vantageCalcImageSize(V);
     vantageCalcCenteredImagePos(V, &V->imagePosX_, &V->imagePosY_);
+    vantageRefreshDiffLevel(V);
+}
+
+// Centers the next (or previous) most severe region, zoomed to span about a third of the window
+static void vantageJumpToDiffRegion(Vantage * V, int direction)
+{
+    clearOverlay(V);
+    vantageCreateDiff(V);
+    if (!V->imageDiff_ || !V->diffRegions_) {
+        appendOverlay(V, "Region navigation needs a diff");
+        return;
+    }
+    const int count = V->diffRegions_->count;
+    if (count == 0) {
+        appendOverlay(V, "No regions over threshold (%d)", V->diffThreshold_);
+        return;
+    }
+
+    if (V->diffRegionIndex_ < 0) {
+        V->diffRegionIndex_ = (direction > 0) ? 0 : (count - 1);
+    } else {
+        V->diffRegionIndex_ = (V->diffRegionIndex_ + direction + count) % count;
+    }
+    const DiffRegion * region = &V->diffRegions_->regions[V->diffRegionIndex_];
+
+    // Screen pixels per image pixel when the whole image fits
+    V->imagePosS_ = 1.0f;
+    vantageCalcImageSize(V);
+    const float fitScale = V->imagePosW_ / (float)V->image_->width;
+    const float scaleW = ((float)V->platformW_ / 3.0f) / ((float)region->w * fitScale);
+    const float scaleH = ((float)V->platformH_ / 3.0f) / ((float)region->h * fitScale);
+    V->imagePosS_ = CL_CLAMP(fminf(scaleW, scaleH), 1.0f, MAX_SCALE);
+    vantageCalcImageSize(V);
+
+    const float centerX = (float)region->x + ((float)region->w * 0.5f);
+    const float centerY = (float)region->y + ((float)region->h * 0.5f);
+    V->imagePosX_ = ((float)V->platformW_ * 0.5f) - ((centerX / (float)V->image_->width) * V->imagePosW_);
+    V->imagePosY_ = ((float)V->platformH_ * 0.5f) - ((centerY / (float)V->image_->height) * V->imagePosH_);
+    vantageRefreshDiffLevel(V);
+
+    appendOverlay(V, "Region %d/%d: %dx%d at (%d, %d)", V->diffRegionIndex_ + 1, count, region->w, region->h, region->x, region->y);
+    appendOverlay(V, "* %d pixels over threshold, max diff %d", region->pixelCount, region->maxDiff);
+}
+
+void vantageNextDiffRegion(Vantage * V)
+{
+    vantageJumpToDiffRegion(V, 1);
+}
+
+void vantagePrevDiffRegion(Vantage * V)
+{
+    vantageJumpToDiffRegion(V, -1);
 }
 
 // --------------------------------------------------------------------------------------
@@ -843,6 +1449,44 @@ void vantageMouseLeftDoubleClick(Vantage * V, int x, int y)
     vantageCalcImageSize(V);
     V->imagePosX_ = (float)x - normalizedImagePosX * V->imagePosW_;
     V->imagePosY_ = (float)y - normalizedImagePosY * V->imagePosH_;
+    vantageRefreshDiffLevel(V);
+}
+
+// Timeline columns each cover a run of frames, at least 2 pixels wide
+static int vantageTimelineColumns(Vantage * V, int w)
+{
+    int columns = w / 2;
+    const int frameCount = sequenceDiffFrameCount(V->sequenceDiff_);
+    if (columns > frameCount) {
+        columns = frameCount;
+    }
+    return (columns > 0) ? columns : 1;
+}
+
+// Jumps to the frame under x, snapping to the spike (most over threshold pixels) when the
+// column covers several frames
+static void vantageTimelineClick(Vantage * V, int x)
+{
+    SequenceDiff * sd = V->sequenceDiff_;
+    const int frameCount = sequenceDiffFrameCount(sd);
+    const int columns = vantageTimelineColumns(V, V->timelineW_);
+    int column = (x - V->timelineX_) * columns / V->timelineW_;
+    column = CL_CLAMP(column, 0, columns - 1);
+    const int firstFrame = column * frameCount / columns;
+    const int endFrame = (column + 1) * frameCount / columns;
+
+    int frameIndex = firstFrame;
+    int worstOver = 0;
+    for (int i = firstFrame; i < endFrame; ++i) {
+        const int over = sequenceDiffOverThreshold(sd, i, V->diffThreshold_);
+        if (over > worstOver) {
+            frameIndex = i;
+            worstOver = over;
+        }
+    }
+    if (frameIndex != V->imageVideoFrameIndex_) {
+        vantageSetVideoFrameIndex(V, frameIndex);
+    }
 }
 
 void vantageMouseLeftDown(Vantage * V, int x, int y)
@@ -857,6 +1501,12 @@ void vantageMouseLeftDown(Vantage * V, int x, int y)
         return;
     }
 
+    if (V->sequenceDiff_ && (V->timelineW_ > 0) && (x >= V->timelineX_) && (x < (V->timelineX_ + V->timelineW_)) &&
+        (y >= V->timelineY_) && (y < (V->timelineY_ + V->timelineH_))) {
+        vantageTimelineClick(V, x);
+        return;
+    }
+
     V->dragging_ = 1;
 }
 
@@ -872,7 +1522,17 @@ void vantageMouseLeftUp(Vantage * V, int x, int y)
         if (V->dragControl_->flags & CONTROLFLAG_RELOAD) {
             vantageSetVideoFrameIndex(V, V->imageVideoFrameIndex_);
         } else if (V->dragControl_->flags & CONTROLFLAG_PREPARE) {
+            if ((V->dragControl_ == &V->preparedTonemapContrastSlider_) || (V->dragControl_ == &V->preparedTonemapClipPointSlider_) ||
+                (V->dragControl_ == &V->preparedTonemapSpeedSlider_) || (V->dragControl_ == &V->preparedTonemapPowerSlider_)) {
+                // Hand tuning takes over from the fit
+                V->tonemapAuto_ = 0;
+            } else if (V->dragControl_ == &V->preparedTonemapLuminanceSlider_) {
+                // New target, refit
+                V->tonemapAutoSource_ = NULL;
+            }
             vantagePrepareImage(V);
+        } else if (V->dragControl_->flags & CONTROLFLAG_GAIN) {
+            vantageSetUnspecLuminance(V, V->unspecLuminance_);
         }
 
         V->dragControl_ = NULL;
@@ -885,6 +1545,13 @@ void vantageMouseMove(Vantage * V, int x, int y)
 {
     if (V->dragControl_) {
         vantageControlClick(V, V->dragControl_, x, y);
+        if ((V->dragControl_ == &V->srgbLuminanceSlider_) && V->highlightPlanes_ && (V->srgbLuminance_ != V->highlightLuminance_)) {
+            // Reclassifying a window-sized sample of the planes is cheap enough to follow the
+            // slider, the release prepares the full resolution image
+            V->prepareLive_ = 1;
+            vantagePrepareImage(V);
+            V->prepareLive_ = 0;
+        }
     } else if (V->dragging_) {
         float dx = (float)(x - V->dragLastX_);
         float dy = (float)(y - V->dragLastY_);
@@ -935,6 +1602,7 @@ void vantageMouseWheel(Vantage * V, int x, int y, float delta)
     vantageCalcImageSize(V);
     V->imagePosX_ = (float)x - normalizedImagePosX * V->imagePosW_;
     V->imagePosY_ = (float)y - normalizedImagePosY * V->imagePosH_;
+    vantageRefreshDiffLevel(V);
 }
 
 // --------------------------------------------------------------------------------------
@@ -979,14 +1647,100 @@ void vantagePlatformSetMaxEDR(Vantage * V, float maxEDR)
 // --------------------------------------------------------------------------------------
 // Rendering
 
-void vantagePrepareImage(Vantage * V)
+// How far above SDR white the output can go, used to weight gain maps
+static float vantageDisplayHeadroom(Vantage * V)
 {
-    if (V->preparedImage_) {
-        clImageDestroy(V->C, V->preparedImage_);
-        V->preparedImage_ = NULL;
+    if (!V->platformHDRActive_ || !V->wantsHDR_) {
+        return 1.0f;
+    }
+    if (V->platformLinear_) {
+        return (V->platformMaxEDR_ > 1.0f) ? V->platformMaxEDR_ : 1.0f;
+    }
+    // PQ doesn't report a display peak, allow anything the container can hold
+    return 10000.0f / (float)V->unspecLuminance_;
+}
+
+// The decoded planes stay around, so a headroom change only reapplies the gain map
+static clImage * vantagePrepareGainMap(Vantage * V)
+{
+    float headroom = vantageDisplayHeadroom(V);
+    if (gainMapWeight(V->gainMap_, headroom) <= 0.0f) {
+        // The SDR base is the intended rendition
+        return V->image_;
+    }
+
+    if (!V->gainMapApplied_ || (V->gainMapHeadroom_ != headroom) || (V->gainMapLuminance_ != V->unspecLuminance_)) {
+        if (V->gainMapApplied_) {
+            vantageCancelLightLevels(V);
+            clImageDestroy(V->C, V->gainMapApplied_);
+            if (V->tonemapAutoSource_ == V->gainMapApplied_) {
+                V->tonemapAutoSource_ = NULL;
+            }
+            if (V->gamutCompressedSource_ == V->gainMapApplied_) {
+                V->gamutCompressedSource_ = NULL;
+            }
+            if (V->localTonemappedSource_ == V->gainMapApplied_) {
+                V->localTonemappedSource_ = NULL;
+            }
+            if (V->highlightPlanes_ && (V->highlightPlanes_->source == V->gainMapApplied_)) {
+                vantageDestroyHighlightPlanes(V);
+            }
+            if (V->lightLevels_.source == V->gainMapApplied_) {
+                V->lightLevels_.source = NULL;
+            }
+        }
+        V->gainMapApplied_ = gainMapApply(V->C, V->gainMap_, V->image_, headroom);
+        V->gainMapHeadroom_ = headroom;
+        V->gainMapLuminance_ = V->unspecLuminance_;
+    }
+    return V->gainMapApplied_ ? V->gainMapApplied_ : V->image_;
+}
+
+// Diffs (and their metrics) are only made once something needs them, usually entering the diff
+static void vantageCreateDiff(Vantage * V)
+{
+    if (V->imageDiff_ || !V->image_ || !V->image2_) {
+        return;
+    }
+
+    float minIntensity = 0.0f;
+    switch (V->diffIntensity_) {
+        case DIFFINTENSITY_ORIGINAL:
+            minIntensity = 0.0f;
+            break;
+        case DIFFINTENSITY_BRIGHT:
+        case DIFFINTENSITY_HEATMAP:
+            minIntensity = 0.1f;
+            break;
+        case DIFFINTENSITY_DIFFONLY:
+            minIntensity = 1.0f;
+            break;
+    }
+
+    // Both convert image2_ into image_'s color volume band by band, as they go
+    V->imageDiff_ = diffCreate(V->C, V->image_, V->image2_, minIntensity, V->diffThreshold_);
+    if (!V->diffMetrics_) {
+        V->diffMetrics_ = metricsCreate(V->C, V->image_, V->image2_, 1);
     }
+    vantageUpdateDiffRegions(V);
+}
+
+void vantagePrepareImage(Vantage * V)
+{
+    vantageClearPreparedSlots(V);
+    vantagePrepareCurrentMode(V);
+}
+
+// Prepares the current diff mode only, leaving the other modes' slots alone
+static void vantagePrepareCurrentMode(Vantage * V)
+{
+    // The background prepare may be reading any of the images about to be replaced
+    vantageCancelPrepare(V);
+
+    vantageSetPreparedImage(V, NULL);
 
     clImage * srcImage = NULL;
+    V->diffLevel_ = -1;
 
     V->C->defaultLuminance = V->unspecLuminance_;
 
@@ -994,39 +1748,11 @@ void vantagePrepareImage(Vantage * V)
     int preparedTonemapLuminance = V->preparedTonemapLuminance_;
 
     if (V->image_ && V->image2_) {
-        if (!clProfileMatches(V->C, V->image_->profile, V->image2_->profile) || (V->image_->depth != V->image2_->depth)) {
-            if (V->imageDiff_) {
-                clImageDiffDestroy(V->C, V->imageDiff_);
-                V->imageDiff_ = NULL;
-            }
-        }
-
         if (V->imageDiff_) {
-            clImageDiffUpdate(V->C, V->imageDiff_, V->diffThreshold_);
-        } else {
-            clImage * secondImage = V->image2_;
-            if (!clProfileMatches(V->C, V->image_->profile, V->image2_->profile) || (V->image_->depth != V->image2_->depth)) {
-                secondImage = clImageConvert(V->C, V->image2_, V->image_->depth, V->image_->profile, CL_TONEMAP_OFF, NULL);
-            }
-
-            float minIntensity = 0.0f;
-            switch (V->diffIntensity_) {
-                case DIFFINTENSITY_ORIGINAL:
-                    minIntensity = 0.0f;
-                    break;
-                case DIFFINTENSITY_BRIGHT:
-                    minIntensity = 0.1f;
-                    break;
-                case DIFFINTENSITY_DIFFONLY:
-                    minIntensity = 1.0f;
-                    break;
-            }
-
-            V->imageDiff_ = clImageDiffCreate(V->C, V->image_, secondImage, minIntensity, V->diffThreshold_);
-
-            if (V->image2_ != secondImage) {
-                clImageDestroy(V->C, secondImage);
-            }
+            diffUpdate(V->C, V->imageDiff_, V->diffThreshold_);
+            vantageUpdateDiffRegions(V);
+        } else if (V->diffMode_ == DIFFMODE_SHOWDIFF) {
+            vantageCreateDiff(V);
         }
 
         switch (V->diffMode_) {
@@ -1041,57 +1767,212 @@ void vantagePrepareImage(Vantage * V)
                 preparedTonemap = NULL;
                 preparedTonemapLuminance = SRGB_LUMINANCE_DEF;
 
-                srcImage = V->imageDiff_->image;
+                if ((V->diffIntensity_ == DIFFINTENSITY_HEATMAP) && V->diffMetrics_) {
+                    srcImage = V->diffMetrics_->heatmap;
+                } else if (V->imageDiff_) {
+                    // Max pooled down to the screen's resolution, so the proxy and the GPU's
+                    // filtering can't average isolated differences away
+                    V->diffLevel_ = vantageDiffLevel(V);
+                    srcImage = diffVisualize(V->C, V->imageDiff_, V->diffLevel_);
+                }
                 break;
         }
+    } else if (V->gainMap_) {
+        srcImage = vantagePrepareGainMap(V);
     } else {
         // Just show an image like normal
         srcImage = V->image_;
     }
 
     if (srcImage) {
+        V->highlightSource_ = NULL;
+        if (!V->srgbHighlight_) {
+            vantageDestroyHighlightPlanes(V);
+        }
         if (V->diffMode_ == DIFFMODE_SHOWDIFF) {
+            V->shownSource_ = NULL;
             vantageUpdateCIEBackground(V, NULL);
         } else {
+            V->shownSource_ = srcImage;
             vantageUpdateCIEBackground(V, srcImage->profile);
 
             clProfileQuery(V->C, srcImage->profile, NULL, NULL, &V->imageLuminance_);
 
             if (V->srgbHighlight_) {
-                if (V->imageHighlight_) {
+                // Everything but the threshold is measured once per source, and per pixel values
+                // only for the hovered pixel, see vantageRenderInfo()
+                if (!hdrPlanesMatch(V->C, V->highlightPlanes_, srcImage)) {
+                    vantageDestroyHighlightPlanes(V);
+                    V->highlightPlanes_ = hdrPlanesCreate(V->C, srcImage);
+                }
+                if (V->highlightPlanes_) {
+                    // While dragging only a window-sized sample of the planes is reclassified,
+                    // the release reclassifies them all
+                    const HDRPlanes * shownPlanes = V->highlightPlanes_;
+                    int proxyW;
+                    int proxyH;
+                    if (V->prepareLive_ &&
+                        prepareProxySize(V->highlightPlanes_->width, V->highlightPlanes_->height, V->platformW_, V->platformH_, &proxyW, &proxyH)) {
+                        if (!V->highlightProxyPlanes_ || (V->highlightProxyPlanes_->width != proxyW) || (V->highlightProxyPlanes_->height != proxyH)) {
+                            vantageDestroyHighlightProxyPlanes(V);
+                            V->highlightProxyPlanes_ = hdrPlanesCreateProxy(V->C, V->highlightPlanes_, proxyW, proxyH);
+                        }
+                        shownPlanes = V->highlightProxyPlanes_;
+                    } else {
+                        vantageDestroyHighlightProxyPlanes(V);
+                    }
+
+                    // Rewritten in place, the prepare task reading it was cancelled above
+                    V->imageHighlight_ = hdrPlanesHighlight(V->C, shownPlanes, V->srgbLuminance_, V->imageHighlight_);
+                    hdrPlanesStats(V->highlightPlanes_, V->srgbLuminance_, &V->highlightStats_);
+                    V->highlightLuminance_ = V->srgbLuminance_;
+                } else if (V->imageHighlight_) {
                     clImageDestroy(V->C, V->imageHighlight_);
                     V->imageHighlight_ = NULL;
                 }
-                if (V->highlightInfo_) {
-                    clImageHDRPixelInfoDestroy(V->C, V->highlightInfo_);
-                    V->highlightInfo_ = NULL;
+                if (V->imageHighlight_) {
+                    V->highlightSource_ = srcImage;
+                    V->highlightPixelX_ = -1;
+                    V->highlightPixelY_ = -1;
+                    srcImage = V->imageHighlight_;
+
+                    // Don't tonemap the SRGB highlight
+                    preparedTonemap = NULL;
+                    preparedTonemapLuminance = SRGB_LUMINANCE_DEF;
+                }
+            }
+        }
+
+        // preparedTonemap is only left set when tonemapping the image itself (not a diff or highlight)
+        const int sdrOutput = !(V->platformHDRActive_ && V->wantsHDR_);
+        const int compressGamut = (V->gamutMode_ == GAMUTMODE_COMPRESS) && sdrOutput && preparedTonemap;
+        const int localTonemap = (V->tonemapMode_ == TONEMAPMODE_LOCAL) && sdrOutput && preparedTonemap;
+        clImage * stagesSource = srcImage;
+        PrepareStages stages;
+        memset(&stages, 0, sizeof(stages));
+        if (localTonemap) {
+            // Only depends on the source and its own sliders, so it survives everything else
+            if (vantageLocalTonemappedMatches(V, stagesSource, compressGamut, preparedTonemapLuminance)) {
+                if (V->localTonemapped_) {
+                    // Already at preparedTonemapLuminance, so the conversion below won't tonemap again
+                    srcImage = V->localTonemapped_;
+                    preparedTonemap = NULL;
+                }
+            } else {
+                stages.localTonemap = 1;
+                stages.localTonemapParams = V->localTonemap_;
+                stages.localTonemapLuminance = preparedTonemapLuminance;
+            }
+        }
+        if (compressGamut && (srcImage == stagesSource)) {
+            // Only depends on the source, so it survives slider changes
+            if (V->gamutCompressedSource_ == srcImage) {
+                if (V->gamutCompressed_) {
+                    srcImage = V->gamutCompressed_;
                 }
+            } else {
+                stages.gamutCompress = 1;
+            }
+        }
 
-                V->highlightInfo_ = clImageHDRPixelInfoCreate(V->C, srcImage->width * srcImage->height);
-                clImageHDRQuantization quant;
-                clImageMeasureHDR(V->C, srcImage, V->srgbLuminance_, 0.0f, &V->imageHighlight_, &V->highlightStats_, V->highlightInfo_, &quant);
-                srcImage = V->imageHighlight_;
+        clImage * proxyImage = NULL;
+        if ((V->imagePosS_ <= 1.0f) || V->prepareLive_) {
+            proxyImage = prepareCreateProxy(V->C, srcImage, V->platformW_, V->platformH_);
+        }
 
-                // Don't tonemap the SRGB highlight
-                preparedTonemap = NULL;
-                preparedTonemapLuminance = SRGB_LUMINANCE_DEF;
+        // Stages that aren't cached yet run on the proxy, and at full resolution in the prepare
+        // task. Without a proxy they run here.
+        if (!proxyImage) {
+            if (stages.gamutCompress) {
+                vantageSetGamutCompressed(V, srcImage, gamutCompress(V->C, srcImage, NULL));
+                stages.gamutCompress = 0;
+                if (V->gamutCompressed_) {
+                    srcImage = V->gamutCompressed_;
+                }
+            }
+            if (stages.localTonemap) {
+                clImage * localTonemapped = tonemapLocal(V->C, srcImage, &V->localTonemap_, preparedTonemapLuminance, NULL);
+                vantageSetLocalTonemapped(V, stagesSource, compressGamut, &V->localTonemap_, preparedTonemapLuminance, localTonemapped);
+                stages.localTonemap = 0;
+                if (V->localTonemapped_) {
+                    srcImage = V->localTonemapped_;
+                    preparedTonemap = NULL;
+                }
+            }
+        }
+        clTonemapParams * proxyTonemap = preparedTonemap;
+        if (stages.gamutCompress) {
+            clImage * compressedProxy = gamutCompress(V->C, proxyImage, NULL);
+            if (compressedProxy) {
+                clImageDestroy(V->C, proxyImage);
+                proxyImage = compressedProxy;
+            }
+        }
+        if (stages.localTonemap) {
+            // The radius is relative to the image's size, so the proxy looks the same
+            clImage * localProxy = tonemapLocal(V->C, proxyImage, &V->localTonemap_, preparedTonemapLuminance, NULL);
+            if (localProxy) {
+                clImageDestroy(V->C, proxyImage);
+                proxyImage = localProxy;
+                proxyTonemap = NULL;
+            }
+        }
+        clImage * stagedImage = proxyImage ? proxyImage : srcImage; // what the stages have been applied to
+
+        if (V->tonemapAuto_ && (V->tonemapMode_ == TONEMAPMODE_GLOBAL) && sdrOutput && preparedTonemap &&
+            ((V->tonemapAutoSource_ != stagesSource) || (V->tonemapAutoGamut_ != compressGamut))) {
+            // The fitted values land in preparedTonemap_, so the sliders pick them up. Gamut
+            // compression is fitted from the proxy until the full resolution one is ready.
+            if (tonemapFitHistogram(V->C, stages.gamutCompress ? stagedImage : srcImage, preparedTonemapLuminance, &V->preparedTonemap_)) {
+                V->tonemapAutoSource_ = stagesSource;
+                V->tonemapAutoGamut_ = compressGamut;
             }
         }
 
+        int srcLuminance = CL_LUMINANCE_UNSPECIFIED;
+        clProfileQuery(V->C, stagedImage->profile, NULL, NULL, &srcLuminance);
+        V->preparedUnspecLuminance_ = (srcLuminance == CL_LUMINANCE_UNSPECIFIED) ? V->unspecLuminance_ : 0;
+
         clProfile * profile = vantageCreatePreparedProfile(V, preparedTonemapLuminance);
-        V->preparedImage_ = clImageConvert(V->C, srcImage, 16, profile, CL_TONEMAP_AUTO, preparedTonemap);
+        V->preparedFormat_ = vantageChoosePreparedFormat(V);
+        if (proxyImage) {
+            // Show a window-sized proxy right away, and swap in the full resolution image when it's ready
+            vantageSetPreparedImage(V, prepareConvert(V->C, proxyImage, profile, proxyTonemap, V->preparedFormat_, NULL));
+            clImageDestroy(V->C, proxyImage);
+            if (!V->prepareLive_) {
+                V->prepareTask_ = prepareTaskCreate(V->C, srcImage, profile, preparedTonemap, V->preparedFormat_, &stages);
+                V->prepareStages_ = stages;
+                V->prepareStagesSource_ = stagesSource;
+                V->prepareStagesGamut_ = compressGamut;
+            }
+        } else {
+            vantageSetPreparedImage(V, prepareConvert(V->C, srcImage, profile, preparedTonemap, V->preparedFormat_, NULL));
+        }
         clProfileDestroy(V->C, profile);
     }
 
     V->imageDirty_ = 1;
 }
 
+// Linear-light gain applied to the prepared image at draw time: exposure, plus any unspecified
+// luminance change that hasn't been baked into preparedImage_ yet.
+static float vantageDisplayGain(Vantage * V)
+{
+    float gain = powf(2.0f, V->exposure_);
+    if ((V->preparedUnspecLuminance_ > 0) && (V->unspecLuminance_ != V->preparedUnspecLuminance_)) {
+        gain *= (float)V->unspecLuminance_ / (float)V->preparedUnspecLuminance_;
+    }
+    return gain;
+}
+
 static void vantageBlitImage(Vantage * V, float dx, float dy, float dw, float dh)
 {
     if (!V->preparedImage_) {
         return;
     }
 
+    float gain = vantageDisplayGain(V);
+
     Blit blit;
     blit.sx = 0.0f;
     blit.sy = 0.0f;
@@ -1101,9 +1982,9 @@ static void vantageBlitImage(Vantage * V, float dx, float dy, float dw, float dh
     blit.dy = dy / V->platformH_;
     blit.dw = dw / V->platformW_;
     blit.dh = dh / V->platformH_;
-    blit.color.r = 1.0f;
-    blit.color.g = 1.0f;
-    blit.color.b = 1.0f;
+    blit.color.r = gain;
+    blit.color.g = gain;
+    blit.color.b = gain;
     blit.color.a = 1.0f;
     blit.mode = BM_IMAGE;
     daPush(&V->blits_, blit);
@@ -1292,6 +2173,83 @@ static void vantageRenderControl(Vantage * V, Control * control, float x, float
     vantageFill(V, x + (w * offset), y, barThickness, h, &sliderColor);                         // Slider
 }
 
+// One bar per column: over threshold pixels (red, log scaled to the worst frame so far) with the
+// largest diff as a tick (yellow, relative to the largest so far). Pending columns stay empty.
+static void vantageRenderTimeline(Vantage * V, float x, float y, float w, float h, float alpha)
+{
+    SequenceDiff * sd = V->sequenceDiff_;
+    const int frameCount = sequenceDiffFrameCount(sd);
+    V->timelineX_ = (int)x;
+    V->timelineY_ = (int)y;
+    V->timelineW_ = (int)w;
+    V->timelineH_ = (int)h;
+
+    float lum = vantageScaleTextLuminance(V, 1.0f);
+    float halfLum = vantageScaleTextLuminance(V, 0.5f);
+    float qLum = vantageScaleTextLuminance(V, 0.25f);
+    Color backgroundColor = { 0.0f, 0.0f, 0.0f, 0.6f * alpha };
+    Color overColor = { lum, qLum, qLum, alpha };
+    Color largestColor = { lum, lum, qLum, alpha };
+    Color failedColor = { halfLum, halfLum, halfLum, alpha };
+    Color currentColor = { lum, lum, lum, alpha };
+    vantageFill(V, x, y, w, h, &backgroundColor);
+
+    int worstOver = 0;
+    int worstLargest = 0;
+    for (int i = 0; i < frameCount; ++i) {
+        const int over = sequenceDiffOverThreshold(sd, i, V->diffThreshold_);
+        if (over > worstOver) {
+            worstOver = over;
+        }
+        const int largest = sequenceDiffLargestChannelDiff(sd, i);
+        if (largest > worstLargest) {
+            worstLargest = largest;
+        }
+    }
+
+    const int columns = vantageTimelineColumns(V, (int)w);
+    const float columnW = w / (float)columns;
+    const float logWorstOver = logf(1.0f + (float)worstOver);
+    for (int c = 0; c < columns; ++c) {
+        const int firstFrame = c * frameCount / columns;
+        const int endFrame = (c + 1) * frameCount / columns;
+        int over = -1;
+        int largest = 0;
+        int failed = 0;
+        for (int i = firstFrame; i < endFrame; ++i) {
+            const int frameOver = sequenceDiffOverThreshold(sd, i, V->diffThreshold_);
+            if (frameOver > over) {
+                over = frameOver;
+            }
+            const int frameLargest = sequenceDiffLargestChannelDiff(sd, i);
+            if (frameLargest > largest) {
+                largest = frameLargest;
+            }
+            if (sequenceDiffFrameState(sd, i) == SEQUENCEFRAME_FAILED) {
+                failed = 1;
+            }
+        }
+
+        const float columnX = x + (c * columnW);
+        if (failed) {
+            vantageFill(V, columnX, y + h - 2.0f, columnW, 2.0f, &failedColor);
+        }
+        if ((over > 0) && (logWorstOver > 0.0f)) {
+            const float barH = h * logf(1.0f + (float)over) / logWorstOver;
+            vantageFill(V, columnX, y + h - barH, columnW, barH, &overColor);
+        }
+        if ((largest > 0) && (worstLargest > 0)) {
+            const float tickY = y + h - (h * (float)largest / (float)worstLargest);
+            vantageFill(V, columnX, tickY, columnW, 2.0f, &largestColor);
+        }
+    }
+
+    if (V->imageVideoFrameIndex_ < frameCount) {
+        const float currentX = x + (w * ((float)V->imageVideoFrameIndex_ + 0.5f) / (float)frameCount);
+        vantageFill(V, currentX - 1.0f, y, 2.0f, h, &currentColor);
+    }
+}
+
 static void vantageRenderNextLine(Vantage * V, const char * format, ...)
 {
     va_list args;
@@ -1305,6 +2263,33 @@ static void vantageRenderNextLine(Vantage * V, const char * format, ...)
     V->nextLineY_ += V->nextLineHeight_;
 }
 
+// Keeps lightLevels_ (measured on a task, the first time the panel shows a source) up to date with
+// shownSource and unspecLuminance_, which a gain change moves without a prepare. Returns 0 while
+// they're being measured.
+static int vantageUpdateLightLevels(Vantage * V, clImage * shownSource)
+{
+    if (hdrLightLevelsMatch(V->C, &V->lightLevels_, shownSource, V->unspecLuminance_)) {
+        return 1;
+    }
+    if (V->dragControl_) {
+        // A slider may move the luminance every frame, the release measures once
+        return 0;
+    }
+    if (V->lightLevelsTask_ && !hdrLightLevelsTaskMatch(V->C, V->lightLevelsTask_, shownSource, V->unspecLuminance_)) {
+        vantageCancelLightLevels(V);
+    }
+    if (!V->lightLevelsTask_) {
+        V->lightLevelsTask_ = hdrLightLevelsTaskCreate(V->C, shownSource, V->unspecLuminance_);
+        return 0;
+    }
+    if (!hdrLightLevelsTaskFinished(V->lightLevelsTask_)) {
+        return 0;
+    }
+    V->lightLevelsValid_ = hdrLightLevelsTaskFinish(V->lightLevelsTask_, &V->lightLevels_);
+    V->lightLevelsTask_ = NULL;
+    return 1;
+}
+
 static void vantageRenderInfo(Vantage * V, float left, float top, float fontHeight, float nextLine, Color * color)
 {
     if (V->image_) {
@@ -1313,7 +2298,7 @@ static void vantageRenderInfo(Vantage * V, float left, float top, float fontHeig
         int depth = V->image_->depth;
 
         int fileSize = 0;
-        if (V->imageDiff_) {
+        if (V->image2_) {
             switch (V->diffMode_) {
                 case DIFFMODE_SHOW1:
                     fileSize = V->imageFileSize_;
@@ -1350,7 +2335,7 @@ static void vantageRenderInfo(Vantage * V, float left, float top, float fontHeig
             }
         }
 
-        if (V->imageDiff_) {
+        if (V->image2_) {
             const char * showing = "??";
             switch (V->diffMode_) {
                 case DIFFMODE_SHOW1:
@@ -1363,7 +2348,26 @@ static void vantageRenderInfo(Vantage * V, float left, float top, float fontHeig
                     showing = "Diff";
                     break;
             }
-            vantageRenderNextLine(V, "Showing        : %s", showing);
+            vantageRenderNextLine(V, "Showing        : %s%s", showing, V->flicker_ ? " (flicker)" : "");
+        }
+
+        clImage * shownSource = V->shownSource_;
+        if (shownSource && !vantageUpdateLightLevels(V, shownSource)) {
+            vantageRenderNextLine(V, "Light Levels   : measuring...");
+        } else if (shownSource && V->lightLevelsValid_) {
+            const HDRLightLevels * levels = &V->lightLevels_;
+            const HDRContentLightLevel * clli = (shownSource == V->image2_) ? &V->imageCLLI2_ : &V->imageCLLI_;
+            vantageRenderNextLine(V, "MaxCLL         : %.1f nits", levels->maxCLL);
+            vantageRenderNextLine(V, "MaxFALL        : %.1f nits", levels->maxFALL);
+            vantageRenderNextLine(V, "Nits P50 / P90 : %.2f / %.2f", levels->p50, levels->p90);
+            vantageRenderNextLine(V, "Nits P99 / 99.9: %.1f / %.1f", levels->p99, levels->p999);
+            if (clli->present) {
+                vantageRenderNextLine(V,
+                                      "CLLI           : %.0f / %.0f nits (%s)",
+                                      clli->maxCLL,
+                                      clli->maxFALL,
+                                      hdrContentLightLevelValid(clli, levels) ? "ok" : "exceeded");
+            }
         }
     }
 
@@ -1430,9 +2434,17 @@ static void vantageRenderInfo(Vantage * V, float left, float top, float fontHeig
         }
     }
 
-    if (V->srgbHighlight_ && V->highlightInfo_) {
-        if ((V->imageInfoX_ != -1) && (V->imageInfoY_ != -1)) {
-            clImageHDRPixel * highlightPixel = &V->highlightInfo_->pixels[V->imageInfoX_ + (V->imageInfoY_ * V->image_->width)];
+    if (V->srgbHighlight_ && V->highlightSource_) {
+        if ((V->imageInfoX_ != -1) && (V->imageInfoY_ != -1) &&
+            ((V->highlightPixelX_ != V->imageInfoX_) || (V->highlightPixelY_ != V->imageInfoY_))) {
+            if (hdrMeasurePixel(V->C, V->highlightSource_, V->srgbLuminance_, V->imageInfoX_, V->imageInfoY_, &V->highlightPixel_)) {
+                V->highlightPixelX_ = V->imageInfoX_;
+                V->highlightPixelY_ = V->imageInfoY_;
+            }
+        }
+        if ((V->imageInfoX_ != -1) && (V->imageInfoY_ != -1) && (V->highlightPixelX_ == V->imageInfoX_) &&
+            (V->highlightPixelY_ == V->imageInfoY_)) {
+            clImageHDRPixel * highlightPixel = &V->highlightPixel_;
             float outOfGamut = CL_CLAMP(highlightPixel->saturation - 1.0f, 0.0f, 1.0f);
             vantageRenderNextLine(V, "");
             vantageRenderNextLine(V, "Pixel Highlight:");
@@ -1468,10 +2480,16 @@ static void vantageRenderInfo(Vantage * V, float left, float top, float fontHeig
     if (V->imageDiff_ && (V->diffMode_ == DIFFMODE_SHOWDIFF)) {
         vantageRenderNextLine(V, "");
         vantageRenderNextLine(V, "Threshold      : %d", V->diffThreshold_);
-        vantageRenderNextLine(V, "Largest Diff   : %d", V->imageDiff_->largestChannelDiff);
+        vantageRenderNextLine(V,
+                              "Largest Diff   : %d%s",
+                              V->imageDiff_->largestChannelDiff,
+                              V->imageDiff_->identical ? " (identical)" : "");
         if ((V->imageInfoX_ != -1) && (V->imageInfoY_ != -1)) {
-            int diff = V->imageDiff_->diffs[V->imageInfoX_ + (V->imageInfoY_ * V->imageDiff_->image->width)];
-            vantageRenderNextLine(V, "Pixel Diff     : %d", diff);
+            int pixelIndex = V->imageInfoX_ + (V->imageInfoY_ * V->image_->width);
+            vantageRenderNextLine(V, "Pixel Diff     : %d", V->imageDiff_->levels ? diffLevelAt(&V->imageDiff_->levels[0], V->imageInfoX_, V->imageInfoY_) : 0);
+            if (V->diffMetrics_) {
+                vantageRenderNextLine(V, "Pixel dE ITP   : %.2f", V->diffMetrics_->deltaEITP[pixelIndex]);
+            }
         }
 
         vantageRenderNextLine(V, "");
@@ -1488,6 +2506,23 @@ static void vantageRenderInfo(Vantage * V, float left, float top, float fontHeig
                               "Over Threshold : %7d (%.1f%%)",
                               V->imageDiff_->overThresholdCount,
                               (100.0f * (float)V->imageDiff_->overThresholdCount / V->imageDiff_->pixelCount));
+        if (V->diffRegions_) {
+            vantageRenderNextLine(V, "Regions        : %7d", V->diffRegions_->count);
+        }
+        if (V->imageDiff_->levels) {
+            vantageRenderNextLine(V, "Diff Storage   : %.1f MB", (float)V->imageDiff_->storageBytes / (1024.0f * 1024.0f));
+        }
+
+        if (V->diffMetrics_) {
+            DiffMetrics * metrics = V->diffMetrics_;
+            vantageRenderNextLine(V, "");
+            vantageRenderNextLine(V, "PSNR           : %.2f dB", metrics->psnr);
+            vantageRenderNextLine(V, "PSNR (PQ)      : %.2f dB", metrics->psnrPQ);
+            vantageRenderNextLine(V, "SSIM (PQ)      : %.5f", metrics->ssim);
+            vantageRenderNextLine(V, "MS-SSIM (PQ)   : %.5f", metrics->msssim);
+            vantageRenderNextLine(V, "dE ITP         : %.2f mean, %.2f max", metrics->deltaEITPMean, metrics->deltaEITPMax);
+            vantageRenderNextLine(V, "dE 2000        : %.2f mean, %.2f max", metrics->deltaE2000Mean, metrics->deltaE2000Max);
+        }
     }
 }
 
@@ -1498,6 +2533,7 @@ void vantageRender(Vantage * V)
 
     daClear(&V->blits_, NULL);
     daClear(&V->activeControls_, NULL);
+    V->timelineW_ = 0;
 
     V->wantedHDR_ = V->wantsHDR_;
     V->wantsHDR_ = !V->tonemapSlidersEnabled_;
@@ -1507,6 +2543,19 @@ void vantageRender(Vantage * V)
         vantagePrepareImage(V);
     }
 
+    if (V->flicker_ && V->image2_ && ((now() - V->flickerStart_) >= FLICKER_INTERVAL)) {
+        // Both images stay prepared (and uploaded) after the first round, so a flip is a pointer swap
+        V->flickerStart_ = now();
+        vantageSetDiffMode(V, (V->diffMode_ == DIFFMODE_SHOW1) ? DIFFMODE_SHOW2 : DIFFMODE_SHOW1);
+    }
+
+    prepareTaskReap(&V->abandonedPrepares_, 0);
+
+    // Zooming in needs the real pixels, so stop waiting on the background prepare
+    if (V->prepareTask_ && (prepareTaskFinished(V->prepareTask_) || (V->imagePosS_ > 1.0f))) {
+        vantageFinishPrepare(V);
+    }
+
     if (V->loadWaitFrames_ > 0) {
         --V->loadWaitFrames_;
         if (V->loadWaitFrames_ == 0) {
@@ -1517,7 +2566,11 @@ void vantageRender(Vantage * V)
         Color loadingTextColor = { lum, lum, lum, 1.0f };
         dsClear(&V->tempTextBuffer_);
         if ((dsLength(&V->diffFilename1_) > 0) && (dsLength(&V->diffFilename2_) > 0)) {
-            dsPrintf(&V->tempTextBuffer_, "Loading Diff: %s, %s", V->diffFilename1_, V->diffFilename2_);
+            if (V->imageVideoFrameNextIndex_ > 0) {
+                dsPrintf(&V->tempTextBuffer_, "Loading Diff: %s, %s @ Frame %d", V->diffFilename1_, V->diffFilename2_, V->imageVideoFrameNextIndex_);
+            } else {
+                dsPrintf(&V->tempTextBuffer_, "Loading Diff: %s, %s", V->diffFilename1_, V->diffFilename2_);
+            }
         } else if ((daSize(&V->filenames_) > 0) && (V->imageFileIndex_ >= 0) && (V->imageFileIndex_ < (int)daSize(&V->filenames_))) {
             if (V->imageVideoFrameNextIndex_ > 0) {
                 dsPrintf(&V->tempTextBuffer_,
@@ -1561,7 +2614,7 @@ void vantageRender(Vantage * V)
         float top = 10.0f;
 
         if ((V->imageInfoX_ != -1) || (V->imageInfoY_ != -1) || V->srgbHighlight_ || V->tonemapSlidersEnabled_ ||
-            (V->imageDiff_ && (V->diffMode_ == DIFFMODE_SHOWDIFF))) {
+            V->exposureSliderEnabled_ || (V->imageDiff_ && (V->diffMode_ == DIFFMODE_SHOWDIFF))) {
             float blackW = infoW;
             float blackH = clientH;
             Color black = { 0.0f, 0.0f, 0.0f, 0.8f };
@@ -1583,7 +2636,7 @@ void vantageRender(Vantage * V)
             float blTop = clientH - 25.0f;
             clProfile * profile = NULL;
             if (V->image_) {
-                if (V->imageDiff_) {
+                if (V->image2_) {
                     switch (V->diffMode_) {
                         case DIFFMODE_SHOW1:
                             profile = V->image_->profile;
@@ -1630,6 +2683,51 @@ void vantageRender(Vantage * V)
                 vantageBlitString(V, V->tempTextBuffer_, 10, blTop, fontHeight, &color);
             }
             blTop -= nextLine;
+
+            if (V->gainMap_) {
+                float headroom = vantageDisplayHeadroom(V);
+                int appliedPercent = (int)(gainMapWeight(V->gainMap_, headroom) * 100.0f);
+                dsPrintf(&V->tempTextBuffer_, "GainMap: %d%% applied (headroom %.2fx)", appliedPercent, headroom);
+                vantageBlitString(V, V->tempTextBuffer_, 10, blTop, fontHeight, &color);
+                blTop -= nextLine;
+            }
+
+            if (V->exposure_ != 0.0f) {
+                dsPrintf(&V->tempTextBuffer_, "Exposure: %+.1f EV", V->exposure_);
+                vantageBlitString(V, V->tempTextBuffer_, 10, blTop, fontHeight, &color);
+                blTop -= nextLine;
+            }
+
+            const float timelineW = clientW - infoW - 20.0f;
+            if (V->sequenceDiff_ && (timelineW > 0.0f)) {
+                const float timelineH = 60.0f;
+                int worstFrame = -1;
+                int worstOver = 0;
+                const int frameCount = sequenceDiffFrameCount(V->sequenceDiff_);
+                for (int i = 0; i < frameCount; ++i) {
+                    const int over = sequenceDiffOverThreshold(V->sequenceDiff_, i, V->diffThreshold_);
+                    if (over > worstOver) {
+                        worstFrame = i;
+                        worstOver = over;
+                    }
+                }
+                const int completed = sequenceDiffCompletedCount(V->sequenceDiff_);
+                if (worstFrame >= 0) {
+                    dsPrintf(&V->tempTextBuffer_,
+                             "Timeline: %d/%d frames, worst is %d (%d over threshold)",
+                             completed,
+                             frameCount,
+                             worstFrame,
+                             worstOver);
+                } else {
+                    dsPrintf(&V->tempTextBuffer_, "Timeline: %d/%d frames, none over threshold", completed, frameCount);
+                }
+                vantageBlitString(V, V->tempTextBuffer_, 10, blTop, fontHeight, &color);
+                blTop -= nextLine;
+
+                vantageRenderTimeline(V, 10.0f, blTop + fontHeight - timelineH, timelineW, timelineH, alpha);
+                blTop -= timelineH + 4.0f;
+            }
         }
 
         left += infoMargin; // right text margin
@@ -1645,29 +2743,55 @@ void vantageRender(Vantage * V)
                     imageLuminance = V->unspecLuminance_;
                 }
 
-                vantageRenderControl(V, &V->preparedTonemapContrastSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
-                blTop -= nextLine;
-                dsPrintf(&V->tempTextBuffer_, "Tonemap Contrast : %3.3f", V->preparedTonemap_.contrast);
-                vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
-                blTop -= nextLine;
-
-                vantageRenderControl(V, &V->preparedTonemapClipPointSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
-                blTop -= nextLine;
-                dsPrintf(&V->tempTextBuffer_, "Tonemap ClipPoint: %3.3f", V->preparedTonemap_.clipPoint);
-                vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
-                blTop -= nextLine;
-
-                vantageRenderControl(V, &V->preparedTonemapSpeedSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
-                blTop -= nextLine;
-                dsPrintf(&V->tempTextBuffer_, "Tonemap Speed    : %3.3f", V->preparedTonemap_.speed);
-                vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
-                blTop -= nextLine;
-
-                vantageRenderControl(V, &V->preparedTonemapPowerSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
-                blTop -= nextLine;
-                dsPrintf(&V->tempTextBuffer_, "Tonemap Power    : %3.3f", V->preparedTonemap_.power);
-                vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
-                blTop -= nextLine;
+                if (V->tonemapMode_ == TONEMAPMODE_LOCAL) {
+                    vantageRenderControl(V, &V->localTonemapCompressionSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                    blTop -= nextLine;
+                    dsPrintf(&V->tempTextBuffer_, "Local Compression: %3.2f stops", V->localTonemap_.compression);
+                    vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                    blTop -= nextLine;
+
+                    vantageRenderControl(V, &V->localTonemapDetailSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                    blTop -= nextLine;
+                    dsPrintf(&V->tempTextBuffer_, "Local Detail     : %3.2f", V->localTonemap_.detail);
+                    vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                    blTop -= nextLine;
+
+                    vantageRenderControl(V, &V->localTonemapRadiusSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                    blTop -= nextLine;
+                    dsPrintf(&V->tempTextBuffer_, "Local Radius     : %3.2f%%", V->localTonemap_.radius);
+                    vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                    blTop -= nextLine;
+
+                    vantageRenderControl(V, &V->localTonemapEdgeSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                    blTop -= nextLine;
+                    dsPrintf(&V->tempTextBuffer_, "Local Edge       : %3.2f", V->localTonemap_.edge);
+                    vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                    blTop -= nextLine;
+                } else {
+                    vantageRenderControl(V, &V->preparedTonemapContrastSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                    blTop -= nextLine;
+                    dsPrintf(&V->tempTextBuffer_, "Tonemap Contrast : %3.3f", V->preparedTonemap_.contrast);
+                    vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                    blTop -= nextLine;
+
+                    vantageRenderControl(V, &V->preparedTonemapClipPointSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                    blTop -= nextLine;
+                    dsPrintf(&V->tempTextBuffer_, "Tonemap ClipPoint: %3.3f", V->preparedTonemap_.clipPoint);
+                    vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                    blTop -= nextLine;
+
+                    vantageRenderControl(V, &V->preparedTonemapSpeedSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                    blTop -= nextLine;
+                    dsPrintf(&V->tempTextBuffer_, "Tonemap Speed    : %3.3f", V->preparedTonemap_.speed);
+                    vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                    blTop -= nextLine;
+
+                    vantageRenderControl(V, &V->preparedTonemapPowerSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                    blTop -= nextLine;
+                    dsPrintf(&V->tempTextBuffer_, "Tonemap Power    : %3.3f", V->preparedTonemap_.power);
+                    vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                    blTop -= nextLine;
+                }
 
                 vantageRenderControl(V, &V->preparedTonemapLuminanceSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
                 blTop -= nextLine;
@@ -1678,6 +2802,11 @@ void vantageRender(Vantage * V)
                          (imageLuminance > V->preparedTonemapLuminance_) ? "On" : "Off");
                 vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
                 blTop -= nextLine;
+
+                dsPrintf(&V->tempTextBuffer_, "Tonemap Mode     : %s",
+                         (V->tonemapMode_ == TONEMAPMODE_LOCAL) ? "Local" : (V->tonemapAuto_ ? "Global (Auto)" : "Global"));
+                vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                blTop -= nextLine;
             }
 
             if (V->imageVideoFrameCount_ > 1) {
@@ -1702,6 +2831,15 @@ void vantageRender(Vantage * V)
                 blTop -= nextLine;
             }
 
+            if (V->exposureSliderEnabled_) {
+                vantageRenderControl(V, &V->exposureSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
+                blTop -= nextLine;
+
+                dsPrintf(&V->tempTextBuffer_, "Exposure         : %+.1f EV", V->exposure_);
+                vantageBlitString(V, V->tempTextBuffer_, left, blTop, fontHeight, &color);
+                blTop -= nextLine;
+            }
+
             if (V->srgbHighlight_) {
                 vantageRenderControl(V, &V->srgbLuminanceSlider_, left, blTop, infoW - (infoMargin * 2), fontHeight);
                 blTop -= nextLine;
@@ -1731,6 +2869,14 @@ int vantageImageUsesLinearSampling(Vantage * V)
     return 1;
 }
 
+ImageTransfer vantageImageTransfer(Vantage * V)
+{
+    if (V->platformLinear_) {
+        return IMAGETRANSFER_LINEAR;
+    }
+    return V->imageHDR_ ? IMAGETRANSFER_PQ : IMAGETRANSFER_GAMMA22;
+}
+
 // This could potentially use clFormatDetect() instead, but that'd cause a lot of header reads.
 int vantageIsImageFile(const char * filename)
 {
@@ -7,6 +7,16 @@ extern "C" {
 
 #include "colorist/colorist.h"
 #include "dyn.h"
+#include "align.h"
+#include "diff.h"
+#include "gainmap.h"
+#include "gamut.h"
+#include "hdr.h"
+#include "metrics.h"
+#include "prepare.h"
+#include "regions.h"
+#include "sequence.h"
+#include "tonemap.h"
 
 #include "colorist/version.h"
 #include "version.h"
@@ -21,11 +31,23 @@ typedef enum DiffMode
     DIFFMODE_SHOWDIFF
 } DiffMode;
 
+// One diff mode's prepared output, kept while another mode is on screen so that switching back to
+// it (and flickering between the images) only swaps pointers. See vantagePreparedSerial().
+typedef struct PreparedSlot
+{
+    clImage * image;
+    int serial;
+    int unspecLuminance; // preparedUnspecLuminance_ that goes with image
+    int imageLuminance;
+    int diffLevel;       // diffLevel_ image was prepared at, -1 if none
+} PreparedSlot;
+
 typedef enum DiffIntensity
 {
     DIFFINTENSITY_ORIGINAL = 0,
     DIFFINTENSITY_BRIGHT,
-    DIFFINTENSITY_DIFFONLY
+    DIFFINTENSITY_DIFFONLY,
+    DIFFINTENSITY_HEATMAP // deltaE ITP heatmap from diffMetrics_
 } DiffIntensity;
 
 typedef enum BlitMode
@@ -45,6 +67,8 @@ typedef struct Color
     float a;
 } Color;
 
+// For BM_IMAGE blits, Blit.color is a linear-light gain (exposure, unspecified luminance changes).
+// Platforms whose prepared image isn't linear must apply it after decoding (see vantageImageTransfer()).
 typedef struct Blit
 {
     float sx, sy, sw, sh;
@@ -53,6 +77,13 @@ typedef struct Blit
     BlitMode mode;
 } Blit;
 
+typedef enum ImageTransfer
+{
+    IMAGETRANSFER_LINEAR = 0,
+    IMAGETRANSFER_GAMMA22,
+    IMAGETRANSFER_PQ
+} ImageTransfer;
+
 typedef enum ControlType
 {
     CONTROLTYPE_SLIDER = 0
@@ -63,6 +94,7 @@ typedef enum ControlFlags
     CONTROLFLAG_PREPARE = (1 << 0),
     CONTROLFLAG_RELOAD = (1 << 1),
     CONTROLFLAG_FLOAT = (1 << 2), // value is actually a float, slider is in thousandths
+    CONTROLFLAG_GAIN = (1 << 3),  // value feeds the display gain, only prepare on release if the gain can't express it
 } ControlFlags;
 
 typedef struct Control
@@ -94,23 +126,64 @@ typedef struct Vantage
     DiffMode diffMode_;
     DiffIntensity diffIntensity_;
     int diffThreshold_;
+    int diffLevel_; // diff pyramid level on screen, -1 if none
+    int flicker_;   // bool, alternate between image 1 and 2 on a timer
+    double flickerStart_;
     int srgbHighlight_;
     int srgbLuminance_;
     int unspecLuminance_;
+    float exposure_; // EV, applied at draw time
 
     // Colorist objects
     clContext * C;
     clImage * image_;
     clImage * image2_;
+    GainMap * gainMap_;         // image_ is the SDR base of a gain map image
+    clImage * gainMapApplied_;  // image_ with gainMap_ applied for gainMapHeadroom_
+    float gainMapHeadroom_;
+    int gainMapLuminance_;      // unspecLuminance_ when gainMapApplied_ was built
     clProfile * forcedProfile_;
     clImage * imageFont_;
     clImage * imageCIEBackground_;
     clImage * imageCIECrosshair_;
-    clImageDiff * imageDiff_;
+    ImageDiff * imageDiff_;
+    DiffMetrics * diffMetrics_; // computed once per diff pair
+    DiffRegions * diffRegions_; // over threshold regions, redone when the threshold changes
+    int diffRegionIndex_;       // region last jumped to, -1 if none
+    SequenceDiff * sequenceDiff_; // per frame stats when the diff pair are sequences, kept across frame steps
     clImage * imageHighlight_;
+    clImage * localTonemapped_;       // localTonemappedSource_ run through tonemapLocal() (NULL if that failed)
+    clImage * localTonemappedSource_; // source before any gamut compression
+    int localTonemappedGamut_;        // whether the source was gamut compressed first
+    int localTonemappedLuminance_;
+    LocalTonemapParams localTonemappedParams_;
+    clImage * gamutCompressed_;       // gamutCompressedSource_ run through gamutCompress()
+    clImage * gamutCompressedSource_;
     clImage * preparedImage_;
-    clImageHDRPixelInfo * highlightInfo_;
+    PrepareTask * prepareTask_; // full resolution prepare in flight, preparedImage_ is a proxy until it finishes
+    PrepareTask * abandonedPrepares_; // cancelled prepares still winding down, see prepareTaskReap()
+    PrepareStages prepareStages_;     // what prepareTask_ runs before converting
+    clImage * prepareStagesSource_;   // prepareTask_'s source before any stage, the key for caching their results
+    int prepareStagesGamut_;          // whether prepareTask_'s source was gamut compressed, cached or not
+    PreparedFormat preparedFormat_; // pixel layout of preparedImage_
+    int preparedSerial_;            // unique per preparedImage_, 0 if there is none
+    int preparedSerialNext_;
+    PreparedSlot preparedSlots_[3]; // per DiffMode, the slot of the mode on screen is always empty
+    HDRPlanes * highlightPlanes_; // highlightSource_ measured once, so threshold changes only reclassify it
+    HDRPlanes * highlightProxyPlanes_; // highlightPlanes_ sampled down to the window while dragging the threshold
+    int highlightLuminance_;      // srgbLuminance_ imageHighlight_ was made at
+    int prepareLive_;             // bool, prepare a proxy only (while dragging), the full resolution waits for the release
+    clImage * highlightSource_; // image imageHighlight_ was measured from, borrowed until the next prepare
+    clImage * shownSource_;     // image on screen before any highlight, tonemapping or gamut compression, NULL for a diff
+    HDRLightLevels lightLevels_; // of shownSource_ at unspecLuminance_, measured the first time the info panel shows it
+    int lightLevelsValid_;
+    HDRLightLevelsTask * lightLevelsTask_; // measuring lightLevels_ in the background, see vantageUpdateLightLevels()
+    HDRContentLightLevel imageCLLI_;  // declared by image_'s file
+    HDRContentLightLevel imageCLLI2_; // declared by image2_'s file
     clImageHDRStats highlightStats_;
+    clImageHDRPixel highlightPixel_; // hdrMeasurePixel() at (highlightPixelX_, highlightPixelY_), both -1 until measured
+    int highlightPixelX_;
+    int highlightPixelY_;
     clImagePixelInfo pixelInfo_;
     clImagePixelInfo pixelInfo2_;
 
@@ -122,9 +195,15 @@ typedef struct Vantage
     int imageHDR_;
     int imageLuminance_;
     int imageDirty_;
+    int imageCIEBackgroundDirty_;
+    int preparedUnspecLuminance_; // unspecLuminance_ baked into preparedImage_, 0 if its luminance was specified
     int imageVideoFrameNextIndex_;
     int imageVideoFrameIndex_;
     int imageVideoFrameCount_;
+    int timelineX_; // sequence diff timeline as last drawn, 0 wide if it wasn't
+    int timelineY_;
+    int timelineW_;
+    int timelineH_;
     float imagePosX_; // x
     float imagePosY_; // y
     float imagePosW_; // width
@@ -141,6 +220,16 @@ typedef struct Vantage
     Control preparedTonemapPowerSlider_;
     Control preparedTonemapLuminanceSlider_;
     int tonemapSlidersEnabled_;
+    GamutMode gamutMode_;
+    int tonemapAuto_;                  // bool, refit preparedTonemap_ to each new source
+    clImage * tonemapAutoSource_;      // source (before any gamut compression) preparedTonemap_ was last fitted to
+    int tonemapAutoGamut_;             // whether that fit was of the gamut compressed source
+    TonemapMode tonemapMode_;
+    LocalTonemapParams localTonemap_;
+    Control localTonemapCompressionSlider_;
+    Control localTonemapDetailSlider_;
+    Control localTonemapRadiusSlider_;
+    Control localTonemapEdgeSlider_;
 
     // Mouse tracking
     int dragging_;
@@ -152,6 +241,8 @@ typedef struct Vantage
     Control srgbLuminanceSlider_;
     Control unspecLuminanceSlider_;
     Control imageVideoFrameIndexSlider_;
+    Control exposureSlider_;
+    int exposureSliderEnabled_;
 
     // Loading state (rendering hack)
     int loadWaitFrames_;
@@ -210,8 +301,17 @@ void vantageToggleSrgbHighlight(Vantage * V);
 void vantageSetVideoFrameIndex(Vantage * V, int videoFrameIndex);
 void vantageSetVideoFrameIndexPercentOffset(Vantage * V, int percentOffset);
 void vantageToggleTonemapSliders(Vantage * V);
+void vantageToggleLocalTonemap(Vantage * V);
+void vantageToggleAutoTonemap(Vantage * V);
+void vantageFitTonemapToReference(Vantage * V);
+void vantageToggleGamutCompression(Vantage * V);
+void vantageToggleFlicker(Vantage * V);
+void vantageNextDiffRegion(Vantage * V);
+void vantagePrevDiffRegion(Vantage * V);
 void vantageToggleMaxEDRClip(Vantage * V);
 void vantageSetUnspecLuminance(Vantage * V, int unspecLuminance);
+void vantageToggleExposureSlider(Vantage * V);
+void vantageResetExposure(Vantage * V);
 
 // Positioning
 void vantageCalcCenteredImagePos(Vantage * V, float * posX, float * posY);
@@ -237,6 +337,11 @@ void vantagePlatformSetMaxEDR(Vantage * V, float maxEDR);
 void vantagePrepareImage(Vantage * V);
 void vantageRender(Vantage * V);
 int vantageImageUsesLinearSampling(Vantage * V); // Returns nonzero if images should render with linear sampling
+ImageTransfer vantageImageTransfer(Vantage * V);   // How preparedImage_ is encoded
+
+// Platforms keep a texture per DiffMode. When imageDirty_ is set, any texture whose serial no longer
+// matches this is stale, and diffMode_'s is (re)uploaded from preparedImage_. 0 means no image.
+int vantagePreparedSerial(Vantage * V, DiffMode diffMode);
 
 // Helpers
 int vantageIsImageFile(const char * filename);
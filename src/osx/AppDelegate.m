@@ -88,6 +88,42 @@
     [[NSNotificationCenter defaultCenter] postNotificationName:@"toggleTonemapSliders" object:self];
 }
 
+// View / Toggle Local Tonemap
+- (IBAction)toggleLocalTonemap:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"toggleLocalTonemap" object:self];
+}
+
+// View / Toggle Auto Tonemap
+- (IBAction)toggleAutoTonemap:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"toggleAutoTonemap" object:self];
+}
+
+// View / Fit Tonemap To Reference
+- (IBAction)fitTonemapToReference:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"fitTonemapToReference" object:self];
+}
+
+// View / Toggle Gamut Compression
+- (IBAction)toggleGamutCompression:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"toggleGamutCompression" object:self];
+}
+
+// View / Toggle Exposure Slider
+- (IBAction)toggleExposureSlider:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"toggleExposureSlider" object:self];
+}
+
+// View / Reset Exposure
+- (IBAction)resetExposure:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"resetExposure" object:self];
+}
+
 // View / Toggle MaxEDR Clip
 - (IBAction)toggleMaxEDRClip:sender
 {
@@ -172,6 +208,30 @@
     [[NSNotificationCenter defaultCenter] postNotificationName:@"diffIntensityDiffOnly" object:self];
 }
 
+// Diff / Diff Intensity: Heatmap
+- (IBAction)diffIntensityHeatmap:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"diffIntensityHeatmap" object:self];
+}
+
+// Diff / Next Diff Region
+- (IBAction)nextDiffRegion:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"nextDiffRegion" object:self];
+}
+
+// Diff / Previous Diff Region
+- (IBAction)previousDiffRegion:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"previousDiffRegion" object:self];
+}
+
+// Diff / Toggle Flicker
+- (IBAction)toggleFlicker:sender
+{
+    [[NSNotificationCenter defaultCenter] postNotificationName:@"toggleFlicker" object:self];
+}
+
 // Diff / Adjust Threshold +1
 - (IBAction)adjustThresholdP1:sender
 {
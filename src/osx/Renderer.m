@@ -27,7 +27,9 @@ static const int MACOS_SDR_WHITE_NITS = 100;
     id<MTLDevice> device_;
     id<MTLCommandQueue> commandQueue_;
     id<MTLRenderPipelineState> pipelineState_;
-    id<MTLTexture> metalPreparedImage_;
+    id<MTLTexture> metalPreparedImages_[3]; // one per DiffMode, see vantagePreparedSerial()
+    int metalPreparedSerials_[3];
+    id<MTLTexture> metalPreparedImage_; // metalPreparedImages_[V->diffMode_]
     id<MTLTexture> metalFontImage_;
     id<MTLTexture> metalCIEBackgroundImage_;
     id<MTLTexture> metalCIECrosshairImage_;
@@ -205,6 +207,12 @@ static const int MACOS_SDR_WHITE_NITS = 100;
     [center addObserver:self selector:@selector(nextImage:) name:@"nextImage" object:nil];
     [center addObserver:self selector:@selector(toggleSRGB:) name:@"toggleSRGB" object:nil];
     [center addObserver:self selector:@selector(toggleTonemapSliders:) name:@"toggleTonemapSliders" object:nil];
+    [center addObserver:self selector:@selector(toggleLocalTonemap:) name:@"toggleLocalTonemap" object:nil];
+    [center addObserver:self selector:@selector(toggleAutoTonemap:) name:@"toggleAutoTonemap" object:nil];
+    [center addObserver:self selector:@selector(fitTonemapToReference:) name:@"fitTonemapToReference" object:nil];
+    [center addObserver:self selector:@selector(toggleGamutCompression:) name:@"toggleGamutCompression" object:nil];
+    [center addObserver:self selector:@selector(toggleExposureSlider:) name:@"toggleExposureSlider" object:nil];
+    [center addObserver:self selector:@selector(resetExposure:) name:@"resetExposure" object:nil];
     [center addObserver:self selector:@selector(showOverlay:) name:@"showOverlay" object:nil];
     [center addObserver:self selector:@selector(hideOverlay:) name:@"hideOverlay" object:nil];
     [center addObserver:self selector:@selector(diffCurrentImageAgainst:) name:@"diffCurrentImageAgainst" object:nil];
@@ -218,6 +226,10 @@ static const int MACOS_SDR_WHITE_NITS = 100;
     [center addObserver:self selector:@selector(diffIntensityOriginal:) name:@"diffIntensityOriginal" object:nil];
     [center addObserver:self selector:@selector(diffIntensityBright:) name:@"diffIntensityBright" object:nil];
     [center addObserver:self selector:@selector(diffIntensityDiffOnly:) name:@"diffIntensityDiffOnly" object:nil];
+    [center addObserver:self selector:@selector(diffIntensityHeatmap:) name:@"diffIntensityHeatmap" object:nil];
+    [center addObserver:self selector:@selector(nextDiffRegion:) name:@"nextDiffRegion" object:nil];
+    [center addObserver:self selector:@selector(previousDiffRegion:) name:@"previousDiffRegion" object:nil];
+    [center addObserver:self selector:@selector(toggleFlicker:) name:@"toggleFlicker" object:nil];
     [center addObserver:self selector:@selector(adjustThresholdP1:) name:@"adjustThresholdP1" object:nil];
     [center addObserver:self selector:@selector(adjustThresholdP5:) name:@"adjustThresholdP5" object:nil];
     [center addObserver:self selector:@selector(adjustThresholdP50:) name:@"adjustThresholdP50" object:nil];
@@ -275,6 +287,36 @@ static const int MACOS_SDR_WHITE_NITS = 100;
     vantageToggleTonemapSliders(V);
 }
 
+- (void)toggleLocalTonemap:(NSNotification *)notification
+{
+    vantageToggleLocalTonemap(V);
+}
+
+- (void)toggleAutoTonemap:(NSNotification *)notification
+{
+    vantageToggleAutoTonemap(V);
+}
+
+- (void)fitTonemapToReference:(NSNotification *)notification
+{
+    vantageFitTonemapToReference(V);
+}
+
+- (void)toggleGamutCompression:(NSNotification *)notification
+{
+    vantageToggleGamutCompression(V);
+}
+
+- (void)toggleExposureSlider:(NSNotification *)notification
+{
+    vantageToggleExposureSlider(V);
+}
+
+- (void)resetExposure:(NSNotification *)notification
+{
+    vantageResetExposure(V);
+}
+
 - (void)showOverlay:(NSNotification *)notification
 {
     vantageKickOverlay(V);
@@ -409,6 +451,26 @@ static const int MACOS_SDR_WHITE_NITS = 100;
     vantageSetDiffIntensity(V, DIFFINTENSITY_DIFFONLY);
 }
 
+- (void)diffIntensityHeatmap:(NSNotification *)notification
+{
+    vantageSetDiffIntensity(V, DIFFINTENSITY_HEATMAP);
+}
+
+- (void)nextDiffRegion:(NSNotification *)notification
+{
+    vantageNextDiffRegion(V);
+}
+
+- (void)previousDiffRegion:(NSNotification *)notification
+{
+    vantagePrevDiffRegion(V);
+}
+
+- (void)toggleFlicker:(NSNotification *)notification
+{
+    vantageToggleFlicker(V);
+}
+
 - (void)adjustThresholdP1:(NSNotification *)notification
 {
     vantageAdjustThreshold(V, 1);
@@ -642,12 +704,38 @@ static const int MACOS_SDR_WHITE_NITS = 100;
     if (V->imageDirty_) {
         V->imageDirty_ = 0;
 
-        metalPreparedImage_ = nil;
-        if (V->preparedImage_) {
-            clImagePrepareReadPixels(V->C, V->preparedImage_, CL_PIXELFORMAT_U16);
+        // Flipping back to a diff mode that's still prepared reuses its texture
+        for (int slot = 0; slot < 3; ++slot) {
+            if (metalPreparedSerials_[slot] != vantagePreparedSerial(V, (DiffMode)slot)) {
+                metalPreparedImages_[slot] = nil;
+                metalPreparedSerials_[slot] = 0;
+            }
+        }
+        metalPreparedImage_ = metalPreparedImages_[V->diffMode_];
+
+        if (V->preparedImage_ && (metalPreparedImage_ == nil)) {
+            MTLPixelFormat pixelFormat = MTLPixelFormatRGBA16Unorm;
+            const void * pixels = NULL;
+            NSUInteger pixelBytes = 8;
+            switch (V->preparedFormat_) {
+                case PREPAREDFORMAT_RGBA16:
+                    clImagePrepareReadPixels(V->C, V->preparedImage_, CL_PIXELFORMAT_U16);
+                    pixels = V->preparedImage_->pixelsU16;
+                    break;
+                case PREPAREDFORMAT_RGB10A2:
+                    pixelFormat = MTLPixelFormatRGB10A2Unorm;
+                    pixels = V->preparedImage_->pixelsU8;
+                    pixelBytes = 4;
+                    break;
+                case PREPAREDFORMAT_RGBA8:
+                    pixelFormat = MTLPixelFormatRGBA8Unorm;
+                    pixels = V->preparedImage_->pixelsU8;
+                    pixelBytes = 4;
+                    break;
+            }
 
             MTLTextureDescriptor * textureDescriptor = [[MTLTextureDescriptor alloc] init];
-            textureDescriptor.pixelFormat = MTLPixelFormatRGBA16Unorm;
+            textureDescriptor.pixelFormat = pixelFormat;
             textureDescriptor.width = V->preparedImage_->width;
             textureDescriptor.height = V->preparedImage_->height;
 
@@ -656,11 +744,16 @@ static const int MACOS_SDR_WHITE_NITS = 100;
             [metalPreparedImage_ replaceRegion:region
                                    mipmapLevel:0
                                          slice:0
-                                     withBytes:V->preparedImage_->pixelsU16
-                                   bytesPerRow:8 * V->preparedImage_->width
+                                     withBytes:pixels
+                                   bytesPerRow:pixelBytes * V->preparedImage_->width
                                  bytesPerImage:0];
+            metalPreparedImages_[V->diffMode_] = metalPreparedImage_;
+            metalPreparedSerials_[V->diffMode_] = V->preparedSerial_;
         }
+    }
 
+    if (V->imageCIEBackgroundDirty_) {
+        V->imageCIEBackgroundDirty_ = 0;
         [self _updateCIEBackground];
     }
 
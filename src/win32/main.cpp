@@ -55,6 +55,7 @@ struct ConstantBuffer
     XMMATRIX transform;
     XMFLOAT4 color;
     XMFLOAT4 texOffsetScale;
+    XMFLOAT4 transfer;
 };
 struct SimpleVertex
 {
@@ -80,7 +81,9 @@ static ID3D11Buffer * indexBuffer_;
 static ID3D11SamplerState * samplerPoint_;
 static ID3D11SamplerState * samplerLinear_;
 static ID3D11BlendState * blend_;
-static ID3D11ShaderResourceView * image_;
+static ID3D11ShaderResourceView * images_[3]; // one per DiffMode, see vantagePreparedSerial()
+static int imageSerials_[3];
+static ID3D11ShaderResourceView * image_; // images_[V->diffMode_]
 static ID3D11ShaderResourceView * font_;
 static ID3D11ShaderResourceView * cieBackground_;
 static ID3D11ShaderResourceView * cieCrosshair_;
@@ -379,9 +382,27 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM l
                 case 115: // S
                     vantageToggleSrgbHighlight(V);
                     break;
+                case 101: // E
+                    vantageToggleExposureSlider(V);
+                    break;
+                case 69: // Shift+E
+                    vantageResetExposure(V);
+                    break;
                 case 116: // T
                     vantageToggleTonemapSliders(V);
                     break;
+                case 108: // L
+                    vantageToggleLocalTonemap(V);
+                    break;
+                case 97: // A
+                    vantageToggleAutoTonemap(V);
+                    break;
+                case 65: // Shift+A
+                    vantageFitTonemapToReference(V);
+                    break;
+                case 107: // K
+                    vantageToggleGamutCompression(V);
+                    break;
 
                 case 122: // Z
                     vantageSetDiffIntensity(V, DIFFINTENSITY_ORIGINAL);
@@ -392,6 +413,18 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM l
                 case 99: // C
                     vantageSetDiffIntensity(V, DIFFINTENSITY_DIFFONLY);
                     break;
+                case 118: // V
+                    vantageSetDiffIntensity(V, DIFFINTENSITY_HEATMAP);
+                    break;
+                case 110: // N
+                    vantageNextDiffRegion(V);
+                    break;
+                case 78: // Shift+N
+                    vantagePrevDiffRegion(V);
+                    break;
+                case 98: // B
+                    vantageToggleFlicker(V);
+                    break;
 
                 case 32: // Space
                     vantageKickOverlay(V);
@@ -505,6 +538,24 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM l
                 case ID_VIEW_TOGGLETONEMAPSLIDERS:
                     vantageToggleTonemapSliders(V);
                     break;
+                case ID_VIEW_TOGGLELOCALTONEMAP:
+                    vantageToggleLocalTonemap(V);
+                    break;
+                case ID_VIEW_TOGGLEAUTOTONEMAP:
+                    vantageToggleAutoTonemap(V);
+                    break;
+                case ID_VIEW_FITTONEMAPTOREFERENCE:
+                    vantageFitTonemapToReference(V);
+                    break;
+                case ID_VIEW_TOGGLEGAMUTCOMPRESSION:
+                    vantageToggleGamutCompression(V);
+                    break;
+                case ID_VIEW_TOGGLEEXPOSURESLIDER:
+                    vantageToggleExposureSlider(V);
+                    break;
+                case ID_VIEW_RESETEXPOSURE:
+                    vantageResetExposure(V);
+                    break;
 
                 case ID_DIFF_DIFFCURRENTIMAGEAGAINST:
                     diffOpen();
@@ -529,6 +580,18 @@ static LRESULT CALLBACK WndProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM l
                 case ID_DIFF_DIFFINTENSITY_DIFFONLY:
                     vantageSetDiffIntensity(V, DIFFINTENSITY_DIFFONLY);
                     break;
+                case ID_DIFF_DIFFINTENSITY_HEATMAP:
+                    vantageSetDiffIntensity(V, DIFFINTENSITY_HEATMAP);
+                    break;
+                case ID_DIFF_NEXTDIFFREGION:
+                    vantageNextDiffRegion(V);
+                    break;
+                case ID_DIFF_PREVIOUSDIFFREGION:
+                    vantagePrevDiffRegion(V);
+                    break;
+                case ID_DIFF_TOGGLEFLICKER:
+                    vantageToggleFlicker(V);
+                    break;
 
                 case ID_DIFF_ADJUSTTHRESHOLDM1:
                     vantageAdjustThreshold(V, -1);
@@ -1171,10 +1234,14 @@ static void destroyDevice()
         context_ = nullptr;
     }
 
-    if (image_) {
-        image_->Release();
-        image_ = nullptr;
+    for (int slot = 0; slot < 3; ++slot) {
+        if (images_[slot]) {
+            images_[slot]->Release();
+            images_[slot] = nullptr;
+        }
+        imageSerials_[slot] = 0;
     }
+    image_ = nullptr;
 
     if (font_) {
         font_->Release();
@@ -1286,38 +1353,62 @@ static void render()
     bool showHLG = false;
 
     if (V->imageDirty_) {
-        if (image_) {
-            image_->Release();
-            image_ = NULL;
+        // Flipping back to a diff mode that's still prepared reuses its texture
+        for (int slot = 0; slot < 3; ++slot) {
+            if (images_[slot] && (imageSerials_[slot] != vantagePreparedSerial(V, (DiffMode)slot))) {
+                images_[slot]->Release();
+                images_[slot] = NULL;
+                imageSerials_[slot] = 0;
+            }
         }
+        image_ = images_[V->diffMode_];
+
+        if (V->preparedImage_ && !image_) {
+            DXGI_FORMAT format = DXGI_FORMAT_R16G16B16A16_UNORM;
+            const void * pixels = NULL;
+            UINT pixelBytes = 8;
+            switch (V->preparedFormat_) {
+                case PREPAREDFORMAT_RGBA16:
+                    clImagePrepareReadPixels(V->C, V->preparedImage_, CL_PIXELFORMAT_U16);
+                    pixels = (const void *)V->preparedImage_->pixelsU16;
+                    break;
+                case PREPAREDFORMAT_RGB10A2:
+                    format = DXGI_FORMAT_R10G10B10A2_UNORM;
+                    pixels = (const void *)V->preparedImage_->pixelsU8;
+                    pixelBytes = 4;
+                    break;
+                case PREPAREDFORMAT_RGBA8:
+                    format = DXGI_FORMAT_R8G8B8A8_UNORM;
+                    pixels = (const void *)V->preparedImage_->pixelsU8;
+                    pixelBytes = 4;
+                    break;
+            }
 
-        if (V->preparedImage_) {
             D3D11_TEXTURE2D_DESC desc;
             ZeroMemory(&desc, sizeof(desc));
             desc.Width = static_cast<UINT>(V->preparedImage_->width);
             desc.Height = static_cast<UINT>(V->preparedImage_->height);
             desc.MipLevels = static_cast<UINT>(1);
             desc.ArraySize = static_cast<UINT>(1);
-            desc.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+            desc.Format = format;
             desc.SampleDesc.Count = 1;
             desc.SampleDesc.Quality = 0;
             desc.Usage = D3D11_USAGE_DEFAULT;
             desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
             desc.CPUAccessFlags = 0;
 
-            clImagePrepareReadPixels(V->C, V->preparedImage_, CL_PIXELFORMAT_U16);
             D3D11_SUBRESOURCE_DATA initData;
             ZeroMemory(&initData, sizeof(initData));
-            initData.pSysMem = (const void *)V->preparedImage_->pixelsU16;
-            initData.SysMemPitch = V->preparedImage_->width * 4 * 2;
-            initData.SysMemSlicePitch = static_cast<UINT>(V->preparedImage_->width * V->preparedImage_->height * 4 * 2);
+            initData.pSysMem = pixels;
+            initData.SysMemPitch = V->preparedImage_->width * pixelBytes;
+            initData.SysMemSlicePitch = static_cast<UINT>(V->preparedImage_->width * V->preparedImage_->height * pixelBytes);
 
             ID3D11Texture2D * tex = NULL;
             HRESULT hr = device_->CreateTexture2D(&desc, &initData, &tex);
             if (SUCCEEDED(hr) && (tex != NULL)) {
                 D3D11_SHADER_RESOURCE_VIEW_DESC SRVDesc;
                 memset(&SRVDesc, 0, sizeof(SRVDesc));
-                SRVDesc.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+                SRVDesc.Format = format;
                 SRVDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
                 SRVDesc.Texture2D.MipLevels = 1;
 
@@ -1328,12 +1419,18 @@ static void render()
                     vantageUnload(V);
                     return;
                 }
+                images_[V->diffMode_] = image_;
+                imageSerials_[V->diffMode_] = V->preparedSerial_;
             }
             if (tex) {
                 tex->Release();
             }
         }
 
+        V->imageDirty_ = 0;
+    }
+
+    if (V->imageCIEBackgroundDirty_) {
         if (cieBackground_) {
             cieBackground_->Release();
             cieBackground_ = NULL;
@@ -1381,7 +1478,7 @@ static void render()
             }
         }
 
-        V->imageDirty_ = 0;
+        V->imageCIEBackgroundDirty_ = 0;
     }
 
     context_->OMSetRenderTargets(1, &renderTarget_, nullptr);
@@ -1403,6 +1500,7 @@ static void render()
         cb.transform *= XMMatrixOrthographicOffCenterRH(0.0f, 1.0f, 1.0f, 0.0f, -1.0f, 1.0f);
         cb.color = XMFLOAT4(blit->color.r, blit->color.g, blit->color.b, blit->color.a);
         cb.texOffsetScale = XMFLOAT4(blit->sx, blit->sy, blit->sw, blit->sh);
+        cb.transfer = XMFLOAT4((blit->mode == BM_IMAGE) ? (float)vantageImageTransfer(V) : 0.0f, 0.0f, 0.0f, 0.0f);
         context_->UpdateSubresource(constantBuffer_, 0, nullptr, &cb, 0, 0);
 
         UINT stride = sizeof(SimpleVertex);
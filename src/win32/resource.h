@@ -54,6 +54,16 @@
 #define ID_VIEW_TOGGLETONEMAPSLIDERS    32811
 #define ID_FILE_FORCEPROFILE            32812
 #define ID_FILE_CLEARFORCEDPROFILE      32813
+#define ID_VIEW_TOGGLEEXPOSURESLIDER    32814
+#define ID_VIEW_RESETEXPOSURE           32815
+#define ID_VIEW_TOGGLELOCALTONEMAP      32816
+#define ID_VIEW_TOGGLEAUTOTONEMAP       32817
+#define ID_VIEW_FITTONEMAPTOREFERENCE   32818
+#define ID_VIEW_TOGGLEGAMUTCOMPRESSION  32819
+#define ID_DIFF_DIFFINTENSITY_HEATMAP   32820
+#define ID_DIFF_NEXTDIFFREGION          32821
+#define ID_DIFF_PREVIOUSDIFFREGION      32822
+#define ID_DIFF_TOGGLEFLICKER           32823
 #define IDC_STATIC                      -1
 #define IDC_INFORMATIVE                 -1
 
@@ -63,7 +73,7 @@
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        130
-#define _APS_NEXT_COMMAND_VALUE         32814
+#define _APS_NEXT_COMMAND_VALUE         32824
 #define _APS_NEXT_CONTROL_VALUE         1001
 #define _APS_NEXT_SYMED_VALUE           110
 #endif
@@ -13,6 +13,7 @@ cbuffer cb0: register (b0)
     float4x4 transform;
     float4 color;
     float4 texOffsetScale;
+    float4 transfer; // x: ImageTransfer of the sampled texture (0 = linear, 1 = gamma 2.2, 2 = PQ)
 };
 
 struct VS_INPUT
@@ -35,7 +36,33 @@ PS_INPUT VS(VS_INPUT input)
     return output;
 }
 
+static const float PQ_M1 = 0.1593017578125;
+static const float PQ_M2 = 78.84375;
+static const float PQ_C1 = 0.8359375;
+static const float PQ_C2 = 18.8515625;
+static const float PQ_C3 = 18.6875;
+
+float3 PQToLinear(float3 v)
+{
+    float3 p = pow(saturate(v), 1.0 / PQ_M2);
+    return pow(max(p - PQ_C1, 0.0) / (PQ_C2 - (PQ_C3 * p)), 1.0 / PQ_M1);
+}
+
+float3 LinearToPQ(float3 v)
+{
+    float3 p = pow(saturate(v), PQ_M1);
+    return pow((PQ_C1 + (PQ_C2 * p)) / (1.0 + (PQ_C3 * p)), PQ_M2);
+}
+
 float4 PS(PS_INPUT input) : SV_Target
 {
-    return texture0.Sample(sampler0, (input.Tex * texOffsetScale.zw) + texOffsetScale.xy) * color;
+    float4 texel = texture0.Sample(sampler0, (input.Tex * texOffsetScale.zw) + texOffsetScale.xy);
+
+    // color.rgb is a linear-light gain, so encoded textures are decoded around it
+    if (transfer.x > 1.5) {
+        return float4(LinearToPQ(PQToLinear(texel.rgb) * color.rgb), texel.a * color.a);
+    } else if (transfer.x > 0.5) {
+        return float4(pow(pow(texel.rgb, 2.2) * color.rgb, 1.0 / 2.2), texel.a * color.a);
+    }
+    return texel * color;
 }